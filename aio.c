@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+
+#include "aio.h"
+#include "file_sys.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define AIO_WORKERS 4 // 线程池线程数
+
+#define AIO_OP_READ 0  // 读
+#define AIO_OP_WRITE 1 // 写
+#define AIO_OP_FSYNC 2 // fdatasync，不读写缓冲区
+
+typedef struct aio_req {
+    int fd;                 // 文件
+    char *buf;              // 缓冲区
+    size_t n;               // 字节数
+    size_t off;             // 文件位置偏移量
+    unsigned char op;       // AIO_OP_READ / AIO_OP_WRITE / AIO_OP_FSYNC
+} aio_req;
+
+struct aio_ctx {
+    int backend;        // AIO_URING / AIO_THREADS
+    unsigned int depth; // 队列深度
+    int err;            // 上一次 aio_wait 之后是否有请求出错
+
+    // io_uring
+    int ring_fd;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    aio_req *slots;         // 在途请求，下标即 user_data
+    unsigned *free_slots;   // 空闲 slot 栈
+    unsigned free_slots_size;
+    unsigned to_submit;     // 已放入 SQ 还未提交的请求数
+
+    // 线程池
+    pthread_t workers[AIO_WORKERS];
+    pthread_mutex_t lock;
+    pthread_cond_t has_work;  // 队列非空
+    pthread_cond_t has_space; // 队列未满或全部完成
+    aio_req *queue;           // 环形队列
+    size_t queue_head;
+    size_t queue_size;
+    unsigned pending;         // 排队中和执行中的请求数
+    int stop;
+};
+
+/**
+ * 同步完成请求，用于线程池和 io_uring 部分完成的情况
+ * @return 0：成功；1：出错
+ */
+static int do_sync(const aio_req *req) {
+    if (req->op == AIO_OP_FSYNC) return fdatasync(req->fd) != 0;
+    if (req->op == AIO_OP_WRITE) return pwrite_full(req->fd, req->buf, req->n, req->off);
+    return pread_full(req->fd, req->buf, req->n, req->off);
+}
+
+static int uring_setup(aio_ctx *ctx) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int) syscall(__NR_io_uring_setup, ctx->depth, &p);
+    if (fd < 0) return 1;
+
+    ctx->ring_fd = fd;
+    ctx->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ctx->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) { // SQ 和 CQ 共用一次映射
+        if (ctx->cq_ring_size > ctx->sq_ring_size) ctx->sq_ring_size = ctx->cq_ring_size;
+        ctx->cq_ring_size = ctx->sq_ring_size;
+    }
+
+    ctx->sq_ring = mmap(NULL, ctx->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                        IORING_OFF_SQ_RING);
+    if (ctx->sq_ring == MAP_FAILED) {
+        ctx->sq_ring = NULL;
+        return 1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) ctx->cq_ring = ctx->sq_ring;
+    else {
+        ctx->cq_ring = mmap(NULL, ctx->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                            IORING_OFF_CQ_RING);
+        if (ctx->cq_ring == MAP_FAILED) {
+            ctx->cq_ring = NULL;
+            return 1;
+        }
+    }
+
+    ctx->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ctx->sqes == MAP_FAILED) {
+        ctx->sqes = NULL;
+        return 1;
+    }
+
+    char *sq = ctx->sq_ring;
+    char *cq = ctx->cq_ring;
+    ctx->sq_head = (unsigned *) (sq + p.sq_off.head);
+    ctx->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ctx->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    ctx->sq_array = (unsigned *) (sq + p.sq_off.array);
+    ctx->cq_head = (unsigned *) (cq + p.cq_off.head);
+    ctx->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    ctx->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    ctx->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    ctx->slots = malloc(ctx->depth * sizeof(aio_req));
+    ctx->free_slots = malloc(ctx->depth * sizeof(unsigned));
+    if (ctx->slots == NULL || ctx->free_slots == NULL) return 1;
+    for (unsigned i = 0; i < ctx->depth; i++) ctx->free_slots[i] = ctx->depth - 1 - i;
+    ctx->free_slots_size = ctx->depth;
+    return 0;
+}
+
+/**
+ * 收割已完成的请求，部分完成的请求剩余部分同步完成
+ */
+static void uring_reap(aio_ctx *ctx) {
+    unsigned head = *ctx->cq_head;
+    while (head != __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &ctx->cqes[head & *ctx->cq_mask];
+        aio_req *req = &ctx->slots[cqe->user_data];
+
+        if (cqe->res < 0 || (size_t) cqe->res < req->n) {
+            aio_req rest = *req;
+            size_t done = cqe->res < 0 ? 0 : (size_t) cqe->res;
+            rest.buf += done;
+            rest.n -= done;
+            rest.off += done;
+            if (do_sync(&rest)) ctx->err = 1;
+        }
+
+        ctx->free_slots[ctx->free_slots_size++] = (unsigned) cqe->user_data;
+        head++;
+    }
+    __atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * 提交 SQ 中的请求，并等待至少 min_complete 个请求完成
+ */
+static void uring_enter(aio_ctx *ctx, unsigned min_complete) {
+    while (1) {
+        int res = (int) syscall(__NR_io_uring_enter, ctx->ring_fd, ctx->to_submit, min_complete,
+                                min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (res < 0 && errno == EINTR) continue;
+        if (res < 0) {
+            perror("io_uring enter error!");
+            exit(EXIT_FAILURE);
+        }
+        ctx->to_submit -= res;
+        if (ctx->to_submit == 0) break;
+    }
+    uring_reap(ctx);
+}
+
+static void uring_queue(aio_ctx *ctx, const aio_req *req) {
+    // 没有空闲 slot，提交并等待至少一个请求完成
+    while (ctx->free_slots_size == 0) uring_enter(ctx, 1);
+
+    unsigned slot = ctx->free_slots[--ctx->free_slots_size];
+    ctx->slots[slot] = *req;
+
+    unsigned tail = *ctx->sq_tail;
+    unsigned idx = tail & *ctx->sq_mask;
+    struct io_uring_sqe *sqe = &ctx->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    static const unsigned char opcodes[] = {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC};
+    sqe->opcode = opcodes[req->op];
+    sqe->fd = req->fd;
+    if (req->op == AIO_OP_FSYNC) sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->addr = (unsigned long) req->buf;
+    sqe->len = (unsigned) req->n;
+    sqe->off = req->off;
+    sqe->user_data = slot;
+    ctx->sq_array[idx] = idx;
+    __atomic_store_n(ctx->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ctx->to_submit++;
+
+    // 攒够一批再提交，减少系统调用
+    if (ctx->to_submit >= ctx->depth / 4) uring_enter(ctx, 0);
+}
+
+static void *worker(void *arg) {
+    aio_ctx *ctx = arg;
+
+    pthread_mutex_lock(&ctx->lock);
+    while (1) {
+        while (!ctx->stop && ctx->queue_size == 0) pthread_cond_wait(&ctx->has_work, &ctx->lock);
+        if (ctx->queue_size == 0) break; // stop
+
+        aio_req req = ctx->queue[ctx->queue_head];
+        ctx->queue_head = (ctx->queue_head + 1) % ctx->depth;
+        ctx->queue_size--;
+        pthread_cond_broadcast(&ctx->has_space);
+        pthread_mutex_unlock(&ctx->lock);
+
+        int err = do_sync(&req);
+
+        pthread_mutex_lock(&ctx->lock);
+        if (err) ctx->err = 1;
+        ctx->pending--;
+        if (ctx->pending == 0) pthread_cond_broadcast(&ctx->has_space);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+/**
+ * 创建线程池，失败时停止已经启动的工作线程并释放已经分配的部分
+ * @return 0：成功；1：失败
+ */
+static int threads_setup(aio_ctx *ctx) {
+    ctx->queue = malloc(ctx->depth * sizeof(aio_req));
+    if (ctx->queue == NULL) return 1;
+    pthread_mutex_init(&ctx->lock, NULL);
+    pthread_cond_init(&ctx->has_work, NULL);
+    pthread_cond_init(&ctx->has_space, NULL);
+
+    int started = 0;
+    while (started < AIO_WORKERS && !pthread_create(&ctx->workers[started], NULL, worker, ctx)) started++;
+    if (started == AIO_WORKERS) return 0;
+
+    pthread_mutex_lock(&ctx->lock);
+    ctx->stop = 1;
+    pthread_cond_broadcast(&ctx->has_work);
+    pthread_mutex_unlock(&ctx->lock);
+    for (int i = 0; i < started; i++) pthread_join(ctx->workers[i], NULL);
+    pthread_mutex_destroy(&ctx->lock);
+    pthread_cond_destroy(&ctx->has_work);
+    pthread_cond_destroy(&ctx->has_space);
+    free(ctx->queue);
+    ctx->queue = NULL;
+    return 1;
+}
+
+static void threads_queue(aio_ctx *ctx, const aio_req *req) {
+    pthread_mutex_lock(&ctx->lock);
+    while (ctx->queue_size == ctx->depth) pthread_cond_wait(&ctx->has_space, &ctx->lock);
+    ctx->queue[(ctx->queue_head + ctx->queue_size) % ctx->depth] = *req;
+    ctx->queue_size++;
+    ctx->pending++;
+    pthread_cond_signal(&ctx->has_work);
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+/**
+ * 创建异步 I/O 上下文
+ * @param depth 队列深度
+ * @param backend AIO_AUTO / AIO_URING / AIO_THREADS，AIO_AUTO 在 io_uring 不可用时退化为线程池
+ * @return 上下文；NULL：创建失败
+ */
+aio_ctx *aio_create(unsigned int depth, int backend) {
+    aio_ctx *ctx = calloc(1, sizeof(aio_ctx));
+    if (ctx == NULL) return NULL;
+    ctx->depth = depth ? depth : AIO_DEPTH;
+    ctx->ring_fd = -1;
+
+    if (backend != AIO_THREADS) {
+        ctx->backend = AIO_URING;
+        if (!uring_setup(ctx)) return ctx;
+
+        // io_uring 不可用，释放已经分配的部分
+        aio_destroy(ctx);
+        if (backend == AIO_URING) return NULL;
+        ctx = calloc(1, sizeof(aio_ctx));
+        if (ctx == NULL) return NULL;
+        ctx->depth = depth ? depth : AIO_DEPTH;
+        ctx->ring_fd = -1;
+    }
+
+    ctx->backend = AIO_THREADS;
+    if (threads_setup(ctx)) {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+int aio_backend(const aio_ctx *ctx) {
+    return ctx->backend;
+}
+
+const char *aio_backend_name(const aio_ctx *ctx) {
+    return ctx->backend == AIO_URING ? "io_uring" : "threads";
+}
+
+/**
+ * 排队一个读请求，队列满时会先提交并等待部分请求完成
+ */
+void aio_read(aio_ctx *ctx, int fd, void *buf, size_t n, size_t off) {
+    aio_req req = {fd, buf, n, off, AIO_OP_READ};
+    if (ctx->backend == AIO_URING) uring_queue(ctx, &req);
+    else threads_queue(ctx, &req);
+}
+
+/**
+ * 排队一个写请求，缓冲区在 aio_wait 返回之前不能修改
+ */
+void aio_write(aio_ctx *ctx, int fd, const void *buf, size_t n, size_t off) {
+    aio_req req = {fd, (char *) buf, n, off, AIO_OP_WRITE};
+    if (ctx->backend == AIO_URING) uring_queue(ctx, &req);
+    else threads_queue(ctx, &req);
+}
+
+/**
+ * 排队一个 fdatasync 请求，不保证在之前排队的写请求之后执行，需要先 aio_wait 等待写请求完成
+ */
+void aio_fsync(aio_ctx *ctx, int fd) {
+    aio_req req = {fd, NULL, 0, 0, AIO_OP_FSYNC};
+    if (ctx->backend == AIO_URING) uring_queue(ctx, &req);
+    else threads_queue(ctx, &req);
+}
+
+/**
+ * 提交已排队的请求，不等待完成
+ */
+void aio_submit(aio_ctx *ctx) {
+    if (ctx->backend == AIO_URING && ctx->to_submit) uring_enter(ctx, 0);
+}
+
+/**
+ * 提交已排队的请求并等待全部完成
+ * @return 0：全部成功；1：有请求出错
+ */
+int aio_wait(aio_ctx *ctx) {
+    if (ctx->backend == AIO_URING) {
+        while (ctx->free_slots_size < ctx->depth) uring_enter(ctx, 1);
+    } else {
+        pthread_mutex_lock(&ctx->lock);
+        while (ctx->pending > 0) pthread_cond_wait(&ctx->has_space, &ctx->lock);
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    int err = ctx->err;
+    ctx->err = 0;
+    return err;
+}
+
+/**
+ * 等待在途请求完成并释放上下文
+ */
+void aio_destroy(aio_ctx *ctx) {
+    if (ctx == NULL) return;
+
+    if (ctx->backend == AIO_URING) {
+        if (ctx->slots != NULL && ctx->free_slots != NULL && ctx->ring_fd >= 0) aio_wait(ctx);
+        if (ctx->sqes != NULL) munmap(ctx->sqes, ctx->sqes_size);
+        if (ctx->cq_ring != NULL && ctx->cq_ring != ctx->sq_ring) munmap(ctx->cq_ring, ctx->cq_ring_size);
+        if (ctx->sq_ring != NULL) munmap(ctx->sq_ring, ctx->sq_ring_size);
+        if (ctx->ring_fd >= 0) close(ctx->ring_fd);
+        free(ctx->slots);
+        free(ctx->free_slots);
+    } else {
+        aio_wait(ctx);
+        pthread_mutex_lock(&ctx->lock);
+        ctx->stop = 1;
+        pthread_cond_broadcast(&ctx->has_work);
+        pthread_mutex_unlock(&ctx->lock);
+        for (int i = 0; i < AIO_WORKERS; i++) pthread_join(ctx->workers[i], NULL);
+        pthread_mutex_destroy(&ctx->lock);
+        pthread_cond_destroy(&ctx->has_work);
+        pthread_cond_destroy(&ctx->has_space);
+        free(ctx->queue);
+    }
+    free(ctx);
+}
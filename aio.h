@@ -0,0 +1,38 @@
+#ifndef FILE_SYSTEM_AIO_H
+#define FILE_SYSTEM_AIO_H
+
+#include <stddef.h>
+
+/*
+ * 异步块 I/O：优先使用 io_uring，内核不支持时退化为线程池 pread/pwrite
+ * 每个 aio_ctx 同一时刻只能被一个线程使用，请求先排队，批量提交，aio_wait 等待全部完成
+ */
+
+#define AIO_AUTO 0    // 自动选择，优先 io_uring
+#define AIO_URING 1   // io_uring
+#define AIO_THREADS 2 // 线程池
+
+#define AIO_DEPTH 64        // 默认队列深度（同时在途的请求数）
+#define AIO_CHUNK_BLOCKS 32 // 大段连续读写拆分后每个请求的最大盘块数
+
+typedef struct aio_ctx aio_ctx;
+
+aio_ctx *aio_create(unsigned int depth, int backend);
+
+int aio_backend(const aio_ctx *ctx);
+
+const char *aio_backend_name(const aio_ctx *ctx);
+
+void aio_read(aio_ctx *ctx, int fd, void *buf, size_t n, size_t off);
+
+void aio_write(aio_ctx *ctx, int fd, const void *buf, size_t n, size_t off);
+
+void aio_fsync(aio_ctx *ctx, int fd);
+
+void aio_submit(aio_ctx *ctx);
+
+int aio_wait(aio_ctx *ctx);
+
+void aio_destroy(aio_ctx *ctx);
+
+#endif //FILE_SYSTEM_AIO_H
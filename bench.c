@@ -0,0 +1,396 @@
+#include "file_sys.h"
+#include "crc32c.h"
+#include "dirscan.h"
+#include "lz.h"
+#include "writeback.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/*
+ * 微基准测试：
+ * file_system_bench [数据文件]
+ * 不指定数据文件时使用生成的目录块和文本块。
+ * 压缩后的盘块在镜像中仍占一个盘块的位置，回写时只写压缩后的字节，盘块的其余部分在数据文件中打洞。
+ * 编解码部分报告的是压缩后负载的大小，镜像部分把同样的盘块分别以压缩和不压缩的方式写入文件系统，
+ * 报告回写写入的字节数和数据文件的实际占用；打洞只能释放宿主文件系统整块的空间，宿主块大于 BLOCK_SIZE 时占用可能不变。
+ * 去重部分在新卷上写入几种典型的工作负载（模板副本、修改过的模板、全零文件、稀疏文件、小配置文件），报告 dedup 前后已分配的盘块数
+ */
+
+#define BENCH_ROUNDS 200 // 每组数据重复次数
+#define DIR_ENTRIES (BLOCK_SIZE / sizeof(fcb)) // 目录查找测试中每个目录的目录项数量
+#define BENCH_DATA_FILE "./bench.data" // 镜像占用测试的临时数据文件
+#define BENCH_FILE_BLOCKS 32           // 镜像占用测试中每个文件的盘块数
+#define BENCH_DEDUP_FILES 16           // 去重测试中每种工作负载的文件数
+
+typedef struct image_usage {
+    size_t used;       // 镜像中已分配的盘块数
+    size_t host_bytes; // 数据文件在宿主机上实际占用的字节数
+    size_t written;    // 回写写入的数据字节数
+} image_usage;
+
+/**
+ * 当前单调时钟（秒）
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * 生成测试盘块：一半目录块，一半文本块
+ */
+static void gen_blocks(char *blocks, size_t block_cnt) {
+    static const char *words[] = {"file", "system", "block", "data", "the", "of", "directory", "fat", "1024"};
+
+    for (size_t b = 0; b < block_cnt; b++) {
+        char *p = blocks + b * BLOCK_SIZE;
+        memset(p, 0, BLOCK_SIZE);
+
+        if (b % 2 == 0) { // 目录块
+            for (size_t i = 0; i < BLOCK_SIZE / sizeof(fcb); i++) {
+                fcb f;
+                memset(&f, 0, sizeof(f));
+                sprintf(f.filename, "f%zu_%zu", b, i);
+                strcpy(f.ext, ".txt");
+                f.is_file = i % 3 != 0;
+                f.created_time = 1700000000 + i;
+                f.len = (unsigned short) (i * 37);
+                f.first = (unsigned short) (b + i);
+                memcpy(p + i * sizeof(fcb), &f, sizeof(f));
+            }
+        } else { // 文本块
+            size_t len = 0;
+            while (len < BLOCK_SIZE) {
+                const char *w = words[rand() % (sizeof(words) / sizeof(words[0]))];
+                for (int i = 0; w[i] != '\0' && len < BLOCK_SIZE; i++) p[len++] = w[i];
+                if (len < BLOCK_SIZE) p[len++] = ' ';
+            }
+        }
+    }
+}
+
+/**
+ * 目录查找：在每个目录中依次查找每个目录项，统计每秒比较的目录项数量
+ * @param kernel 查找函数名称，NULL 表示逐项 strcmp
+ * @return 每秒比较的目录项数量（百万）；0：CPU 不支持
+ */
+static double bench_dir_scan(const char *kernel, const fcb *dirs, size_t dir_cnt) {
+    if (kernel != NULL && dirscan_use(kernel)) return 0;
+
+    size_t found = 0;
+    size_t compared = 0;
+    double start = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (size_t d = 0; d < dir_cnt; d++) {
+            const fcb *dir = dirs + d * DIR_ENTRIES;
+            for (size_t k = 0; k < DIR_ENTRIES; k++) {
+                size_t i = 0;
+                if (kernel == NULL) {
+                    while (i < DIR_ENTRIES && (dir[i].is_file != dir[k].is_file || strcmp(dir[i].filename, dir[k].filename)))
+                        i++;
+                } else i = dir_find(dir, DIR_ENTRIES, dir[k].filename, dir[k].is_file);
+                found += i == k;
+                compared += i + 1;
+            }
+        }
+    }
+    double elapsed = now() - start;
+
+    if (found != BENCH_ROUNDS * dir_cnt * DIR_ENTRIES) {
+        printf("%s: Dir scan mismatch\n", kernel == NULL ? "strcmp" : kernel);
+        exit(EXIT_FAILURE);
+    }
+    return compared / elapsed / 1e6;
+}
+
+typedef int (*child_fn)(const void *arg, void *res); // 在子进程的临时卷上运行，结果写入 res，返回 0 表示成功
+
+/**
+ * 文件系统每个进程只能启动一次：在子进程中以 opts 挂载新格式化的临时卷并运行 fn，结果通过管道传回
+ * @param opts 挂载参数，同 -o
+ * @return 0：成功；1：出错
+ */
+static int run_child(const char *opts, child_fn fn, const void *arg, void *res, size_t res_size) {
+    int fds[2];
+    if (pipe(fds)) return 1;
+
+    fflush(stdout); // 子进程不能重复输出缓冲区中的内容
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+    if (pid == 0) { // 子进程，文件系统的输出丢弃
+        close(fds[0]);
+        if (freopen("/dev/null", "w", stdout) == NULL || parse_mount_opt(opts)) _exit(EXIT_FAILURE);
+        strcpy(sys_opt.stripe_spec, BENCH_DATA_FILE);
+        unlink(BENCH_DATA_FILE);
+        start_sys();
+        fs_exec(MY_FORMAT);
+        if (fn(arg, res)) _exit(EXIT_FAILURE);
+        _exit(write(fds[1], res, res_size) == (ssize_t) res_size ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    int ok = read(fds[0], res, res_size) == (ssize_t) res_size;
+    close(fds[0]);
+    int status;
+    ok &= waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    unlink(BENCH_DATA_FILE);
+    return !ok;
+}
+
+/**
+ * 在当前目录创建文件并写入 n 字节
+ * @return 0：成功；1：出错
+ */
+static int put_file(const char *name, size_t off, const char *data, size_t n) {
+    char line[32];
+    snprintf(line, sizeof(line), "%s %s", MY_CREATE, name);
+    fs_exec(line);
+    return fs_write(name, off, data, n);
+}
+
+typedef struct image_arg {
+    const char *blocks;
+    size_t block_cnt; // 写入的盘块数，不超过镜像的数据区
+} image_arg;
+
+/**
+ * 镜像占用的子进程部分：把盘块按每 BENCH_FILE_BLOCKS 块一个文件写入，退出后统计镜像和数据文件的实际占用
+ */
+static int image_child(const void *arg, void *res) {
+    const image_arg *a = arg;
+    char name[16];
+    for (size_t b = 0, k = 0; b < a->block_cnt; b += BENCH_FILE_BLOCKS, k++) {
+        snprintf(name, sizeof(name), "/b%zu", k);
+        if (put_file(name, 0, a->blocks + b * BLOCK_SIZE, MIN(BENCH_FILE_BLOCKS, a->block_cnt - b) * BLOCK_SIZE))
+            return 1;
+    }
+
+    fs_usage usage;
+    fs_get_usage(&usage);
+    fs_exec(MY_SYNC);
+    wb_stat wstat;
+    wb_get_stat(&wstat);
+    fs_exec(MY_EXITSYS); // 写回并释放空闲盘块占用的空间
+
+    struct stat st;
+    if (stat(BENCH_DATA_FILE, &st)) return 1;
+    image_usage *usage_ptr = res;
+    usage_ptr->used = usage.used;
+    usage_ptr->host_bytes = (size_t) st.st_blocks * 512;
+    usage_ptr->written = wstat.bytes;
+    return 0;
+}
+
+/**
+ * 镜像占用：在新格式化的临时卷上写入盘块，统计镜像和数据文件的实际占用
+ * @param compress 是否以 compress 挂载
+ * @return 0：成功；1：出错
+ */
+static int bench_image(int compress, const char *blocks, size_t block_cnt, image_usage *usage_ptr) {
+    image_arg arg = {blocks, block_cnt};
+    return run_child(compress ? "compress,flush=0" : "nocompress,flush=0", image_child, &arg, usage_ptr,
+                     sizeof(*usage_ptr));
+}
+
+typedef struct dedup_arg {
+    int kind;           // 工作负载，见 dedup_kinds
+    const char *blocks; // 模板内容，BENCH_FILE_BLOCKS 块
+} dedup_arg;
+
+static const char *dedup_kinds[] = {"copies", "head edits", "middle edits", "zero-filled", "sparse copies",
+                                    "small configs"};
+
+/**
+ * 去重节省的子进程部分：按工作负载写入 BENCH_DEDUP_FILES 个文件，统计 dedup 前后已分配的盘块数
+ */
+static int dedup_child(const void *arg, void *res) {
+    const dedup_arg *a = arg;
+    size_t n = BENCH_FILE_BLOCKS * BLOCK_SIZE;
+    char *data = malloc(n);
+    if (data == NULL) {
+        perror("Bench malloc error!");
+        exit(EXIT_FAILURE);
+    }
+
+    char name[16];
+    int err = 0;
+    for (int k = 0; k < BENCH_DEDUP_FILES && !err; k++) {
+        memcpy(data, a->blocks, n);
+        snprintf(name, sizeof(name), "/d%d", k);
+        switch (a->kind) {
+            case 1: // 模板开头被修改，只有后缀相同
+                data[0] = (char) ('a' + k);
+                err = put_file(name, 0, data, n);
+                break;
+            case 2: // 模板中间被修改，前后两段相同
+                data[n / 2] = (char) ('a' + k);
+                err = put_file(name, 0, data, n);
+                break;
+            case 3: // 预先写满零的文件
+                memset(data, 0, n);
+                err = put_file(name, 0, data, n);
+                break;
+            case 4: // 稀疏文件：只有开头和结尾有数据
+                err = put_file(name, 0, data, BLOCK_SIZE) || fs_write(name, n - BLOCK_SIZE, data, BLOCK_SIZE);
+                break;
+            case 5: // 相同的小配置文件，放在碎片中
+                err = put_file(name, 0, data, BLOCK_SIZE / 2);
+                break;
+            default: // 相同的模板副本
+                err = put_file(name, 0, data, n);
+        }
+    }
+    free(data);
+    if (err) return 1;
+
+    fs_usage usage;
+    size_t *used = res;
+    fs_get_usage(&usage);
+    used[0] = usage.used;
+    fs_exec(MY_DEDUP);
+    fs_get_usage(&usage);
+    used[1] = usage.used;
+    fs_exec(MY_EXITSYS);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t block_cnt = BLOCK_ASSET;
+    char *blocks = malloc(block_cnt * BLOCK_SIZE);
+    char *out = malloc(block_cnt * BLOCK_SIZE);
+    if (blocks == NULL || out == NULL) {
+        perror("Bench malloc error!");
+        return EXIT_FAILURE;
+    }
+
+    if (argc > 1) { // 从数据文件读取盘块
+        FILE *data_file = fopen(argv[1], "rb");
+        if (data_file == NULL) {
+            perror("Data file open error!");
+            return EXIT_FAILURE;
+        }
+        block_cnt = fread(blocks, BLOCK_SIZE, block_cnt, data_file);
+        fclose(data_file);
+    } else gen_blocks(blocks, block_cnt);
+
+    size_t raw_bytes = block_cnt * BLOCK_SIZE;
+    unsigned short *zlens = malloc(block_cnt * sizeof(unsigned short));
+
+    // 原始模式：直接拷贝
+    double start = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++) memcpy(out, blocks, raw_bytes);
+    double raw_time = now() - start;
+
+    // 压缩模式：逐块压缩，不可压缩的块按原样存储
+    size_t stored_bytes = 0;
+    size_t compressed_blocks = 0;
+    start = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        stored_bytes = 0;
+        compressed_blocks = 0;
+        for (size_t b = 0; b < block_cnt; b++) {
+            zlens[b] = lz_compress(blocks + b * BLOCK_SIZE, BLOCK_SIZE, out + b * BLOCK_SIZE, BLOCK_SIZE - 1);
+            if (zlens[b]) compressed_blocks++;
+            stored_bytes += zlens[b] ? zlens[b] : BLOCK_SIZE;
+        }
+    }
+    double compress_time = now() - start;
+
+    // 解压
+    char buf[BLOCK_SIZE];
+    start = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (size_t b = 0; b < block_cnt; b++) {
+            if (zlens[b]) {
+                if (lz_decompress(out + b * BLOCK_SIZE, zlens[b], buf, sizeof(buf)) != BLOCK_SIZE ||
+                    memcmp(buf, blocks + b * BLOCK_SIZE, BLOCK_SIZE) != 0) {
+                    printf("Block %zu: Decompress mismatch\n", b);
+                    return EXIT_FAILURE;
+                }
+            } else memcpy(buf, blocks + b * BLOCK_SIZE, BLOCK_SIZE);
+        }
+    }
+    double decompress_time = now() - start;
+
+    // 校验和，先用标准测试向量检查结果
+    crc32c_init();
+    if (crc32c(0, "123456789", 9) != 0XE3069283) {
+        printf("Checksum mismatch\n");
+        return EXIT_FAILURE;
+    }
+    unsigned int sum = 0;
+    start = now();
+    for (int r = 0; r < BENCH_ROUNDS; r++) {
+        for (size_t b = 0; b < block_cnt; b++) sum ^= crc32c(0, blocks + b * BLOCK_SIZE, BLOCK_SIZE);
+    }
+    double crc_time = now() - start;
+
+    double total_mb = (double) raw_bytes * BENCH_ROUNDS / (1024 * 1024);
+    printf("blocks: %zu, compressed: %zu, raw fallback: %zu\n", block_cnt, compressed_blocks,
+           block_cnt - compressed_blocks);
+    printf("%-16s%16s%16s\n", "mode", "MiB/s", "payload ratio");
+    printf("%-16s%16.1f%16.3f\n", "raw", total_mb / raw_time, 1.0);
+    printf("%-16s%16.1f%16.3f\n", "compress", total_mb / compress_time, (double) raw_bytes / stored_bytes);
+    printf("%-16s%16.1f%16s\n", "decompress", total_mb / decompress_time, "-");
+    printf("%-16s%16.1f%16s\n", crc32c_kernel_name(), total_mb / crc_time, "-");
+    if (sum == 1) printf("\n"); // 避免校验和计算被优化掉
+
+    // 回写字节数和镜像实际占用，压缩块只写压缩后的字节
+    size_t image_blocks = MIN(block_cnt, (BLOCK_ASSET - DATA_START) * 3 / 4);
+    image_usage usages[2];
+    printf("%-16s%16s%16s%16s\n", "image", "used blocks", "written KiB", "host KiB");
+    for (int compress = 0; compress < 2; compress++) {
+        if (bench_image(compress, blocks, image_blocks, &usages[compress])) {
+            printf("%-16s%16s%16s%16s\n", compress ? "compress" : "raw", "-", "-", "-");
+            continue;
+        }
+        printf("%-16s%16zu%16zu%16zu\n", compress ? "compress" : "raw", usages[compress].used,
+               usages[compress].written / 1024, usages[compress].host_bytes / 1024);
+    }
+
+    // 去重节省：每种工作负载在新卷上写入后离线去重，共享只能从链尾开始，零块变成空洞
+    printf("%-16s%16s%16s%16s\n", "dedup", "used before", "used after", "saved");
+    for (int kind = 0; kind < (int) (sizeof(dedup_kinds) / sizeof(dedup_kinds[0])); kind++) {
+        dedup_arg arg = {kind, blocks};
+        size_t used[2];
+        if (block_cnt < BENCH_FILE_BLOCKS || run_child("flush=0", dedup_child, &arg, used, sizeof(used))) {
+            printf("%-16s%16s%16s%16s\n", dedup_kinds[kind], "-", "-", "-");
+            continue;
+        }
+        printf("%-16s%16zu%16zu%16zu\n", dedup_kinds[kind], used[0], used[1], used[0] - used[1]);
+    }
+
+    // 目录查找，目录项名称补零
+    size_t dir_cnt = block_cnt;
+    fcb *dirs = calloc(dir_cnt * DIR_ENTRIES, sizeof(fcb));
+    if (dirs == NULL) {
+        perror("Bench malloc error!");
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < dir_cnt * DIR_ENTRIES; i++) {
+        sprintf(dirs[i].filename, "file_%zu", i % 1000);
+        dirs[i].is_file = i % 2;
+    }
+    dirscan_init();
+    printf("%-16s%16s\n", "dir scan", "Mentries/s");
+    printf("%-16s%16.1f\n", "strcmp", bench_dir_scan(NULL, dirs, dir_cnt));
+    static const char *kernels[] = {"scalar", "sse2", "avx2"};
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        double speed = bench_dir_scan(kernels[i], dirs, dir_cnt);
+        if (speed > 0) printf("%-16s%16.1f\n", kernels[i], speed);
+        else printf("%-16s%16s\n", kernels[i], "-");
+    }
+    free(dirs);
+
+    free(zlens);
+    free(out);
+    free(blocks);
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include "cache.h"
+#include "aio.h"
+#include "file_sys.h"
+#include "stripe.h"
+#include "writeback.h"
+
+typedef struct frame {
+    unsigned short block; // 缓存的盘块号
+    unsigned char valid;  // 是否已缓存盘块
+    unsigned char dirty;  // 是否被修改过
+    unsigned char ref;    // CLOCK 访问位
+    unsigned char busy;   // 是否有在途的异步 I/O，淘汰时跳过
+} frame;
+
+static aio_ctx *cache_io;    // 预读和批量写回使用的异步 I/O 上下文
+static frame *frames;        // 缓存帧
+static char *frame_data;     // 缓存帧数据，每帧 BLOCK_SIZE 字节
+static size_t frames_size;   // 缓存帧数量
+static int *frame_of;        // 盘块号 -> 缓存帧号，-1 表示未缓存
+static size_t hand;          // CLOCK 指针
+static cache_stat stat;      // 统计信息
+
+/**
+ * 初始化块缓存，盘块通过 stripe 读写数据文件
+ * @param frame_cnt 缓存帧数量
+ * @param io 异步 I/O 上下文
+ * @return 0：成功；1：内存不足
+ */
+int cache_init(size_t frame_cnt, aio_ctx *io) {
+    frames = calloc(frame_cnt, sizeof(frame));
+    frame_data = malloc(frame_cnt * BLOCK_SIZE);
+    frame_of = malloc(BLOCK_ASSET * sizeof(int));
+    if (frames == NULL || frame_data == NULL || frame_of == NULL) {
+        cache_destroy();
+        return 1;
+    }
+
+    for (int i = 0; i < BLOCK_ASSET; i++) frame_of[i] = -1;
+    cache_io = io;
+    frames_size = frame_cnt;
+    hand = 0;
+    memset(&stat, 0, sizeof(stat));
+    return 0;
+}
+
+/**
+ * 写回一个脏帧，压缩块只写压缩后的字节，等待正在进行的后台回写完成后再写，避免旧快照覆盖新数据
+ * @return 0：成功；1：写入出错
+ */
+static int write_back(size_t i) {
+    if (!frames[i].valid || !frames[i].dirty) return 0;
+
+    char *data = frame_data + i * BLOCK_SIZE;
+    size_t n = stored_size(frames[i].block);
+    memset(data + n, 0, BLOCK_SIZE - n); // 打洞后读出零
+    checksum_block(frames[i].block, data);
+    wb_io_begin();
+    int err = stripe_pwrite_head(data, frames[i].block, n);
+    wb_io_end();
+    if (err) return 1;
+
+    frames[i].dirty = 0;
+    clean_block(frames[i].block);
+    stat.writebacks++;
+    return 0;
+}
+
+/**
+ * CLOCK 算法选出一个可用的缓存帧，被选中的帧如果是脏帧会先写回
+ */
+static size_t evict(void) {
+    while (1) {
+        size_t i = hand;
+        hand = (hand + 1) % frames_size;
+
+        if (!frames[i].valid) return i;
+        if (frames[i].busy) continue;
+        if (frames[i].ref) { // 最近访问过，给第二次机会
+            frames[i].ref = 0;
+            continue;
+        }
+
+        if (write_back(i)) {
+            perror("Data file write error!");
+            exit(EXIT_FAILURE);
+        }
+        frame_of[frames[i].block] = -1;
+        frames[i].valid = 0;
+        stat.evictions++;
+        return i;
+    }
+}
+
+/**
+ * 获取盘块在缓存中的地址，未命中时从数据文件读取
+ * @param block 盘块号
+ * @param dirty 是否要修改该盘块
+ * @return 盘块数据地址，只在下一次 cache_get 之前有效
+ */
+char *cache_get(unsigned short block, int dirty) {
+    int i = frame_of[block];
+    if (i >= 0) stat.hits++;
+    else {
+        stat.misses++;
+        i = (int) evict();
+        // 等待正在进行的后台回写完成后再读，否则可能读到快照落盘前的旧数据
+        wb_io_begin();
+        int err = stripe_pread(frame_data + (size_t) i * BLOCK_SIZE, block, 1);
+        wb_io_end();
+        if (err) {
+            perror("Data file read error!");
+            exit(EXIT_FAILURE);
+        }
+        frames[i].block = block;
+        frames[i].valid = 1;
+        frames[i].dirty = 0;
+        frame_of[block] = i;
+        verify_block(block, frame_data + (size_t) i * BLOCK_SIZE);
+    }
+
+    frames[i].ref = 1;
+    if (dirty) frames[i].dirty = 1;
+    return frame_data + (size_t) i * BLOCK_SIZE;
+}
+
+/**
+ * 预读一组盘块，未缓存的盘块一起提交异步读请求，最多占用一半的缓存帧
+ * @param blocks 盘块号
+ * @param n 盘块数量
+ */
+void cache_prefetch(const unsigned short *blocks, size_t n) {
+    size_t issued[n];
+    size_t issued_size = 0;
+
+    wb_io_begin(); // 同 cache_get，等待正在进行的后台回写完成后再读
+    for (size_t k = 0; k < n && issued_size < frames_size / 2; k++) {
+        if (frame_of[blocks[k]] >= 0) continue;
+
+        size_t i = evict();
+        frames[i].block = blocks[k];
+        frames[i].valid = 1;
+        frames[i].dirty = 0;
+        frames[i].ref = 1;
+        frames[i].busy = 1;
+        frame_of[blocks[k]] = (int) i;
+        issued[issued_size++] = i;
+        stat.prefetches++;
+        stripe_read(cache_io, frame_data + i * BLOCK_SIZE, blocks[k], 1);
+    }
+
+    int err = issued_size ? aio_wait(cache_io) : 0;
+    wb_io_end();
+    if (err) {
+        perror("Data file read error!");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t k = 0; k < issued_size; k++) {
+        frames[issued[k]].busy = 0;
+        verify_block(frames[issued[k]].block, frame_data + issued[k] * BLOCK_SIZE);
+    }
+}
+
+static int cmp_frame_block(const void *a, const void *b) {
+    return (int) frames[*(const size_t *) a].block - (int) frames[*(const size_t *) b].block;
+}
+
+/**
+ * 取走所有脏帧的快照（按盘块号升序），并清除脏标志，由调用者负责写入数据文件
+ * @param blocks_ptr 盘块号数组接收缓冲区，由调用者 free
+ * @param data_ptr 盘块数据接收缓冲区，由调用者 free
+ * @return 脏帧数量
+ */
+size_t cache_take_dirty(unsigned short **blocks_ptr, char **data_ptr) {
+    size_t *dirty = malloc(frames_size * sizeof(size_t));
+    size_t dirty_size = 0;
+    if (dirty == NULL) {
+        perror("Cache malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < frames_size; i++) {
+        if (frames[i].valid && frames[i].dirty) dirty[dirty_size++] = i;
+    }
+    qsort(dirty, dirty_size, sizeof(size_t), cmp_frame_block);
+
+    *blocks_ptr = malloc(dirty_size * sizeof(unsigned short) + 1);
+    *data_ptr = malloc(dirty_size * BLOCK_SIZE + 1);
+    if (*blocks_ptr == NULL || *data_ptr == NULL) {
+        perror("Cache malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t k = 0; k < dirty_size; k++) {
+        size_t i = dirty[k];
+        (*blocks_ptr)[k] = frames[i].block;
+        memcpy(*data_ptr + k * BLOCK_SIZE, frame_data + i * BLOCK_SIZE, BLOCK_SIZE);
+        frames[i].dirty = 0;
+    }
+    stat.writebacks += dirty_size;
+
+    free(dirty);
+    return dirty_size;
+}
+
+/**
+ * 获取缓存帧数量和统计信息
+ */
+void cache_get_stat(size_t *frame_cnt_ptr, cache_stat *stat_ptr) {
+    *frame_cnt_ptr = frames_size;
+    *stat_ptr = stat;
+}
+
+/**
+ * 释放块缓存，不会写回脏帧
+ */
+void cache_destroy(void) {
+    free(frames);
+    free(frame_data);
+    free(frame_of);
+    frames = NULL;
+    frame_data = NULL;
+    frame_of = NULL;
+    frames_size = 0;
+    cache_io = NULL;
+}
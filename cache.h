@@ -0,0 +1,35 @@
+#ifndef FILE_SYSTEM_CACHE_H
+#define FILE_SYSTEM_CACHE_H
+
+#include <stddef.h>
+
+/*
+ * 块缓存：固定数量的缓存帧，CLOCK 算法淘汰，脏帧淘汰时写回数据文件，预读和批量写回走异步 I/O
+ * cache_get 返回的地址只在下一次 cache_get 之前有效
+ */
+
+#define CACHE_PREFETCH_MAX 64 // 顺序读取时一次预读的最多盘块数
+
+typedef struct cache_stat {
+    unsigned long hits;       // 命中次数
+    unsigned long misses;     // 未命中次数
+    unsigned long prefetches; // 预读盘块数
+    unsigned long evictions;  // 淘汰次数
+    unsigned long writebacks; // 脏帧写回次数
+} cache_stat;
+
+typedef struct aio_ctx aio_ctx;
+
+int cache_init(size_t frame_cnt, aio_ctx *io);
+
+char *cache_get(unsigned short block, int dirty);
+
+void cache_prefetch(const unsigned short *blocks, size_t n);
+
+size_t cache_take_dirty(unsigned short **blocks_ptr, char **data_ptr);
+
+void cache_get_stat(size_t *frame_cnt_ptr, cache_stat *stat_ptr);
+
+void cache_destroy(void);
+
+#endif //FILE_SYSTEM_CACHE_H
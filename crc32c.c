@@ -0,0 +1,109 @@
+#include "crc32c.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLY 0X82F63B78 // 反射后的 Castagnoli 多项式
+
+static unsigned int table[8][256]; // slicing-by-8 查找表
+
+static unsigned int (*kernel)(unsigned int crc, const unsigned char *p, size_t n); // 当前使用的计算函数
+
+static const char *kernel_name = "table";
+
+/**
+ * 查表法，每次处理 8 个字节
+ */
+static unsigned int crc_table(unsigned int crc, const unsigned char *p, size_t n) {
+    while (n && ((uintptr_t) p & 7)) {
+        crc = table[0][(crc ^ *p++) & 0XFF] ^ (crc >> 8);
+        n--;
+    }
+
+    while (n >= 8) {
+        unsigned int lo;
+        unsigned int hi;
+        memcpy(&lo, p, sizeof(lo));
+        memcpy(&hi, p + 4, sizeof(hi));
+        lo ^= crc; // 按小端序处理
+        crc = table[7][lo & 0XFF] ^ table[6][(lo >> 8) & 0XFF] ^ table[5][(lo >> 16) & 0XFF] ^ table[4][lo >> 24] ^
+              table[3][hi & 0XFF] ^ table[2][(hi >> 8) & 0XFF] ^ table[1][(hi >> 16) & 0XFF] ^ table[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+
+    while (n--) crc = table[0][(crc ^ *p++) & 0XFF] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * SSE4.2 crc32 指令，每条指令处理 8 个字节
+ */
+__attribute__((target("sse4.2")))
+static unsigned int crc_sse42(unsigned int crc, const unsigned char *p, size_t n) {
+    while (n && ((uintptr_t) p & 7)) {
+        crc = _mm_crc32_u8(crc, *p++);
+        n--;
+    }
+
+    unsigned long long c = crc;
+    while (n >= 8) {
+        unsigned long long v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        n -= 8;
+    }
+    crc = (unsigned int) c;
+
+    while (n--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+/**
+ * 生成查找表并选择计算函数，使用 crc32c 之前调用一次
+ */
+void crc32c_init(void) {
+    for (unsigned int i = 0; i < 256; i++) {
+        unsigned int crc = i;
+        for (int k = 0; k < 8; k++) crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        table[0][i] = crc;
+    }
+    for (unsigned int i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) table[t][i] = table[0][table[t - 1][i] & 0XFF] ^ (table[t - 1][i] >> 8);
+    }
+
+    kernel = crc_table;
+    kernel_name = "table";
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        kernel = crc_sse42;
+        kernel_name = "sse4.2";
+    }
+#endif
+}
+
+/**
+ * 计算 CRC32C，可以分段计算：crc32c(crc32c(0, a, n1), b, n2) 等于 a、b 拼接后的校验和
+ * @param crc 之前数据的校验和，第一段传 0
+ * @param buf 数据
+ * @param n 字节数
+ * @return 校验和
+ */
+unsigned int crc32c(unsigned int crc, const void *buf, size_t n) {
+    return ~kernel(~crc, buf, n);
+}
+
+/**
+ * 当前使用的计算函数名称
+ */
+const char *crc32c_kernel_name(void) {
+    return kernel_name;
+}
@@ -0,0 +1,17 @@
+#ifndef FILE_SYSTEM_CRC32C_H
+#define FILE_SYSTEM_CRC32C_H
+
+#include <stddef.h>
+
+/*
+ * CRC32C（Castagnoli 多项式）校验和，用于校验盘块是否损坏
+ * x86-64 上 CPU 支持 SSE4.2 时使用 crc32 指令，否则使用查表法（slicing-by-8）
+ */
+
+void crc32c_init(void);
+
+unsigned int crc32c(unsigned int crc, const void *buf, size_t n);
+
+const char *crc32c_kernel_name(void);
+
+#endif //FILE_SYSTEM_CRC32C_H
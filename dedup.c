@@ -0,0 +1,74 @@
+#include "dedup.h"
+#include "file_sys.h"
+
+static unsigned short head[BLOCK_ASSET];   // 桶 -> 第一个盘块，END 表示空桶
+static unsigned short next[BLOCK_ASSET];   // 盘块 -> 同一个桶中的下一个盘块
+static unsigned int fps[BLOCK_ASSET];      // 盘块登记时的指纹
+static unsigned short succs[BLOCK_ASSET];  // 盘块登记时的后继
+static unsigned char indexed[BLOCK_ASSET]; // 盘块是否已登记
+static size_t indexed_cnt;                 // 已登记的盘块数
+
+/**
+ * 指纹和后继所在的桶
+ */
+static size_t bucket_of(unsigned int fp, unsigned short succ) {
+    return (fp ^ succ * 0x9E3779B1U) % BLOCK_ASSET;
+}
+
+/**
+ * 清空索引
+ */
+void dedup_reset(void) {
+    for (int i = 0; i < BLOCK_ASSET; i++) head[i] = END;
+    memset(indexed, 0, sizeof(indexed));
+    indexed_cnt = 0;
+}
+
+/**
+ * 登记盘块，已登记过时替换为新的指纹和后继
+ * @param block 盘块号
+ * @param fp 内容指纹
+ * @param succ FAT 中的后继盘块（或 END）
+ */
+void dedup_insert(unsigned short block, unsigned int fp, unsigned short succ) {
+    dedup_remove(block);
+
+    size_t bucket = bucket_of(fp, succ);
+    fps[block] = fp;
+    succs[block] = succ;
+    next[block] = head[bucket];
+    head[bucket] = block;
+    indexed[block] = 1;
+    indexed_cnt++;
+}
+
+/**
+ * 取消登记，盘块被修改时调用，没有登记时什么也不做
+ */
+void dedup_remove(unsigned short block) {
+    if (!indexed[block]) return;
+
+    unsigned short *link = &head[bucket_of(fps[block], succs[block])];
+    while (*link != block) link = &next[*link];
+    *link = next[block];
+    indexed[block] = 0;
+    indexed_cnt--;
+}
+
+/**
+ * 查找指纹和后继都相同、并且通过 same 核对的盘块
+ * @return 盘块号；END：没有
+ */
+unsigned short dedup_find(unsigned int fp, unsigned short succ, dedup_same_fn same, void *arg) {
+    for (unsigned short b = head[bucket_of(fp, succ)]; b != END; b = next[b]) {
+        if (fps[b] == fp && succs[b] == succ && same(b, arg)) return b;
+    }
+    return END;
+}
+
+/**
+ * 已登记的盘块数
+ */
+size_t dedup_size(void) {
+    return indexed_cnt;
+}
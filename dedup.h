@@ -0,0 +1,25 @@
+#ifndef FILE_SYSTEM_DEDUP_H
+#define FILE_SYSTEM_DEDUP_H
+
+#include <stddef.h>
+
+/*
+ * 去重指纹索引：盘块按 (内容的 CRC32C 指纹, FAT 中的后继盘块) 登记，每个盘块最多登记一次。
+ * FAT 中一个盘块只有一个后继，只有后继也相同的盘块才能合并，所以从链尾向链首逐块查找。
+ * 因此相同的文件和相同的文件尾部可以共享，链中间相同而后面不同的盘块不能共享；全零盘块由离线去重改为稀疏文件的空洞，不占盘块。
+ * 索引只在内存中，可能过时（盘块被释放、FAT 被修改），查到的候选由调用者核对内容和后继
+ */
+
+typedef int (*dedup_same_fn)(unsigned short block, void *arg); // 核对候选盘块，返回非 0 表示可以合并
+
+void dedup_reset(void);
+
+void dedup_insert(unsigned short block, unsigned int fp, unsigned short succ);
+
+void dedup_remove(unsigned short block);
+
+unsigned short dedup_find(unsigned int fp, unsigned short succ, dedup_same_fn same, void *arg);
+
+size_t dedup_size(void);
+
+#endif //FILE_SYSTEM_DEDUP_H
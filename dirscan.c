@@ -0,0 +1,142 @@
+#include "dirscan.h"
+
+#include <stddef.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define NAME_SIZE 16 // filename 字节数，一个 128 位寄存器
+
+#if defined(__x86_64__)
+_Static_assert(offsetof(fcb, filename) == 0 && offsetof(fcb, is_file) == NAME_SIZE && sizeof(fcb) == 32,
+               "AVX2 kernel assumes 32-byte entries with is_file right after the name");
+#endif
+
+typedef size_t (*scan_fn)(const fcb dir[], size_t n, const char key[NAME_SIZE], unsigned int name_mask, int is_file);
+
+static scan_fn kernel; // 当前使用的查找函数
+
+static const char *kernel_name = "scalar";
+
+/**
+ * 逐目录项比较
+ */
+static size_t scan_scalar(const fcb dir[], size_t n, const char key[NAME_SIZE], unsigned int name_mask,
+                          int is_file) {
+    size_t key_size = 0; // 包括 '\0'
+    while (name_mask >> key_size) key_size++;
+
+    for (size_t i = 0; i < n; i++) {
+        if ((is_file == SCAN_ANY_TYPE || dir[i].is_file == is_file) && !memcmp(dir[i].filename, key, key_size))
+            return i;
+    }
+    return n;
+}
+
+#if defined(__x86_64__)
+/**
+ * SSE2：一次加载整个名称，比较结果按掩码只看目标名称及其 '\0'
+ */
+__attribute__((target("sse2")))
+static size_t scan_sse2(const fcb dir[], size_t n, const char key[NAME_SIZE], unsigned int name_mask, int is_file) {
+    __m128i k = _mm_loadu_si128((const __m128i *) key);
+
+    for (size_t i = 0; i < n; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *) dir[i].filename);
+        unsigned int eq = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(v, k));
+        if ((eq & name_mask) == name_mask && (is_file == SCAN_ANY_TYPE || dir[i].is_file == is_file)) return i;
+    }
+    return n;
+}
+
+/**
+ * AVX2：一次加载整个目录项（32 字节），名称和 is_file 在同一个掩码里比较，每轮比较两个目录项
+ */
+__attribute__((target("avx2")))
+static size_t scan_avx2(const fcb dir[], size_t n, const char key[NAME_SIZE], unsigned int name_mask, int is_file) {
+    // 低 16 字节是名称，紧接着的第 16 字节是 is_file
+    unsigned int mask = name_mask;
+    __m128i type = _mm_setzero_si128();
+    if (is_file != SCAN_ANY_TYPE) {
+        type = _mm_cvtsi32_si128((unsigned char) is_file);
+        mask |= 1U << offsetof(fcb, is_file);
+    }
+    __m256i k = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) key)), type, 1);
+
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        unsigned int eq0 = (unsigned int) _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) &dir[i]), k));
+        unsigned int eq1 = (unsigned int) _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) &dir[i + 1]), k));
+        if ((eq0 & mask) == mask) return i;
+        if ((eq1 & mask) == mask) return i + 1;
+    }
+    if (i < n) {
+        unsigned int eq = (unsigned int) _mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) &dir[i]), k));
+        if ((eq & mask) == mask) return i;
+    }
+    return n;
+}
+#endif
+
+/**
+ * 选择 CPU 支持的最快的查找函数，使用 dir_find 之前调用一次
+ */
+void dirscan_init(void) {
+    kernel = scan_scalar;
+    kernel_name = "scalar";
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = scan_avx2;
+        kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        kernel = scan_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+}
+
+/**
+ * 指定使用的查找函数，用于基准测试
+ * @param name "scalar" / "sse2" / "avx2"
+ * @return 0：成功；1：CPU 不支持
+ */
+int dirscan_use(const char *name) {
+    if (!strcmp(name, "scalar")) kernel = scan_scalar;
+#if defined(__x86_64__)
+    else if (!strcmp(name, "sse2") && __builtin_cpu_supports("sse2")) kernel = scan_sse2;
+    else if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) kernel = scan_avx2;
+#endif
+    else return 1;
+
+    kernel_name = name;
+    return 0;
+}
+
+/**
+ * 当前使用的查找函数名称
+ */
+const char *dirscan_kernel_name(void) {
+    return kernel_name;
+}
+
+/**
+ * 在目录中按名称查找目录项
+ * @param dir 目录
+ * @param n 目录项数量
+ * @param name 名称（不包括扩展名）
+ * @param is_file 0：目录；1：文件；SCAN_ANY_TYPE：不区分
+ * @return 目录项下标；n：不存在
+ */
+size_t dir_find(const fcb dir[], size_t n, const char *name, int is_file) {
+    size_t len = strlen(name);
+    if (len >= NAME_SIZE) return n; // 目录项中的名称最长 NAME_SIZE - 1 字节
+
+    char key[NAME_SIZE] = {0};
+    memcpy(key, name, len);
+    return kernel(dir, n, key, (1U << (len + 1)) - 1, is_file);
+}
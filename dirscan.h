@@ -0,0 +1,23 @@
+#ifndef FILE_SYSTEM_DIRSCAN_H
+#define FILE_SYSTEM_DIRSCAN_H
+
+#include "file_sys.h"
+
+/*
+ * 目录项按名称查找：filename 正好 16 字节，一次向量加载即可整体比较。
+ * 只比较到目标名称的 '\0' 为止（包括 '\0'），不依赖目录项 '\0' 之后的字节，
+ * 写入时名称仍然补零，保证同名的目录项字节完全相同。
+ * 运行时按 CPU 支持情况选择 AVX2（一次加载同时比较名称和 is_file）、SSE2 或逐字节比较
+ */
+
+#define SCAN_ANY_TYPE (-1) // 不区分文件和目录
+
+void dirscan_init(void);
+
+int dirscan_use(const char *kernel);
+
+const char *dirscan_kernel_name(void);
+
+size_t dir_find(const fcb dir[], size_t n, const char *name, int is_file);
+
+#endif //FILE_SYSTEM_DIRSCAN_H
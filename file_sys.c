@@ -1,20 +1,107 @@
 #include "file_sys.h"
-
-char *dist; // 模拟磁盘
+#include "aio.h"
+#include "cache.h"
+#include "crc32c.h"
+#include "dedup.h"
+#include "dirscan.h"
+#include "fsck.h"
+#include "hosttree.h"
+#include "lz.h"
+#include "stripe.h"
+#include "trace.h"
+#include "writeback.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+char *dist; // 模拟磁盘，块缓存模式下为 NULL
+
+aio_ctx *io_ctx; // 加载、持久化和块缓存使用的异步 I/O 上下文
 
 unsigned short fat[BLOCK_ASSET]; // FAT
 
+unsigned short zlen[BLOCK_ASSET]; // 每个盘块压缩后的字节数，0 表示未压缩，ZLEN_UNWRITTEN 表示预分配未写入
+
+unsigned int crc[BLOCK_ASSET]; // 每个盘块在数据文件中的 CRC32C
+
+unsigned short refs[BLOCK_ASSET]; // 每个盘块的引用数减一，大于 0 表示被多条链共享
+
+uint32_t frags[BLOCK_ASSET]; // 每个片段盘块中已用片段单元的位图，0 表示不是片段盘块
+
+typedef struct dedup_stat {
+    unsigned long hashed; // 计算过指纹的盘块数
+    unsigned long saved;  // 合并到已有盘块、不需要分配的盘块数
+    unsigned long copied; // 写时复制的盘块数
+    double seconds;       // 去重花费的时间
+} dedup_stat;
+
+static dedup_stat dd_stat; // 去重统计
+unsigned long crc_errors = 0;  // 校验失败的盘块数量
+
+unsigned char blk_state[BLOCK_ASSET]; // 每个盘块的状态，BLK_DIRTY 等
+size_t dirty_cnt = 0;                 // 脏块数量
+unsigned long mod_seq = 0;            // 修改计数，每次写盘块加一，用于判断命令是否修改了虚拟磁盘
+
+typedef struct txn_state {
+    unsigned char active;             // 是否在事务中，回写线程取快照期间暂时为 0
+    unsigned char suspended;          // 回写线程取快照期间换回了已提交的状态
+    unsigned short fat[BLOCK_ASSET];  // 事务开始时的 FAT
+    unsigned short zlen[BLOCK_ASSET]; // 事务开始时的 zlen
+    unsigned short refs[BLOCK_ASSET]; // 事务开始时的 refs
+    uint32_t frags[BLOCK_ASSET];      // 事务开始时的 frags
+    fcb stack[20];                    // 事务开始时的 FCB 栈
+    size_t stack_size;
+    char *blocks[BLOCK_ASSET];        // 事务内修改过的盘块副本，NULL 表示没有修改
+    size_t staged;                    // 修改过的盘块数量
+} txn_state;
+
+static txn_state txn; // 当前事务
+
+mount_opt sys_opt = {.flush_interval = 5000, .dirty_ratio = 10, .group_window = 10}; // 挂载参数
+
 fcb fcb_stack[20]; // FCB 栈结构，用于存放每个层级，注意：此结构存放的仅仅只是 fcb 的副本，修改 fcb 的操作要注意一致性
 size_t fcb_stack_size = 0;
 
 char cmd_arg[256];        // 输入命令
-char cmd_args[16][16];    // 以空格（可多个连续空格）分隔 cmd_arg
+char cmd_args[16][256];   // 以空格（可多个连续空格）分隔 cmd_arg
 size_t cmd_args_size = 0; // cmd_args size
 
+static int load_side(int *has_crc_ptr);
+
+static void load_meta(int has_crc);
+
+typedef int (*entry_visit_fn)(const fcb entries[], size_t n, size_t base, void *arg); // 目录项遍历回调，返回非 0 时停止遍历
+
+static unsigned long scan_blocks(int check);
+
+static void take_dirty(wb_batch *batch);
+
+static void mark_dirty(unsigned short block);
+
 static void persistence(void);
 
+static char *block_ptr(unsigned short block, int dirty);
+
+static char *disk_block_ptr(unsigned short block, int dirty);
+
+static int txn_begin(void);
+
+static size_t txn_commit(void);
+
+static int txn_abort(void);
+
+static void txn_swap(void);
+
+static void read_meta(size_t off, void *dest, size_t n);
+
+static void write_meta(size_t off, const void *src, size_t n);
+
 static void sys_exit(void);
 
+static void cur_path(char path[256]);
+
 static void print_cur_path(void);
 
 static void my_ls();
@@ -23,6 +110,8 @@ static void my_format();
 
 static void my_cd();
 
+static void make_paths(unsigned char is_file);
+
 static void my_mkdir();
 
 static void my_rmdir();
@@ -31,607 +120,2712 @@ static void my_create();
 
 static void my_rm();
 
-static int parse_path(const char src[16], char dest[16][16], size_t *dest_size_ptr);
+static int move_path(const char *src, const char *dst);
+
+static void my_mv();
+
+static int copy_path(const char *src, const char *dst, int recursive);
+
+static void my_cp();
+
+static int fallocate_path(const char *path, size_t n);
+
+static void my_fallocate();
+
+static int write_path(const char *path, size_t off, const char *data, size_t n);
+
+static void my_write();
+
+static int read_path(const char *path, size_t off, char *buf, size_t n, size_t *n_ptr);
+
+static void my_dedup();
+
+static void my_stat();
+
+static void my_sync();
+
+static void my_fsck();
+
+static void my_import();
+
+static void my_export();
+
+static void my_begin();
+
+static void my_commit();
+
+static void my_abort();
+
+static void my_trace();
+
+static int parse_path(const char *src, char dest[16][16], size_t *dest_size_ptr);
+
+static int resolve_dir(const char *path, fcb stack[20], size_t *stack_size_ptr);
+
+static int name_fits(const char *name);
 
 static void get_data_from_dist(void *dest, unsigned short first_block, size_t n);
 
+static void read_data(const fcb *tar_fcb_ptr, size_t off, void *dest, size_t n);
+
+static size_t next_entry(const fcb dir[], size_t k, size_t dir_size);
+
+static void pack_inline(fcb slots[], const char *data, size_t n);
+
+static void unpack_inline(const fcb slots[], char *data, size_t n);
+
+static size_t frag_need(const unsigned char units[], size_t n);
+
+static void alloc_frag(size_t n, frag_ref *ref);
+
+static void free_frag(const fcb *slot, size_t n);
+
+static void read_frag(const fcb *slot, char *data, size_t n);
+
+static void write_frag(const frag_ref *ref, const char *data, size_t n);
+
+static void copy_frag(fcb *slot, size_t n, const frag_ref *ref);
+
+static uint64_t hole_bits(size_t n);
+
+static void load_hole_map(const fcb *f, const fcb *slot, hole_map *hm);
+
+static size_t shared_blocks(unsigned short first, size_t n);
+
+static void fill_holes(hole_map *hm, uint64_t want);
+
+static void read_blocks(const hole_map *hm, char *data, size_t n);
+
+static const char *view_block(unsigned short block, char *buf);
+
+static int scan_dir(const fcb *dir_fcb_ptr, entry_visit_fn visit, void *arg);
+
+static size_t find_entry(const fcb *dir_fcb_ptr, const char *name, int is_file, fcb *fcb_ptr);
+
+static void update_entry(fcb *dir_fcb_ptr, const fcb *fcb_ptr);
+
 static int get_fcb_from(fcb *dir_fcb_ptr, char filename[16], unsigned char is_file, fcb *fcb_ptr);
 
 static unsigned short next_free_block(void);
 
-static int create_fcb(fcb *prev_dir_fcb_ptr, fcb *cur_dir_fcb_ptr, char *name, fcb *fcb_ptr, unsigned char is_file);
+static void rewrite_data(fcb *tar_fcb_ptr, char data[], size_t n);
+
+static void release_chain(unsigned short first);
 
-static void rmfcb_in(fcb *dir_ptr, fcb *fcb_ptr);
+static void unshare_data(fcb *tar_fcb_ptr, size_t keep, size_t n);
 
-static void rewrite_data(fcb *tar_fcb_ptr, char data[], size_t n);
+static double now(void);
+
+static void load_block(unsigned short block, char *buf);
+
+static size_t write_dedup(fcb *tar_fcb_ptr, const char *data, size_t n, unsigned short *cursor_ptr);
+
+static int dedup_file(fcb *tar_fcb_ptr);
+
+static int dedup_sparse(const fcb *f, hole_map *hm);
+
+static size_t zero_holes(fcb stack[], size_t stack_size, size_t pos, fcb ent);
+
+static void dedup_dir(fcb stack[], size_t stack_size, size_t *files_ptr, size_t *holes_ptr);
+
+static void write_data(fcb *tar_fcb_ptr, size_t off, const void *src, size_t n);
+
+static void remove_data(fcb *tar_fcb_ptr, size_t off, size_t n);
+
+static void truncate_data(fcb *tar_fcb_ptr, size_t n);
+
+static void write_block(unsigned short block, const char *data, size_t n);
 
-static void get_dir(fcb *dir_ptr, fcb dir[], size_t *dir_size_ptr);
+static size_t blocks_for(size_t n);
+
+static unsigned short alloc_run(size_t n, unsigned short *cursor_ptr);
+
+static unsigned short alloc_extent(size_t n, unsigned short goal);
+
+static void extend_chain(fcb *tar_fcb_ptr, size_t n);
+
+static size_t blocks_of(const fcb *tar_fcb_ptr);
+
+static void write_chain(unsigned short first, const char *data, size_t n);
 
 static void format();
 
 static void rm_file(fcb *prev_dir_fcb_ptr, fcb *cur_dir_fcb_ptr, fcb *tar_fcb);
 
 /**
- * 初始化，读取数据文件到内存，如果数据文件存在则正常读取，不存在则先初始化内存的各种上下文信息，等程序退出时会自动创建数据文件并按照预定结构写入
+ * 解析挂载参数，多个参数以 ',' 分隔，如 "compress,dedup,cache=256,aio=uring,qd=128,flush=1000,dirty_ratio=20,sync=group,verify=mount"，
+ * stripe= 指定数据文件列表，如 "stripe=/mnt/a/data:/mnt/b/data"，数据文件都为空时按列表格式化为条带化的卷
+ * @param opts 参数字符串
+ * @return 0：解析成功；1：存在未知参数
+ */
+int parse_mount_opt(const char *opts) {
+    char opt[8 + STRIPE_SPEC_MAX];
+    size_t opt_size = 0;
+
+    for (int i = 0;; i++) {
+        if (opts[i] == ',' || opts[i] == '\0') {
+            opt[opt_size] = '\0';
+
+            if (!strcmp(opt, "compress")) sys_opt.compress = 1;
+            else if (!strcmp(opt, "nocompress")) sys_opt.compress = 0;
+            else if (!strcmp(opt, "dedup")) sys_opt.dedup = 1;
+            else if (!strcmp(opt, "nodedup")) sys_opt.dedup = 0;
+            else if (!strncmp(opt, "cache=", 6)) {
+                char *end;
+                sys_opt.cache_size = strtoul(opt + 6, &end, 10);
+                if (*end != '\0') {
+                    printf("Unknown mount option: %s\n", opt);
+                    return 1;
+                }
+            } else if (!strncmp(opt, "flush=", 6)) {
+                char *end;
+                sys_opt.flush_interval = strtoul(opt + 6, &end, 10);
+                if (*end != '\0') {
+                    printf("Unknown mount option: %s\n", opt);
+                    return 1;
+                }
+            } else if (!strncmp(opt, "dirty_ratio=", 12)) {
+                char *end;
+                sys_opt.dirty_ratio = strtoul(opt + 12, &end, 10);
+                if (*end != '\0' || sys_opt.dirty_ratio > 100) {
+                    printf("Unknown mount option: %s\n", opt);
+                    return 1;
+                }
+            } else if (!strcmp(opt, "sync=none")) sys_opt.sync_mode = SYNC_NONE;
+            else if (!strcmp(opt, "sync=cmd")) sys_opt.sync_mode = SYNC_CMD;
+            else if (!strcmp(opt, "sync=group")) sys_opt.sync_mode = SYNC_GROUP;
+            else if (!strncmp(opt, "group_ms=", 9)) {
+                char *end;
+                sys_opt.group_window = strtoul(opt + 9, &end, 10);
+                if (*end != '\0') {
+                    printf("Unknown mount option: %s\n", opt);
+                    return 1;
+                }
+            } else if (!strcmp(opt, "verify=lazy")) sys_opt.verify = VERIFY_LAZY;
+            else if (!strcmp(opt, "verify=mount")) sys_opt.verify = VERIFY_MOUNT;
+            else if (!strcmp(opt, "verify=off")) sys_opt.verify = VERIFY_OFF;
+            else if (!strcmp(opt, "aio=auto")) sys_opt.aio_backend = AIO_AUTO;
+            else if (!strcmp(opt, "aio=uring")) sys_opt.aio_backend = AIO_URING;
+            else if (!strcmp(opt, "aio=threads")) sys_opt.aio_backend = AIO_THREADS;
+            else if (!strncmp(opt, "qd=", 3)) {
+                char *end;
+                sys_opt.aio_depth = strtoul(opt + 3, &end, 10);
+                if (*end != '\0' || sys_opt.aio_depth == 0) {
+                    printf("Unknown mount option: %s\n", opt);
+                    return 1;
+                }
+            } else if (!strncmp(opt, "stripe=", 7)) {
+                if (strlen(opt + 7) >= sizeof(sys_opt.stripe_spec)) {
+                    printf("Unknown mount option: %s\n", opt);
+                    return 1;
+                }
+                strcpy(sys_opt.stripe_spec, opt + 7);
+            }
+            else if (opt_size != 0) {
+                printf("Unknown mount option: %s\n", opt);
+                return 1;
+            }
+
+            if (opts[i] == '\0') break;
+            opt_size = 0;
+        } else if (opt_size + 1 < sizeof(opt)) opt[opt_size++] = opts[i];
+    }
+
+    return 0;
+}
+
+/**
+ * 初始化，打开数据文件并读取到内存，如果数据文件不存在则先创建并初始化内存的各种上下文信息。
+ * 块缓存模式下只读取 FAT 和根目录 FCB，其余盘块在访问时按需读取到块缓存
  */
 void start_sys(void) {
-    // 分配虚拟磁盘空间
-    dist = (char *) malloc(DIST_SIZE * sizeof(char));
-    if (dist == NULL) {
-        perror("Dist malloc error!");
+    crc32c_init();
+    dirscan_init();
+    dedup_reset();
+
+    // 创建异步 I/O 上下文
+    io_ctx = aio_create(sys_opt.aio_depth, sys_opt.aio_backend);
+    if (io_ctx == NULL) {
+        perror("Aio init error!");
+        exit(EXIT_FAILURE);
+    }
+
+    // 打开实际磁盘文件（条带化时为所有数据文件），不存在则创建，运行期间一直保持打开；新文件大小固定，全部是空洞
+    int is_new;
+    if (stripe_open(sys_opt.stripe_spec, O_RDWR | O_CREAT, &is_new)) exit(EXIT_FAILURE);
+
+    if (sys_opt.cache_size) { // 块缓存模式，不加载整个虚拟磁盘
+        if (cache_init(sys_opt.cache_size, io_ctx)) {
+            perror("Cache malloc error!");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        // 分配虚拟磁盘空间
+        dist = (char *) malloc(DIST_SIZE * sizeof(char));
+        if (dist == NULL) {
+            perror("Dist malloc error!");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (wb_init(take_dirty)) {
+        perror("Writeback init error!");
         exit(EXIT_FAILURE);
     }
 
-    // 打开实际磁盘文件
-    FILE *data_file = fopen(REAL_DATA_FILE, "rb");
-    if (data_file == NULL) // 还未初始化，需要初始化一下
+    if (is_new) { // 还未初始化，需要初始化一下
+        if (dist != NULL) memset(dist, 0, DIST_SIZE);
         format();
-    else {
-        // 分块读取实际磁盘文件到虚拟磁盘空间
-        for (int i = 0; i < BLOCK_ASSET; i++) {
-            if (BLOCK_SIZE != fread(dist + i * BLOCK_SIZE, sizeof(char), BLOCK_SIZE, data_file)) {
-                perror("Data file read error!");
-                free(dist);
-                if (fclose(data_file)) perror("Data file close error!");
-                exit(EXIT_FAILURE);
-            }
+    } else {
+        // 初始化侧表和 FAT
+        int has_crc;
+        if (load_side(&has_crc)) {
+            perror("Data file read error!");
+            exit(EXIT_FAILURE);
         }
+        load_meta(has_crc);
+
+        // 按 FAT 只读取已写入的盘块，连续的已写入盘块按条带单元拆成多个异步读请求，所有数据文件同时在途，
+        // 空闲盘块（文件中的空洞）和预分配未写入的盘块直接清零
+        for (int i = 0; i < BLOCK_ASSET && dist != NULL;) {
+            int skip = fat[i] == FREE || zlen[i] == ZLEN_UNWRITTEN;
+            int j = i;
+            while (j < BLOCK_ASSET && (fat[j] == FREE || zlen[j] == ZLEN_UNWRITTEN) == skip) j++;
 
-        // 关闭实际磁盘文件
-        if (fclose(data_file)) {
-            perror("Data file close error!");
-            free(dist);
+            if (skip) memset(dist + (size_t) i * BLOCK_SIZE, 0, (size_t) (j - i) * BLOCK_SIZE);
+            else stripe_read(io_ctx, dist + (size_t) i * BLOCK_SIZE, i, j - i);
+
+            i = j;
+        }
+        if (aio_wait(io_ctx)) {
+            perror("Data file read error!");
             exit(EXIT_FAILURE);
         }
 
-        // 初始化 FAT
-        memcpy(fat, dist + FAT_FIRST * BLOCK_SIZE, sizeof(fat));
+        // 已分配的盘块在数据文件中有数据，空闲盘块和预分配未写入的盘块不需要校验
+        for (int i = 0; i < BLOCK_ASSET; i++) {
+            if (fat[i] != FREE) blk_state[i] |= BLK_ON_DISK;
+            if (fat[i] == FREE || zlen[i] == ZLEN_UNWRITTEN) blk_state[i] |= BLK_CHECKED;
+        }
+
+        // 旧数据文件没有 crc 表，按现有内容计算；否则按校验模式在挂载时校验或首次访问时校验
+        if (!has_crc) scan_blocks(0);
+        else if (sys_opt.verify == VERIFY_MOUNT) crc_errors += scan_blocks(1);
+        if (!has_crc || sys_opt.verify != VERIFY_LAZY) {
+            for (int i = 0; i < BLOCK_ASSET; i++) blk_state[i] |= BLK_CHECKED;
+        }
+
+        // 旧版本的目录中没有内联槽，升级版本号后旧程序不会再挂载
+        disk_hdr hdr;
+        read_meta(DISK_HDR_OFFSET, &hdr, sizeof(hdr));
+        if (hdr.version != DISK_VERSION) {
+            hdr.version = DISK_VERSION;
+            write_meta(DISK_HDR_OFFSET, &hdr, sizeof(hdr));
+        }
 
         // 初始化根目录 fcb
         fcb root_dir_fcb;
-        memcpy(&root_dir_fcb, dist + ROOT_FCB_OFFSET, sizeof(fcb));
+        read_meta(ROOT_FCB_OFFSET, &root_dir_fcb, sizeof(fcb));
 
         // 初始化 fcb_stack
         fcb_stack[fcb_stack_size++] = root_dir_fcb;
     }
+
+    // 启动后台回写线程，组提交也由回写线程完成
+    if ((sys_opt.flush_interval || sys_opt.sync_mode == SYNC_GROUP) &&
+        wb_start(sys_opt.flush_interval, sys_opt.group_window, sys_opt.sync_mode != SYNC_NONE)) {
+        perror("Writeback start error!");
+        exit(EXIT_FAILURE);
+    }
 }
 
 /**
- * 循环读取从控制台输入的一行命令，不支持换行，只能一行
+ * 读取数据文件（条带化时为第一个数据文件）盘块区域之后的侧表，旧数据文件没有侧表，全部按未压缩处理，没有 refs 表时所有盘块都不共享，
+ * 没有 frags 表时没有片段盘块
+ * @param has_crc_ptr 侧表中是否有 crc 表的接收缓冲区
+ * @return 0：成功；1：读取出错
  */
-void command() {
-    int i;
-    int j;
-    size_t len;
+static int load_side(int *has_crc_ptr) {
+    size_t off;
+    int fd = stripe_side(&off);
+    side_hdr hdr;
+    *has_crc_ptr = 0;
+    memset(zlen, 0, sizeof(zlen));
+    memset(refs, 0, sizeof(refs));
+    memset(frags, 0, sizeof(frags));
+    if (pread_full(fd, &hdr, sizeof(hdr), off) || memcmp(hdr.magic, SIDE_MAGIC, sizeof(hdr.magic))) return 0;
+
+    if ((hdr.flags & SIDE_ZLEN) && pread_full(fd, zlen, sizeof(zlen), off + sizeof(hdr))) return 1;
+    if (hdr.flags & SIDE_CRC) {
+        if (pread_full(fd, crc, sizeof(crc), off + sizeof(hdr) + sizeof(zlen))) return 1;
+        *has_crc_ptr = 1;
+    }
+    if ((hdr.flags & SIDE_REFS) && pread_full(fd, refs, sizeof(refs), off + sizeof(hdr) + sizeof(zlen) + sizeof(crc)))
+        return 1;
+    if ((hdr.flags & SIDE_FRAGS) &&
+        pread_full(fd, frags, sizeof(frags), off + sizeof(hdr) + sizeof(zlen) + sizeof(crc) + sizeof(refs)))
+        return 1;
+    return 0;
+}
 
-    while (1) {
-        cmd_args_size = 0; // 重置
+/**
+ * 读取 FAT 所在的元数据盘块，有 crc 表时先校验，再检查磁盘格式版本和 FAT 每一项是否合法，
+ * FAT 损坏时继续使用会沿着错误的链读写任意盘块，直接退出
+ * @param has_crc 侧表中是否有 crc 表
+ */
+static void load_meta(int has_crc) {
+    char buf[ROOT_DIR_FIRST * BLOCK_SIZE];
+    if (stripe_pread(buf, FAT_FIRST, ROOT_DIR_FIRST)) {
+        perror("Data file read error!");
+        exit(EXIT_FAILURE);
+    }
 
-        print_cur_path(); // 打印命令行前段路径
+    int bad = 0;
+    for (size_t i = FAT_FIRST; has_crc && sys_opt.verify != VERIFY_OFF && i < ROOT_DIR_FIRST; i++) {
+        if (crc32c(0, buf + i * BLOCK_SIZE, BLOCK_SIZE) != crc[i]) {
+            printf("Block %zu: Checksum error\n", i);
+            bad = 1;
+        }
+    }
 
-        fgets(cmd_arg, sizeof(cmd_arg), stdin); // 读取命令
-        len = strlen(cmd_arg);
-        if (len > 0 && cmd_arg[len - 1] == '\n') cmd_arg[--len] = '\0'; // fgets 函数以换行符为结尾，不以空格符，所以需要补上结束符 '\0'
+    // 磁盘格式版本不一致时目录项的布局不同，不能挂载
+    disk_hdr hdr;
+    memcpy(&hdr, buf + DISK_HDR_OFFSET, sizeof(hdr));
+    uint32_t version = memcmp(hdr.magic, DISK_MAGIC, sizeof(hdr.magic)) ? 1 : hdr.version;
+    if (!bad && (version < DISK_VERSION_MIN || version > DISK_VERSION)) {
+        printf("Data file version %u, expected %u\n", version, DISK_VERSION);
+        exit(EXIT_FAILURE);
+    }
 
-        // 解析命令，按空格（可能是连续空格）分隔
-        i = 0;
-        j = 0;
-        while (1) {
-            if (i == len) { // 读取完了
-                if (j != 0) cmd_args[cmd_args_size++][j] = '\0';
-                break;
-            }
+    // 元数据盘块串成一条链，数据盘块只能指向数据盘块
+    memcpy(fat, buf, sizeof(fat));
+    for (size_t i = 0; i < BLOCK_ASSET && !bad; i++) {
+        if (i < DATA_START) bad = fat[i] != (i == DATA_START - 1 ? END : i + 1);
+        else bad = fat[i] != FREE && fat[i] != END && (fat[i] < DATA_START || fat[i] >= BLOCK_ASSET);
+    }
+    if (bad) {
+        printf("FAT corrupted\n");
+        exit(EXIT_FAILURE);
+    }
 
-            if (cmd_arg[i] != ' ') cmd_args[cmd_args_size][j++] = cmd_arg[i]; // 读到空格以外的字符
-            else if (j != 0) { // 读到空格字符 && 上一个是普通字符
-                cmd_args[cmd_args_size++][j] = '\0';
-                j = 0;
-            }
-            // 如果以上两种情况都不是，即 读到空格字符 && (上一个也是空格 || 当前是第一个字符)，不需要做额外的事，正常 i++ 即可
+    for (size_t i = FAT_FIRST; i < ROOT_DIR_FIRST; i++) blk_state[i] |= BLK_CHECKED;
+}
+
+typedef struct scan_arg {
+    int first;            // 起始盘块号
+    int last;             // 结束盘块号（不包含）
+    int check;            // 1：校验；0：计算
+    unsigned long errors; // 校验失败的盘块数量
+} scan_arg;
+
+/**
+ * 校验或计算一段盘块的校验和，跳过空闲盘块。块缓存模式下直接从数据文件读取
+ */
+static void *scan_range(void *arg) {
+    scan_arg *range = arg;
+    char buf[AIO_CHUNK_BLOCKS * BLOCK_SIZE];
 
+    for (int i = range->first; i < range->last;) {
+        if (fat[i] == FREE || (blk_state[i] & BLK_CHECKED)) {
             i++;
+            continue;
         }
 
-        if (cmd_args_size == 0) continue; // 输入全是空格 或 只输入了回车
-
-        // 此时至少有一个命令
+        // 连续的已分配盘块一起读取
+        int j = i;
+        while (j < range->last && j - i < AIO_CHUNK_BLOCKS && fat[j] != FREE && !(blk_state[j] & BLK_CHECKED)) j++;
+        const char *data = dist + (size_t) i * BLOCK_SIZE;
+        if (dist == NULL) {
+            if (stripe_pread(buf, i, j - i)) {
+                perror("Data file read error!");
+                exit(EXIT_FAILURE);
+            }
+            data = buf;
+        }
 
-        if (!strcmp(MY_EXITSYS, cmd_args[0])) { // 退出命令
-            if (cmd_args_size > 1) printf("Unknown command: %s\n", cmd_arg);
-            else {
-                sys_exit();
-                break;
+        for (int k = i; k < j; k++) {
+            unsigned int sum = crc32c(0, data + (size_t) (k - i) * BLOCK_SIZE, BLOCK_SIZE);
+            if (!range->check) crc[k] = sum;
+            else if (sum != crc[k]) {
+                printf("Block %d: Checksum error\n", k);
+                range->errors++;
             }
-        } else if (!strcmp(MY_LS, cmd_args[0])) my_ls();
-        else if (!strcmp(MY_FORMAT, cmd_args[0])) my_format();
-        else if (!strcmp(MY_CD, cmd_args[0])) my_cd();
-        else if (!strcmp(MY_MKDIR, cmd_args[0])) my_mkdir();
-        else if (!strcmp(MY_RMDIR, cmd_args[0])) my_rmdir();
-        else if (!strcmp(MY_CREATE, cmd_args[0])) my_create();
-        else if (!strcmp(MY_RM, cmd_args[0])) my_rm();
-        else printf("Unknown command: %s\n", cmd_arg);
+        }
+        i = j;
     }
-}
-
-/**
- * 退出当前系统需要完成的收尾操作
- */
-static void sys_exit(void) {
-    // 刷新 fat 到虚拟磁盘
-    memcpy(dist + FAT_FIRST * BLOCK_SIZE, fat, sizeof(fat));
 
-    persistence(); // 虚拟磁盘持久化
-    free(dist); // 释放分配内存
+    return NULL;
 }
 
 /**
- * 遵循传统命令行格式，打印当前路径 + "# "，如 "/folder1/folder2# "
+ * 多线程校验或计算所有已分配、未校验过盘块的校验和
+ * @param check 1：校验；0：按数据文件现有内容计算
+ * @return 校验失败的盘块数量
  */
-static void print_cur_path(void) {
-    char path[64];
-    size_t path_size = 0;
-    // 遍历一遍 fcb_stack 即可
-    for (int i = 0; i < fcb_stack_size; ++i) {
-        if (i > 1) path[path_size++] = '/';
-        for (int j = 0; fcb_stack[i].filename[j] != '\0'; j++) {
-            path[path_size++] = fcb_stack[i].filename[j];
-        }
+static unsigned long scan_blocks(int check) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads_size = (int) MIN(MIN(cpus > 0 ? cpus : 1, 8), (BLOCK_ASSET + 63) / 64);
+    pthread_t threads[threads_size];
+    scan_arg args[threads_size];
+
+    int per = (BLOCK_ASSET + threads_size - 1) / threads_size;
+    for (int t = 0; t < threads_size; t++) {
+        args[t].first = MIN(t * per, BLOCK_ASSET);
+        args[t].last = MIN((t + 1) * per, BLOCK_ASSET);
+        args[t].check = check;
+        args[t].errors = 0;
     }
-    path[path_size] = '\0';
-    printf("%s# ", path);
+    for (int t = 1; t < threads_size; t++) {
+        if (pthread_create(&threads[t], NULL, scan_range, &args[t])) args[t].first = -1; // 创建失败时由当前线程处理
+    }
+    scan_range(&args[0]);
+
+    unsigned long errors = args[0].errors;
+    for (int t = 1; t < threads_size; t++) {
+        if (args[t].first < 0) {
+            args[t].first = MIN(t * per, BLOCK_ASSET);
+            scan_range(&args[t]);
+        } else pthread_join(threads[t], NULL);
+        errors += args[t].errors;
+    }
+    return errors;
 }
 
 /**
- * 持久化虚拟磁盘数据
+ * 循环读取从控制台输入的一行命令，不支持换行，只能一行
  */
-static void persistence(void) {
-    // 以写入二进制形式打开数据文件
-    FILE *data_file = fopen(REAL_DATA_FILE, "wb");
-    if (data_file == NULL) {
-        perror("Data file close error!");
-        free(dist);
-        exit(EXIT_FAILURE);
-    }
+void command() {
+    while (1) {
+        print_cur_path(); // 打印命令行前段路径
 
-    // 分块写入磁盘文件
-    for (int i = 0; i < BLOCK_ASSET; ++i) {
-        if (BLOCK_SIZE != fwrite(dist + i * BLOCK_SIZE, sizeof(char), BLOCK_SIZE, data_file)) {
-            perror("Data file write error!");
-            free(dist);
-            if (fclose(data_file)) perror("Data file close error!");
-            exit(EXIT_FAILURE);
-        }
-    }
+        if (fgets(cmd_arg, sizeof(cmd_arg), stdin) == NULL) strcpy(cmd_arg, MY_EXITSYS); // 输入结束，按退出处理
 
-    // 写入完成，关闭数据文件
-    if (fclose(data_file)) {
-        perror("Data file close error!");
-        free(dist);
-        exit(EXIT_FAILURE);
+        // 记录轨迹时保存命令和耗时，trace 命令本身不记录
+        char line[sizeof(cmd_arg)];
+        strcpy(line, cmd_arg);
+        uint64_t start = trace_now();
+        if (fs_exec(line)) break;
+        if (trace_active() && cmd_args_size > 0 && strcmp(cmd_args[0], MY_TRACE) != 0) {
+            trace_log(cmd_arg, start, trace_now() - start);
+        }
     }
 }
 
 /**
- * 列出当前目录
- * "my_ls"：列出简单目录
- * "my_ls -a"：列出目录时，包含详细信息
+ * 命令修改了虚拟磁盘时按持久化模式提交，调用时已持有 fs_lock
+ * @param seq 命令执行前的修改计数
+ * @return 组提交的请求序号，调用者释放 fs_lock 后用 wb_wait 等待落盘；不需要等待时为 0
  */
-static void my_ls() {
-    if (cmd_args_size > 2) { // 参数长度校验
-        printf("Unknown command: %s\n", cmd_arg);
-        return;
-    }
+static unsigned long sync_after(unsigned long seq) {
+    if (seq == mod_seq) return 0;
+    if (sys_opt.sync_mode == SYNC_CMD) wb_sync();
+    else if (sys_opt.sync_mode == SYNC_GROUP) return wb_commit();
+    return 0;
+}
 
-    fcb cur_dir[36];
-    size_t cur_dir_size = 0;
-    get_dir(&(fcb_stack[fcb_stack_size - 1]), cur_dir, &cur_dir_size);
+/**
+ * 执行一行命令，供命令循环和嵌入文件系统的程序调用
+ * @param line 命令，可以以换行符结尾
+ * @return 0：继续；1：执行了退出命令，文件系统已关闭
+ */
+int fs_exec(const char *line) {
+    size_t i;
+    size_t j;
+    size_t len;
 
-    // 长度为0就没必要往下执行了
-    if (cur_dir_size == 0) return;
+    cmd_args_size = 0; // 重置
 
-    if (cmd_args_size == 1) { // 列出简单目录
-        // 遍历当前目录
-        for (int i = 0; i < cur_dir_size; ++i) {
-            // 一行打印5个
-            if (i != 0 && i % 5 == 0) printf("\n");
+    if (line != cmd_arg) snprintf(cmd_arg, sizeof(cmd_arg), "%s", line);
+    len = strlen(cmd_arg);
+    if (len > 0 && cmd_arg[len - 1] == '\n') cmd_arg[--len] = '\0'; // fgets 函数以换行符为结尾，不以空格符，所以需要补上结束符 '\0'
 
-            char name[24];
-            sprintf(name, "%s%s", cur_dir[i].filename, cur_dir[i].ext);
-            printf("%-32s", name);
-        }
-        printf("\n");
-    } else {
-        // 带 "-a" 参数，表示列出目录时，需包含详细信息
-        if (strcmp(cmd_args[1], "-a") != 0) {
-            printf("Unknown command: %s\n", cmd_arg);
-            return;
+    // 解析命令，按空格（可能是连续空格）分隔
+    i = 0;
+    j = 0;
+    while (1) {
+        if (i == len) { // 读取完了
+            if (j != 0) cmd_args[cmd_args_size++][j] = '\0';
+            break;
         }
 
-        char *format = "%-32s%-32s%-32s\n";
-
-        // 表头
-        printf(format, "name", "size", "created_time");
+        if (cmd_arg[i] != ' ') cmd_args[cmd_args_size][j++] = cmd_arg[i]; // 读到空格以外的字符
+        else if (j != 0) { // 读到空格字符 && 上一个是普通字符
+            cmd_args[cmd_args_size++][j] = '\0';
+            j = 0;
+            if (cmd_args_size == sizeof(cmd_args) / sizeof(cmd_args[0])) break; // 参数过多，后面的丢弃
+        }
+        // 如果以上两种情况都不是，即 读到空格字符 && (上一个也是空格 || 当前是第一个字符)，不需要做额外的事，正常 i++ 即可
 
-        // 遍历当前目录
-        for (int i = 0; i < cur_dir_size; ++i) {
-            // 文件名或目录名
-            char name[24];
-            sprintf(name, "%s%s", cur_dir[i].filename, cur_dir[i].ext);
+        i++;
+    }
 
-            // 文件大小正常显示，目录大小显示 "/"
-            char size[32];
-            if (cur_dir[i].is_file) sprintf(size, "%d", cur_dir[i].len);
-            else strcpy(size, "/");
+    if (cmd_args_size == 0) return 0; // 输入全是空格 或 只输入了回车
 
-            // 创建时间
-            char time[32];
-            strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", localtime(&(cur_dir[i].created_time)));
+    // 此时至少有一个命令
 
-            printf(format, name, size, time);
+    if (!strcmp(MY_EXITSYS, cmd_args[0])) { // 退出命令
+        if (cmd_args_size > 1) {
+            printf("Unknown command: %s\n", cmd_arg);
+            return 0;
         }
+        sys_exit();
+        return 1;
     }
+
+    pthread_mutex_lock(&fs_lock); // 执行命令期间回写线程不能取快照
+    unsigned long seq = mod_seq;
+    if (!strcmp(MY_LS, cmd_args[0])) my_ls();
+    else if (!strcmp(MY_FORMAT, cmd_args[0])) my_format();
+    else if (!strcmp(MY_CD, cmd_args[0])) my_cd();
+    else if (!strcmp(MY_MKDIR, cmd_args[0])) my_mkdir();
+    else if (!strcmp(MY_RMDIR, cmd_args[0])) my_rmdir();
+    else if (!strcmp(MY_CREATE, cmd_args[0])) my_create();
+    else if (!strcmp(MY_RM, cmd_args[0])) my_rm();
+    else if (!strcmp(MY_MV, cmd_args[0])) my_mv();
+    else if (!strcmp(MY_CP, cmd_args[0])) my_cp();
+    else if (!strcmp(MY_FALLOCATE, cmd_args[0])) my_fallocate();
+    else if (!strcmp(MY_WRITE, cmd_args[0])) my_write();
+    else if (!strcmp(MY_DEDUP, cmd_args[0])) my_dedup();
+    else if (!strcmp(MY_STAT, cmd_args[0])) my_stat();
+    else if (!strcmp(MY_SYNC, cmd_args[0])) my_sync();
+    else if (!strcmp(MY_FSCK, cmd_args[0])) my_fsck();
+    else if (!strcmp(MY_IMPORT, cmd_args[0])) my_import();
+    else if (!strcmp(MY_EXPORT, cmd_args[0])) my_export();
+    else if (!strcmp(MY_BEGIN, cmd_args[0])) my_begin();
+    else if (!strcmp(MY_COMMIT, cmd_args[0])) my_commit();
+    else if (!strcmp(MY_ABORT, cmd_args[0])) my_abort();
+    else if (!strcmp(MY_TRACE, cmd_args[0])) my_trace();
+    else printf("Unknown command: %s\n", cmd_arg);
+
+    // 命令修改了虚拟磁盘，按持久化模式提交，组提交时释放 fs_lock 后再等待落盘
+    unsigned long ticket = sync_after(seq);
+    pthread_mutex_unlock(&fs_lock);
+    wb_wait(ticket);
+    return 0;
 }
 
 /**
- * 格式化文件系统
+ * 移动或重命名文件、目录，见 mv 命令
+ * @return 0：成功；1：失败，已打印原因
  */
-static void my_format() {
-    if (cmd_args_size > 1) { // 参数长度校验
-        printf("Unknown command: %s\n", cmd_arg);
-        return;
-    }
+int fs_mv(const char *src, const char *dst) {
+    pthread_mutex_lock(&fs_lock);
+    unsigned long seq = mod_seq;
+    int ret = move_path(src, dst);
+    unsigned long ticket = sync_after(seq);
+    pthread_mutex_unlock(&fs_lock);
+    wb_wait(ticket);
+    return ret;
+}
 
-    format();
+/**
+ * 复制文件或目录树，见 cp 命令
+ * @return 0：成功；1：失败，已打印原因
+ */
+int fs_cp(const char *src, const char *dst, int recursive) {
+    pthread_mutex_lock(&fs_lock);
+    unsigned long seq = mod_seq;
+    int ret = copy_path(src, dst, recursive);
+    unsigned long ticket = sync_after(seq);
+    pthread_mutex_unlock(&fs_lock);
+    wb_wait(ticket);
+    return ret;
+}
 
-    printf("Done\n");
+/**
+ * 给文件预分配空间，见 fallocate 命令
+ * @return 0：成功；1：失败，已打印原因
+ */
+int fs_fallocate(const char *path, size_t bytes) {
+    pthread_mutex_lock(&fs_lock);
+    unsigned long seq = mod_seq;
+    int ret = fallocate_path(path, bytes);
+    unsigned long ticket = sync_after(seq);
+    pthread_mutex_unlock(&fs_lock);
+    wb_wait(ticket);
+    return ret;
 }
 
 /**
- * 改变当前路径至任意存在的目录
+ * 在文件的 off 处写入 n 字节，见 write 命令
+ * @return 0：成功；1：失败，已打印原因
  */
-static void my_cd() {
-    if (cmd_args_size != 2) { // 参数长度校验
-        printf("Unknown command: %s\n", cmd_arg);
-        return;
-    }
+int fs_write(const char *path, size_t off, const void *data, size_t n) {
+    pthread_mutex_lock(&fs_lock);
+    unsigned long seq = mod_seq;
+    int ret = write_path(path, off, data, n);
+    unsigned long ticket = sync_after(seq);
+    pthread_mutex_unlock(&fs_lock);
+    wb_wait(ticket);
+    return ret;
+}
 
-    // 解析路径参数
-    // 用户输入的路径，"a/b/c" --> ["a", "b", "c"]
-    char paths[16][16];
+/**
+ * 读取文件 off 处的 n 字节，n 为 0 时只查找文件
+ * @param n_ptr 实际读取的字节数的接收缓冲区，读到文件末尾时小于 n
+ * @return 0：成功；1：失败，已打印原因
+ */
+int fs_read(const char *path, size_t off, void *buf, size_t n, size_t *n_ptr) {
+    pthread_mutex_lock(&fs_lock);
+    int ret = read_path(path, off, buf, n, n_ptr);
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
+}
+
+/**
+ * 开始事务，之后的命令修改的盘块和 FAT 都暂存在事务中，提交时一次写回
+ * @return 0：成功；1：已经在事务中
+ */
+int fs_begin(void) {
+    pthread_mutex_lock(&fs_lock);
+    int ret = txn_begin();
+    pthread_mutex_unlock(&fs_lock);
+    return ret;
+}
+
+/**
+ * 提交事务，按持久化模式一次持久化事务中的所有修改
+ * @return 0：成功；1：不在事务中
+ */
+int fs_commit(void) {
+    pthread_mutex_lock(&fs_lock);
+    if (!txn.active) {
+        pthread_mutex_unlock(&fs_lock);
+        return 1;
+    }
+    unsigned long seq = mod_seq;
+    txn_commit();
+    unsigned long ticket = sync_after(seq);
+    pthread_mutex_unlock(&fs_lock);
+    wb_wait(ticket);
+    return 0;
+}
+
+/**
+ * 放弃事务，丢弃事务中的所有修改，当前目录回到事务开始时的目录
+ */
+void fs_abort(void) {
+    pthread_mutex_lock(&fs_lock);
+    txn_abort();
+    pthread_mutex_unlock(&fs_lock);
+}
+
+/**
+ * 按 FAT 统计空间占用和碎片情况，不遍历目录树
+ * @param usage_ptr 统计信息接收缓冲区
+ */
+void fs_get_usage(fs_usage *usage_ptr) {
+    memset(usage_ptr, 0, sizeof(*usage_ptr));
+    usage_ptr->blocks = BLOCK_ASSET;
+
+    pthread_mutex_lock(&fs_lock);
+    unsigned char has_pred[BLOCK_ASSET] = {0}; // 是否有 FAT 项指向该盘块，没有的已分配数据盘块是链首
+    for (int i = DATA_START; i < BLOCK_ASSET; i++) {
+        if (fat[i] != FREE && fat[i] != END) has_pred[fat[i]] = 1;
+    }
+    size_t free_run = 0;
+    for (size_t i = 0; i < BLOCK_ASSET; i++) {
+        if (fat[i] != FREE) usage_ptr->used++;
+        if (i < DATA_START) continue;
+
+        if (fat[i] == FREE) {
+            if (free_run++ == 0) usage_ptr->free_extents++;
+            usage_ptr->largest_free = MAX(usage_ptr->largest_free, free_run);
+            continue;
+        }
+        free_run = 0;
+        if (!has_pred[i]) usage_ptr->chains++;
+        if (fat[i] != END && fat[i] != i + 1) usage_ptr->fragments++;
+    }
+    pthread_mutex_unlock(&fs_lock);
+}
+
+/**
+ * 退出当前系统需要完成的收尾操作
+ */
+static void sys_exit(void) {
+    if (txn.active) { // 没有提交的事务不写回
+        fs_abort();
+        printf("Transaction aborted\n");
+    }
+
+    if (trace_active()) trace_stop(NULL); // 退出时结束轨迹记录
+
+    wb_stop(); // 停止后台回写线程
+
+    persistence(); // 虚拟磁盘持久化
+    free(dist); // 释放分配内存
+    cache_destroy();
+    wb_destroy();
+    aio_destroy(io_ctx);
+}
+
+/**
+ * 当前目录的绝对路径，如 "/folder1/folder2"
+ * @param path 接收缓冲区，256 字节
+ */
+static void cur_path(char path[256]) {
+    size_t path_size = 0;
+    // 遍历一遍 fcb_stack 即可
+    for (size_t i = 0; i < fcb_stack_size && path_size < 255; ++i) {
+        if (i > 1) path[path_size++] = '/';
+        for (int j = 0; fcb_stack[i].filename[j] != '\0' && path_size < 255; j++) {
+            path[path_size++] = fcb_stack[i].filename[j];
+        }
+    }
+    path[path_size] = '\0';
+}
+
+/**
+ * 遵循传统命令行格式，打印当前路径 + "# "，如 "/folder1/folder2# "
+ */
+static void print_cur_path(void) {
+    char path[256];
+    cur_path(path);
+    printf("%s# ", path);
+}
+
+/**
+ * 持久化虚拟磁盘数据，只写入脏块，已分配又被释放的盘块在数据文件中打洞，数据文件占用的磁盘空间与已用空间成正比
+ */
+static void persistence(void) {
+    // 写入所有脏块和侧表
+    wb_sync();
+
+    // 释放数据文件中空闲盘块占用的空间，文件系统不支持打洞时保留旧数据即可，读取时不会读空闲盘块
+    for (int i = 0; i < BLOCK_ASSET;) {
+        if (fat[i] != FREE || !(blk_state[i] & BLK_ON_DISK)) {
+            i++;
+            continue;
+        }
+
+        int j = i;
+        while (j < BLOCK_ASSET && fat[j] == FREE && (blk_state[j] & BLK_ON_DISK)) blk_state[j++] &= ~BLK_ON_DISK;
+        stripe_punch(i, j - i);
+        i = j;
+    }
+
+    // 写入完成，关闭数据文件
+    if (stripe_close()) {
+        perror("Data file close error!");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * 取走脏块快照交给后台回写，调用时已持有 fs_lock。事务进行中先换回事务开始时的 FAT 和侧表，只回写已提交的状态。
+ * 常驻内存模式从虚拟磁盘复制脏块，块缓存模式复制脏帧，同时带上 FAT 和侧表
+ * @param batch 快照接收缓冲区
+ */
+static void take_dirty(wb_batch *batch) {
+    txn_swap(); // 事务进行中只回写已提交的状态
+
+    // 刷新 fat 到虚拟磁盘
+    write_meta(FAT_FIRST * BLOCK_SIZE, fat, sizeof(fat));
+
+    if (sys_opt.cache_size) batch->size = cache_take_dirty(&batch->blocks, &batch->data);
+    else {
+        size_t dirty_size = 0;
+        for (int i = 0; i < BLOCK_ASSET; i++) {
+            if ((blk_state[i] & BLK_DIRTY) && fat[i] != FREE) dirty_size++;
+        }
+
+        batch->blocks = malloc(dirty_size * sizeof(unsigned short) + 1);
+        batch->data = malloc(dirty_size * BLOCK_SIZE + 1);
+        if (batch->blocks == NULL || batch->data == NULL) {
+            perror("Writeback malloc error!");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < BLOCK_ASSET; i++) {
+            if (!(blk_state[i] & BLK_DIRTY) || fat[i] == FREE) continue;
+            batch->blocks[batch->size] = i;
+            memcpy(batch->data + batch->size * BLOCK_SIZE, dist + (size_t) i * BLOCK_SIZE, BLOCK_SIZE);
+            batch->size++;
+        }
+    }
+
+    for (int i = 0; i < BLOCK_ASSET; i++) blk_state[i] &= ~BLK_DIRTY;
+    dirty_cnt = 0;
+
+    // 更新要写入盘块的校验和，压缩块只写压缩后的字节
+    batch->lens = malloc(batch->size * sizeof(unsigned short) + 1);
+    if (batch->lens == NULL) {
+        perror("Writeback malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t k = 0; k < batch->size; k++) {
+        batch->lens[k] = stored_size(batch->blocks[k]);
+        memset(batch->data + k * BLOCK_SIZE + batch->lens[k], 0, BLOCK_SIZE - batch->lens[k]); // 打洞后读出零
+        checksum_block(batch->blocks[k], batch->data + k * BLOCK_SIZE);
+    }
+
+    // 侧表快照
+    side_hdr hdr;
+    memcpy(hdr.magic, SIDE_MAGIC, sizeof(hdr.magic));
+    hdr.flags = SIDE_ZLEN | SIDE_CRC | SIDE_REFS | SIDE_FRAGS;
+    batch->side_size = sizeof(hdr) + sizeof(zlen) + sizeof(crc) + sizeof(refs) + sizeof(frags);
+    batch->side = malloc(batch->side_size);
+    if (batch->side == NULL) {
+        perror("Writeback malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(batch->side, &hdr, sizeof(hdr));
+    memcpy(batch->side + sizeof(hdr), zlen, sizeof(zlen));
+    memcpy(batch->side + sizeof(hdr) + sizeof(zlen), crc, sizeof(crc));
+    memcpy(batch->side + sizeof(hdr) + sizeof(zlen) + sizeof(crc), refs, sizeof(refs));
+    memcpy(batch->side + sizeof(hdr) + sizeof(zlen) + sizeof(crc) + sizeof(refs), frags, sizeof(frags));
+
+    txn_swap();
+}
+
+/**
+ * 校验刚从数据文件读取的盘块，每个盘块挂载后只校验一次，校验失败时只报告错误
+ * @param block 盘块号
+ * @param data 盘块数据，BLOCK_SIZE 字节
+ */
+void verify_block(unsigned short block, const char *data) {
+    if ((blk_state[block] & BLK_CHECKED) || zlen[block] == ZLEN_UNWRITTEN) return; // 未写入的盘块内容不会被读取
+    blk_state[block] |= BLK_CHECKED;
+
+    if (crc32c(0, data, BLOCK_SIZE) != crc[block]) {
+        printf("Block %d: Checksum error\n", block);
+        crc_errors++;
+    }
+}
+
+/**
+ * 记录即将写入数据文件的盘块的校验和
+ * @param block 盘块号
+ * @param data 盘块数据，BLOCK_SIZE 字节
+ */
+void checksum_block(unsigned short block, const char *data) {
+    crc[block] = crc32c(0, data, BLOCK_SIZE);
+}
+
+/**
+ * 盘块在数据文件中要写入的字节数：压缩块为压缩后的字节数，之后的部分全零、可以打洞；其他盘块为 BLOCK_SIZE。
+ * 事务进行中按已提交的 zlen 计算
+ * @param block 盘块号
+ */
+size_t stored_size(unsigned short block) {
+    unsigned short n = txn.active ? txn.zlen[block] : zlen[block];
+    return n && n != ZLEN_UNWRITTEN ? n : BLOCK_SIZE;
+}
+
+/**
+ * 盘块已经写入数据文件（块缓存淘汰脏帧时），清除脏标记，脏块数量相应减少
+ * @param block 盘块号
+ */
+void clean_block(unsigned short block) {
+    if (!(blk_state[block] & BLK_DIRTY)) return;
+
+    blk_state[block] &= ~BLK_DIRTY;
+    dirty_cnt--;
+}
+
+#define LS_DETAIL_FORMAT "%-32s%-16s%-16s%-32s\n" // ls -a 每行格式
+
+typedef struct ls_arg {
+    int detail;   // 是否打印详细信息
+    size_t shown; // 已打印的目录项数量
+    fcb sparse;   // 等待紧跟的 hole_map 的稀疏文件，filename 为空表示没有
+} ls_arg;
+
+/**
+ * ls -a 打印一个目录项：文件显示逻辑大小和实际占用的字节数，目录显示 "/"
+ * @param slot 稀疏文件紧跟的 hole_map，其他目录项为 NULL
+ */
+static void ls_detail(const fcb *f, const fcb *slot) {
+    // 文件名或目录名
+    char name[24];
+    sprintf(name, "%s%s", f->filename, f->ext);
+
+    // 文件大小正常显示，目录大小显示 "/"；占用：盘块数乘以盘块大小，打包文件为片段单元，内联文件为 0
+    char size[32];
+    char allocated[32];
+    hole_map hm;
+    load_hole_map(f, slot, &hm);
+    if (f->is_file) {
+        sprintf(size, "%d", f->len);
+        size_t bytes = IS_PACKED(f) ? FRAG_UNITS(f->len) * FRAG_UNIT : __builtin_popcountll(hm.map) * BLOCK_SIZE;
+        sprintf(allocated, "%zu", bytes);
+    } else {
+        strcpy(size, "/");
+        strcpy(allocated, "/");
+    }
+
+    // 创建时间
+    char time[32];
+    time_t created_time = f->created_time;
+    strftime(time, sizeof(time), "%Y-%m-%d %H:%M:%S", localtime(&created_time));
+
+    printf(LS_DETAIL_FORMAT, name, size, allocated, time);
+}
+
+/**
+ * ls 打印一段目录项，目录项直接引用盘块数据，跳过内联槽；稀疏文件等到紧跟的 hole_map 再打印
+ */
+static int ls_visit(const fcb entries[], size_t n, size_t base, void *arg) {
+    ls_arg *ls = arg;
+    (void) base; // 不需要目录项的下标
+
+    for (size_t k = 0; k < n; k++) {
+        const fcb *f = &entries[k];
+        if (IS_SLOT(f)) {
+            if (ls->sparse.filename[0] != '\0') ls_detail(&ls->sparse, f);
+            ls->sparse.filename[0] = '\0';
+            continue;
+        }
+
+        if (!ls->detail) {
+            // 文件名或目录名，一行打印5个
+            char name[24];
+            sprintf(name, "%s%s", f->filename, f->ext);
+            if (ls->shown != 0 && ls->shown % 5 == 0) printf("\n");
+            printf("%-32s", name);
+            ls->shown++;
+            continue;
+        }
+
+        if (IS_SPARSE(f)) ls->sparse = *f;
+        else ls_detail(f, NULL);
+    }
+    return 0;
+}
+
+/**
+ * 列出当前目录
+ * "my_ls"：列出简单目录
+ * "my_ls -a"：列出目录时，包含详细信息
+ */
+static void my_ls() {
+    if (cmd_args_size > 2) { // 参数长度校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+
+    // 长度为0就没必要往下执行了
+    fcb *cur_dir_fcb_ptr = &(fcb_stack[fcb_stack_size - 1]);
+    if (cur_dir_fcb_ptr->len == 0) return;
+
+    if (cmd_args_size == 1) { // 列出简单目录
+        // 遍历当前目录
+        ls_arg ls = {.detail = 0};
+        scan_dir(cur_dir_fcb_ptr, ls_visit, &ls);
+        printf("\n");
+    } else {
+        // 带 "-a" 参数，表示列出目录时，需包含详细信息
+        if (strcmp(cmd_args[1], "-a") != 0) {
+            printf("Unknown command: %s\n", cmd_arg);
+            return;
+        }
+
+        // 表头
+        printf(LS_DETAIL_FORMAT, "name", "size", "allocated", "created_time");
+
+        // 遍历当前目录，目录末尾的 hole_map 不完整时按全是空洞打印
+        ls_arg ls = {.detail = 1};
+        scan_dir(cur_dir_fcb_ptr, ls_visit, &ls);
+        if (ls.sparse.filename[0] != '\0') ls_detail(&ls.sparse, NULL);
+    }
+}
+
+/**
+ * 格式化文件系统
+ */
+static void my_format() {
+    if (cmd_args_size > 1) { // 参数长度校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+    if (txn.active) {
+        printf("Can't format in a transaction\n");
+        return;
+    }
+
+    format();
+
+    printf("Done\n");
+}
+
+/**
+ * 改变当前路径至任意存在的目录
+ */
+static void my_cd() {
+    if (cmd_args_size != 2) { // 参数长度校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+
+    // 临时 FCB 目录层级栈
+    fcb tmp_fcb_stack[20];
+    size_t tmp_fcb_stack_size = 0;
+    if (resolve_dir(cmd_args[1], tmp_fcb_stack, &tmp_fcb_stack_size)) {
+        printf("%s: No such directory\n", cmd_args[1]);
+        return;
+    }
+
+    // 这时已经找到了最终目标目录
+    // 维护全局变量 fcb_stack
+    memcpy(fcb_stack, tmp_fcb_stack, tmp_fcb_stack_size * sizeof(fcb));
+    fcb_stack_size = tmp_fcb_stack_size;
+}
+
+typedef struct plan_node {
+    fcb f;                // 目录项，已有节点为磁盘上的当前内容
+    int parent;           // 父节点号，根目录为 -1，子节点编号总是大于父节点
+    int depth;            // 层级，根目录为 1
+    unsigned char is_new; // 是否新建
+} plan_node;
+
+#define PLAN_SIZE (sizeof(fcb_stack) / sizeof(fcb) + 16 * 16) // 计划最多的节点数：当前目录栈加每个目标的路径段
+
+/**
+ * 在计划中查找父节点下的同名节点（不区分扩展名），找不到时再到磁盘上的目录中查找，找到的目录项加入计划
+ * @return 节点号；-1：不存在
+ */
+static int plan_find(plan_node plan[], size_t *plan_size_ptr, int parent, const char *filename) {
+    for (size_t k = parent + 1; k < *plan_size_ptr; k++) {
+        if (plan[k].parent == parent && !strcmp(plan[k].f.filename, filename)) return (int) k;
+    }
+    if (plan[parent].is_new) return -1; // 新目录在磁盘上还是空的
+
+    plan_node *nd = &plan[*plan_size_ptr];
+    if (find_entry(&plan[parent].f, filename, SCAN_ANY_TYPE, &nd->f) == plan[parent].f.len / sizeof(fcb)) return -1;
+    nd->parent = parent;
+    nd->depth = plan[parent].depth + 1;
+    nd->is_new = 0;
+    return (int) (*plan_size_ptr)++;
+}
+
+/**
+ * mkdir / create 的实现：批量创建 cmd_args[1..] 中的路径，缺少的中间目录自动创建。
+ * 先把所有路径合并成一棵计划树，共同前缀只出现一次；出错的路径不加入计划，其他路径照常创建。
+ * 然后一次分配所有盘块，每个新目录只写一次，每个已有目录只追加一次新目录项，目录变长时更新上一级目录中的目录项。
+ * 新文件是空的内联文件，新的空目录也推迟到第一次写入目录项时才分配盘块
+ * @param is_file 最后一个路径段创建文件还是目录
+ */
+static void make_paths(unsigned char is_file) {
+    if (cmd_args_size < 2) { // 参数长度校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+
+    // 当前目录的 FCB 栈作为计划的起点，0 号节点是根目录
+    plan_node plan[PLAN_SIZE];
+    size_t plan_size = 0;
+    for (size_t j = 0; j < fcb_stack_size; j++) {
+        plan[plan_size].f = fcb_stack[j];
+        plan[plan_size].parent = (int) j - 1;
+        plan[plan_size].depth = (int) j + 1;
+        plan[plan_size++].is_new = 0;
+    }
+
+    unsigned char planned[16] = {0}; // 每个路径是否加入了计划
+    for (size_t t = 1; t < cmd_args_size; t++) {
+        const char *target = cmd_args[t];
+
+        // 解析路径
+        char paths[16][16];
+        size_t paths_size = 0;
+        if (parse_path(target, paths, &paths_size)) {
+            printf("Unknown command: %s\n", target);
+            continue;
+        }
+        if (paths_size == 0) continue; // 如果解析后的路径为空，直接跳过
+
+        // 校验合法性
+        int err = 0;
+        for (size_t i = 0; i < paths_size && !err; ++i) {
+            if (!strcmp(paths[i], "..") || !strcmp(paths[i], ".")) {
+                printf("%s: Path can't contain \".\" or \"..\"\n", target);
+                err = 1;
+            } else if (!name_fits(paths[i])) {
+                printf("%s: Extension too long\n", target);
+                err = 1;
+            }
+        }
+        if (err) continue;
+
+        size_t i = 0;
+        int cur = (int) fcb_stack_size - 1;
+        if (!strcmp(paths[0], "/")) { // 绝对路径
+            i = 1;
+            cur = 0;
+        }
+        if (i == paths_size) {
+            printf("%s: Directory already exist\n", target);
+            continue;
+        }
+
+        // 遍历路径段，已有的目录沿用，缺少的目录和最后一个路径段加入计划
+        size_t mark = plan_size;
+        for (; i < paths_size && !err; i++) {
+            int last = i == paths_size - 1;
+            size_t filename_size = strcspn(paths[i], ".");
+            char filename[16];
+            memcpy(filename, paths[i], filename_size);
+            filename[filename_size] = '\0';
+
+            int k = plan_find(plan, &plan_size, cur, filename);
+            if (k >= 0) {
+                if (last) printf(plan[k].f.is_file ? "%s: File already exist\n" : "%s: Directory already exist\n", target);
+                else if (plan[k].f.is_file) printf("%s: Not a directory\n", target);
+                err = last || plan[k].f.is_file;
+                cur = k;
+                continue;
+            }
+
+            if (!(last && is_file) && plan[cur].depth == sizeof(fcb_stack) / sizeof(fcb)) {
+                printf("%s: Too deep\n", target);
+                err = 1;
+                continue;
+            }
+
+            plan_node *nd = &plan[plan_size];
+            memset(nd, 0, sizeof(plan_node));
+            memcpy(nd->f.filename, filename, filename_size);
+            strcpy(nd->f.ext, paths[i] + filename_size);
+            nd->f.is_file = last && is_file;
+            nd->f.created_time = (uint32_t) time(NULL);
+            nd->parent = cur;
+            nd->depth = plan[cur].depth + 1;
+            nd->is_new = 1;
+            cur = (int) plan_size++;
+        }
+
+        if (err) plan_size = mark; // 出错的路径不加入计划
+        else planned[t] = 1;
+    }
+
+    // 需要的盘块：每个非空的新目录一条链，再加上已有目录变长后多出的盘块
+    size_t children[PLAN_SIZE] = {0}; // 每个节点的新子节点数量
+    for (size_t k = 0; k < plan_size; k++) {
+        if (plan[k].is_new) children[plan[k].parent]++;
+    }
+    size_t need = 0;
+    for (size_t k = 0; k < plan_size; k++) {
+        size_t len = plan[k].is_new ? 0 : plan[k].f.len;
+        if (len + children[k] * sizeof(fcb) > UINT16_MAX) {
+            printf("%s: Too many entries\n", plan[k].f.filename);
+            return;
+        }
+        if (plan[k].is_new && children[k]) need += blocks_for(children[k] * sizeof(fcb));
+        else if (!plan[k].is_new && children[k]) need += blocks_for(len + children[k] * sizeof(fcb)) - blocks_of(&plan[k].f);
+    }
+    size_t free_cnt = 0;
+    for (int k = DATA_START; k < BLOCK_ASSET; k++) free_cnt += fat[k] == FREE;
+    if (need > free_cnt) {
+        printf("Not enough space, %zu blocks needed, %zu free\n", need, free_cnt);
+        return;
+    }
+
+    // 非空的新目录的盘块连续分配，新目录的内容就是新子节点的目录项
+    unsigned short cursor = DATA_START;
+    for (size_t k = 0; k < plan_size; k++) {
+        if (!plan[k].is_new) continue;
+        plan[k].f.len = children[k] * sizeof(fcb);
+        plan[k].f.first = children[k] ? alloc_run(blocks_for(plan[k].f.len), &cursor) : FREE;
+    }
+
+    // 倒序处理保证子目录先于父目录写入
+    for (int k = (int) plan_size - 1; k >= 0; k--) {
+        plan_node *nd = &plan[k];
+        fcb entries[children[k] + 1];
+        size_t entries_size = 0;
+        for (size_t c = k + 1; c < plan_size && entries_size < children[k]; c++) {
+            if (plan[c].is_new && plan[c].parent == k) entries[entries_size++] = plan[c].f;
+        }
+
+        if (nd->is_new) {
+            if (entries_size) write_chain(nd->f.first, (const char *) entries, entries_size * sizeof(fcb));
+        } else if (entries_size) {
+            write_data(&nd->f, nd->f.len, entries, entries_size * sizeof(fcb));
+            if (nd->parent < 0) write_meta(ROOT_FCB_OFFSET, &nd->f, sizeof(fcb)); // 根目录，要特殊维护
+            else update_entry(&plan[nd->parent].f, &nd->f);
+        }
+    }
+
+    // 维护 fcb_stack，当前目录栈是计划的前 fcb_stack_size 个节点
+    for (size_t j = 0; j < fcb_stack_size; j++) fcb_stack[j] = plan[j].f;
+
+    for (size_t t = 1; t < cmd_args_size; t++) {
+        if (!planned[t]) continue;
+        if (is_file) printf("%s: File created\n", cmd_args[t]);
+        else printf("%s: Create directory success\n", cmd_args[t]);
+    }
+}
+
+/**
+ * 创建文件夹，缺少的中间目录自动创建，可以一次指定多个路径："mkdir p1 p2 ..."，路径段不能含有 ".." 和 "."。
+ */
+static void my_mkdir() {
+    make_paths(0);
+}
+
+/**
+ * 删除指定目录。
+ * 路径不能包含 "." 和 ".."
+ */
+static void my_rmdir() {
+//    if (cmd_args_size != 2) { // 参数长度校验
+//        printf("Unknown command: %s\n", cmd_arg);
+//        return;
+//    }
+//
+//    // 解析路径
+//    char paths[16][16];
+//    size_t paths_size = 0;
+//    if (parse_path(cmd_args[1], paths, &paths_size)) {
+//        printf("Unknown command: %s\n", cmd_arg);
+//        return;
+//    }
+//    if (paths_size == 0) return; // 如果解析后的路径为空，直接返回
+//
+//    // 校验合法性，路径不能包含 "." 和 ".."
+//    for (int i = 0; i < paths_size; ++i) {
+//        if (!strcmp(paths[i], "..") || !strcmp(paths[i], ".")) {
+//            printf("%s: Path can't contain \".\" or \"..\"\n", cmd_arg);
+//            return;
+//        }
+//    }
+//
+//    // 校验当前位置是否是目标删除目录或在目标删除目录中
+//    for (int i = 0, j = 0;; i++, j++) {
+//        if (j == paths_size) {
+//            printf("%s: Can't remove directory where you in", cmd_arg);
+//            return;
+//        }
+//
+//        if (i == fcb_stack_size || strcmp(fcb_stack[i].filename, paths[j]) != 0) break;
+//    }
+//
+//    fcb prev_fcb; // 上一级目录的 FCB
+//    fcb cur_fcb; // 当前目录的 FCB
+//    int k = 0;
+//    if (!strcmp(paths[0], "/")) { // 绝对路径
+//        k = 1;
+//        cur_fcb = blk0.root_dir_fcb;
+//    } else { // 相对路径
+//        k = 0;
+//        cur_fcb = fcb_stack[fcb_stack_size - 1];
+//        if (fcb_stack_size > 1) prev_fcb = fcb_stack[fcb_stack_size - 2];
+//    }
+//
+//    // 遍历 paths，将 cur_fcb 移动到目标删除目录，同时维护 prev_fcb
+//    for (; k < paths_size; k++) {
+//        fcb tar_fcb;
+//
+//        // 不存在目录，返回错误
+//        if (get_fcb_from(&cur_fcb, paths[k], 0, &tar_fcb)) {
+//            printf("%s: No such directory\n", cmd_arg);
+//            return;
+//        }
+//
+//        prev_fcb = cur_fcb;
+//        cur_fcb = tar_fcb;
+//    }
+//
+//    // 删除目录
+//    rmfcb_in(&prev_fcb, &cur_fcb);
+}
+
+/**
+ * 创建文件，缺少的中间目录自动创建，可以一次指定多个路径："create p1 p2 ..."，路径段不能含有 ".." 和 "."。
+ */
+static void my_create() {
+    make_paths(1);
+}
+
+/**
+ * 删除文件，路径不能包含 "." 和 ".."
+ */
+static void my_rm() {
+    if (cmd_args_size != 2) { // 参数长度校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+
+    // 解析路径
+    char paths[16][16];
     size_t paths_size = 0;
     if (parse_path(cmd_args[1], paths, &paths_size)) {
-        printf("%s: No such directory\n", cmd_args[1]);
+        printf("Unknown command: %s\n", cmd_arg);
         return;
     }
-    // 如果解析后的路径为空，直接返回
-    if (paths_size == 0) return;
+    if (paths_size == 0) return; // 如果解析后的路径为空，直接返回
 
-    // 临时 FCB 目录层级栈
-    fcb tmp_fcb_stack[20];
+    // 校验是否含有 "." 和 ".."
+    for (size_t i = 0; i < paths_size; ++i) {
+        if (!strcmp(paths[i], "..") || !strcmp(paths[i], ".")) {
+            printf("%s: Path can't contain \".\" or \"..\"\n", cmd_arg);
+            return;
+        }
+    }
+
+    fcb tmp_fcb_stack[32];
     size_t tmp_fcb_stack_size = 0;
-    int i = 0;
-    if (!strcmp(paths[0], "/")) { // 绝对路径，以 "/" 起始的路径
+    size_t i = 0;
+    if (!strcmp(paths[0], "/")) { // 绝对路径
         i = 1;
-
-        // 根目录 FCB 入栈
         tmp_fcb_stack[tmp_fcb_stack_size++] = fcb_stack[0];
     } else { // 相对路径
         i = 0;
-
-        // 将当前 FCB 栈信息拷贝一份
         memcpy(tmp_fcb_stack, fcb_stack, fcb_stack_size * sizeof(fcb));
         tmp_fcb_stack_size = fcb_stack_size;
     }
 
-    // 遍历用户输入的每一段路径
-    for (; i < paths_size; ++i) {
-        // 遇到 "." 则可以直接跳过
-        if (!strcmp(paths[i], ".")) continue;
+    // 遍历 paths，将 cur_fcb 移动到目标文件
+    while (1) {
+        fcb tar_fcb;
+        fcb *prev_dir_fcb_ptr = tmp_fcb_stack_size == 1 ? NULL : &tmp_fcb_stack[tmp_fcb_stack_size - 2];
+        fcb *cur_dir_fcb_ptr = &tmp_fcb_stack[tmp_fcb_stack_size - 1];
+
+        // 最后一个路径段为文件名，目录项中的名称不包括扩展名
+        if (i == paths_size - 1) {
+            paths[i][strcspn(paths[i], ".")] = '\0';
+
+            // 如果不存在目标文件
+            if (get_fcb_from(cur_dir_fcb_ptr, paths[i], 1, &tar_fcb)) {
+                printf("%s: No such file\n", cmd_arg);
+                return;
+            }
+
+            rm_file(prev_dir_fcb_ptr, cur_dir_fcb_ptr, &tar_fcb);
+            break;
+        }
+
+        // 不存在目录，返回错误
+        if (get_fcb_from(cur_dir_fcb_ptr, paths[i], 0, &tar_fcb)) {
+            printf("%s: No such file\n", cmd_arg);
+            return;
+        }
+
+        tmp_fcb_stack[tmp_fcb_stack_size++] = tar_fcb;
+        i++;
+    }
+
+    // 维护 fcb_stack
+    for (size_t j = 0; j < fcb_stack_size && j < tmp_fcb_stack_size &&
+                    !strcmp(tmp_fcb_stack[j].filename, fcb_stack[j].filename); ++j) {
+        fcb_stack[j] = tmp_fcb_stack[j];
+    }
+
+    printf("%s: File removed\n", cmd_arg);
+}
+
+/**
+ * 把路径拆成所在目录和最后一个路径段，"a/b/c" --> "a/b" 和 "c"，"/c" --> "/" 和 "c"，"c" --> "" 和 "c"
+ * @param dir 所在目录接收缓冲区，256 字节
+ * @return 最后一个路径段
+ */
+static const char *split_path(const char *path, char dir[256]) {
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL) {
+        dir[0] = '\0';
+        return path;
+    }
+
+    size_t dir_size = slash == path ? 1 : (size_t) (slash - path);
+    snprintf(dir, 256, "%.*s", (int) dir_size, path);
+    return slash + 1;
+}
+
+/**
+ * 目录栈栈顶的目录 FCB 变化后写回上一级目录，根目录写回元数据区
+ */
+static void store_dir_fcb(fcb stack[], size_t stack_size) {
+    if (stack_size == 1) write_meta(ROOT_FCB_OFFSET, &stack[0], sizeof(fcb));
+    else update_entry(&stack[stack_size - 2], &stack[stack_size - 1]);
+}
+
+/**
+ * 目录栈是否经过 path 表示的目录，即前 depth 层的名称都相同。
+ * 还没有盘块的空目录起始盘块都是 FREE，所以目录按从根目录开始的路径识别
+ * @param path 目录的 FCB 栈
+ * @param depth path 的大小
+ */
+static int on_path(const fcb stack[], size_t stack_size, const fcb path[], size_t depth) {
+    if (stack_size < depth) return 0;
+    for (size_t j = 0; j < depth; j++) {
+        if (strcmp(stack[j].filename, path[j].filename) != 0) return 0;
+    }
+    return 1;
+}
+
+/**
+ * 目录 path[depth - 1] 变化后，目录栈中它的副本替换为新的 FCB
+ */
+static void refresh_stack(fcb stack[], size_t stack_size, const fcb path[], size_t depth) {
+    if (on_path(stack, stack_size, path, depth)) stack[depth - 1] = path[depth - 1];
+}
+
+/**
+ * 按路径找到源目录项
+ * @param src 源路径
+ * @param stack 所在目录的 FCB 栈接收缓冲区
+ * @param stack_size_ptr 栈大小接收缓冲区
+ * @param ent 目录项接收缓冲区
+ * @return 目录项在所在目录中的下标；-1：不存在，已打印原因
+ */
+static long locate_src(const char *src, fcb stack[20], size_t *stack_size_ptr, fcb *ent) {
+    char dir_path[256];
+    const char *name = split_path(src, dir_path);
+    if (!strcmp(name, ".") || !strcmp(name, "..")) {
+        printf("%s: Path can't contain \".\" or \"..\"\n", src);
+        return -1;
+    }
+
+    char filename[16];
+    size_t filename_size = strcspn(name, ".");
+    if (name[0] == '\0' || filename_size >= sizeof(filename) || resolve_dir(dir_path, stack, stack_size_ptr)) {
+        printf("%s: No such file or directory\n", src);
+        return -1;
+    }
+    memcpy(filename, name, filename_size);
+    filename[filename_size] = '\0';
+
+    const fcb *dir_fcb_ptr = &stack[*stack_size_ptr - 1];
+    size_t pos = find_entry(dir_fcb_ptr, filename, SCAN_ANY_TYPE, ent);
+    if (pos == dir_fcb_ptr->len / sizeof(fcb) || (name[filename_size] != '\0' && strcmp(ent->ext, name + filename_size))) {
+        printf("%s: No such file or directory\n", src);
+        return -1;
+    }
+    return (long) pos;
+}
+
+/**
+ * 按路径确定目标位置：已存在的目录表示放到其中、名称不变，否则最后一个路径段是新名称，所在目录必须存在
+ * @param dst 目标路径
+ * @param stack 目标目录的 FCB 栈接收缓冲区
+ * @param stack_size_ptr 栈大小接收缓冲区
+ * @param ent 要放入的目录项，需要时改为新名称
+ * @return 0：成功；1：失败，已打印原因
+ */
+static int locate_dst(const char *dst, fcb stack[20], size_t *stack_size_ptr, fcb *ent) {
+    if (!resolve_dir(dst, stack, stack_size_ptr)) return 0;
+
+    char dir_path[256];
+    const char *name = split_path(dst, dir_path);
+    if (!strcmp(name, ".") || !strcmp(name, "..")) {
+        printf("%s: Path can't contain \".\" or \"..\"\n", dst);
+        return 1;
+    }
+    if (name[0] == '\0' || resolve_dir(dir_path, stack, stack_size_ptr)) {
+        printf("%s: No such directory\n", dst);
+        return 1;
+    }
+    size_t filename_size = strcspn(name, ".");
+    if (filename_size >= sizeof(ent->filename) || !name_fits(name)) {
+        printf("%s: Name too long\n", dst);
+        return 1;
+    }
+    memset(ent->filename, 0, sizeof(ent->filename));
+    memset(ent->ext, 0, sizeof(ent->ext));
+    memcpy(ent->filename, name, filename_size);
+    strcpy(ent->ext, name + filename_size);
+    return 0;
+}
+
+/**
+ * 检查目标目录能否再放入一个目录项（连同内联槽）：名称不重复，目录大小和空闲盘块足够
+ * @param extra 除目标目录变长之外还需要的盘块数
+ * @return 0：能；1：不能，已打印原因
+ */
+static int check_insert(const char *dst, const fcb *dir_fcb_ptr, const fcb *ent, size_t extra) {
+    fcb other;
+    if (find_entry(dir_fcb_ptr, ent->filename, SCAN_ANY_TYPE, &other) < dir_fcb_ptr->len / sizeof(fcb)) {
+        printf(other.is_file ? "%s: File already exist\n" : "%s: Directory already exist\n", dst);
+        return 1;
+    }
+    size_t add = ENTRY_SLOTS(ent) * sizeof(fcb);
+    if (dir_fcb_ptr->len + add > UINT16_MAX) {
+        printf("%s: Too many entries\n", dst);
+        return 1;
+    }
+
+    size_t need = extra + blocks_for(dir_fcb_ptr->len + add) - blocks_of(dir_fcb_ptr);
+    size_t free_cnt = 0;
+    for (int k = DATA_START; k < BLOCK_ASSET && free_cnt < need; k++) free_cnt += fat[k] == FREE;
+    if (need > free_cnt) {
+        printf("Not enough space, %zu blocks needed, %zu free\n", need, free_cnt);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * 目标 FCB 栈中是否包含目录 ent，即目标位置在该目录自身或子目录中
+ * @param dir_stack ent 所在目录的 FCB 栈
+ */
+static int stack_contains(const fcb stack[], size_t stack_size, const fcb dir_stack[], size_t dir_stack_size,
+                          const fcb *ent) {
+    return on_path(stack, stack_size, dir_stack, dir_stack_size) && stack_size > dir_stack_size &&
+           !strcmp(stack[dir_stack_size].filename, ent->filename);
+}
+
+/**
+ * mv 的实现：从源目录删除目录项，插入目标目录，不读写文件或子目录的 FAT 链和数据，
+ * 移动大文件或整棵目录树与移动空文件的代价相同；内联文件的内联槽随目录项一起移动
+ * @param src 源路径
+ * @param dst 已存在的目录（移动到其中，名称不变）或新路径（所在目录必须存在）
+ * @return 0：成功；1：失败，已打印原因
+ */
+static int move_path(const char *src, const char *dst) {
+    fcb src_stack[20];
+    size_t src_stack_size = 0;
+    fcb ent;
+    long pos = locate_src(src, src_stack, &src_stack_size, &ent);
+    if (pos < 0) return 1;
+    fcb *src_dir = &src_stack[src_stack_size - 1];
+
+    // 不能移动当前所在的目录
+    if (!ent.is_file && stack_contains(fcb_stack, fcb_stack_size, src_stack, src_stack_size, &ent)) {
+        printf("%s: Can't move directory where you in\n", src);
+        return 1;
+    }
+
+    fcb dst_stack[20];
+    size_t dst_stack_size = 0;
+    fcb moved = ent;
+    if (locate_dst(dst, dst_stack, &dst_stack_size, &moved)) return 1;
+    fcb *dst_dir = &dst_stack[dst_stack_size - 1];
+
+    // 目录不能移动到自身或子目录中
+    if (!ent.is_file && dst_stack_size == sizeof(fcb_stack) / sizeof(fcb)) {
+        printf("%s: Too deep\n", dst);
+        return 1;
+    }
+    if (!ent.is_file && stack_contains(dst_stack, dst_stack_size, src_stack, src_stack_size, &ent)) {
+        printf("%s: Can't move a directory into itself\n", src);
+        return 1;
+    }
+
+    // 同一目录内重命名：只覆盖这一个目录项
+    if (dst_dir->first == src_dir->first) {
+        fcb other;
+        size_t other_pos = find_entry(dst_dir, moved.filename, SCAN_ANY_TYPE, &other);
+        if (other_pos != (size_t) pos && other_pos < dst_dir->len / sizeof(fcb)) {
+            printf(other.is_file ? "%s: File already exist\n" : "%s: Directory already exist\n", dst);
+            return 1;
+        }
+        write_data(src_dir, pos * sizeof(fcb), &moved, sizeof(fcb));
+        return 0;
+    }
+
+    if (check_insert(dst, dst_dir, &moved, 0)) return 1;
+
+    fcb slots[1 + INLINE_SLOTS(INLINE_MAX)]; // 目录项连同内联槽
+    size_t slots_size = ENTRY_SLOTS(&moved);
+    slots[0] = moved;
+    read_data(src_dir, (pos + 1) * sizeof(fcb), &slots[1], (slots_size - 1) * sizeof(fcb));
+
+    // 先从源目录删除，源目录可能是目标路径上的目录，变化后同步到目标目录栈
+    remove_data(src_dir, pos * sizeof(fcb), slots_size * sizeof(fcb));
+    store_dir_fcb(src_stack, src_stack_size);
+    refresh_stack(dst_stack, dst_stack_size, src_stack, src_stack_size);
+    refresh_stack(fcb_stack, fcb_stack_size, src_stack, src_stack_size);
+
+    // 再追加到目标目录
+    write_data(dst_dir, dst_dir->len, slots, slots_size * sizeof(fcb));
+    store_dir_fcb(dst_stack, dst_stack_size);
+    refresh_stack(fcb_stack, fcb_stack_size, dst_stack, dst_stack_size);
+    return 0;
+}
+
+typedef struct frag_list {
+    unsigned char *units; // 每个片段的单元数
+    frag_ref *refs;       // 分配好的片段
+    size_t size;
+    size_t cap;
+} frag_list;
+
+/**
+ * 记下一个要复制的打包文件的片段单元数
+ */
+static void frag_list_add(frag_list *list, size_t len) {
+    if (list->size == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 16;
+        list->units = realloc(list->units, list->cap);
+        if (list->units == NULL) {
+            perror("Copy malloc error!");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->units[list->size++] = FRAG_UNITS(len);
+}
+
+/**
+ * 统计复制目录树需要的盘块数和层数，只读取目录；打包文件的片段按遍历顺序记入 frag_list，最后一起计算
+ * @param dir_fcb_ptr 目录 FCB
+ * @param blocks_ptr 盘块数，累加
+ * @param list 片段列表，追加
+ * @return 层数，没有子目录的目录为 1
+ */
+static size_t measure_tree(const fcb *dir_fcb_ptr, size_t *blocks_ptr, frag_list *list) {
+    size_t dir_size = dir_fcb_ptr->len / sizeof(fcb);
+    fcb *dir = malloc(dir_fcb_ptr->len + 1);
+    if (dir == NULL) {
+        perror("Copy malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    get_data_from_dist(dir, dir_fcb_ptr->first, dir_fcb_ptr->len);
+
+    *blocks_ptr += dir_fcb_ptr->len ? blocks_for(dir_fcb_ptr->len) : 0; // 空目录的副本不分配盘块
+    size_t height = 0;
+    for (size_t k = 0; k < dir_size; k = next_entry(dir, k, dir_size)) {
+        if (!dir[k].is_file) {
+            size_t sub = measure_tree(&dir[k], blocks_ptr, list); // MAX 会对参数求值两次
+            height = MAX(height, sub);
+        } else if (IS_PACKED(&dir[k]) && k + 1 < dir_size) frag_list_add(list, dir[k].len);
+    }
+    free(dir);
+    return height + 1;
+}
+
+/**
+ * 复制目录树：目录重新分配盘块写入新的目录项，文件与源文件共享整条链，只增加链首盘块的引用数，
+ * 内联文件的内联槽随目录一起复制，打包文件的内容复制到 measure_tree 之后按同样顺序分配好的片段
+ * @param dir_fcb_ptr 源目录 FCB，返回时 first 指向复制出的目录
+ * @param cursor_ptr 分配游标
+ * @param ref_ptr 下一个分配好的片段
+ */
+static void copy_tree(fcb *dir_fcb_ptr, unsigned short *cursor_ptr, const frag_ref **ref_ptr) {
+    size_t dir_size = dir_fcb_ptr->len / sizeof(fcb);
+    fcb *dir = malloc(dir_fcb_ptr->len + 1);
+    if (dir == NULL) {
+        perror("Copy malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    get_data_from_dist(dir, dir_fcb_ptr->first, dir_fcb_ptr->len);
+
+    for (size_t k = 0; k < dir_size; k = next_entry(dir, k, dir_size)) {
+        dir[k].created_time = (uint32_t) time(NULL);
+        hole_map hm;
+        load_hole_map(&dir[k], k + 1 < dir_size ? &dir[k + 1] : NULL, &hm);
+        if (IS_PACKED(&dir[k]) && k + 1 < dir_size) copy_frag(&dir[k + 1], dir[k].len, (*ref_ptr)++);
+        else if (!dir[k].is_file) copy_tree(&dir[k], cursor_ptr, ref_ptr);
+        else if (hm.first != FREE) refs[hm.first]++; // 稀疏文件同样共享已分配的盘块，hole_map 随目录复制
+    }
+
+    dir_fcb_ptr->first = FREE;
+    if (dir_fcb_ptr->len) {
+        dir_fcb_ptr->first = alloc_run(blocks_for(dir_fcb_ptr->len), cursor_ptr);
+        write_chain(dir_fcb_ptr->first, (const char *) dir, dir_fcb_ptr->len);
+    }
+    free(dir);
+}
+
+/**
+ * cp 的实现：文件与源文件共享盘块，只增加引用数，之后任一方写入时只复制被修改的盘块；
+ * 目录只复制目录本身，代价与元数据量成正比，与文件大小无关。打包文件不到一个盘块，内容直接复制到新的片段
+ * @param src 源路径
+ * @param dst 已存在的目录（复制到其中，名称不变）或新路径（所在目录必须存在）
+ * @param recursive 是否允许复制目录
+ * @return 0：成功；1：失败，已打印原因
+ */
+static int copy_path(const char *src, const char *dst, int recursive) {
+    fcb src_stack[20];
+    size_t src_stack_size = 0;
+    fcb ent;
+    long pos = locate_src(src, src_stack, &src_stack_size, &ent);
+    if (pos < 0) return 1;
+    if (!ent.is_file && !recursive) {
+        printf("%s: Is a directory\n", src);
+        return 1;
+    }
+
+    fcb dst_stack[20];
+    size_t dst_stack_size = 0;
+    fcb copied = ent;
+    if (locate_dst(dst, dst_stack, &dst_stack_size, &copied)) return 1;
+    fcb *dst_dir = &dst_stack[dst_stack_size - 1];
+
+    size_t need = 0;
+    frag_list list = {NULL, NULL, 0, 0};
+    if (!ent.is_file) {
+        if (stack_contains(dst_stack, dst_stack_size, src_stack, src_stack_size, &ent)) {
+            printf("%s: Can't copy a directory into itself\n", src);
+            return 1;
+        }
+        if (dst_stack_size + measure_tree(&ent, &need, &list) > sizeof(fcb_stack) / sizeof(fcb)) {
+            printf("%s: Too deep\n", dst);
+            free(list.units);
+            return 1;
+        }
+    } else if (IS_PACKED(&ent)) frag_list_add(&list, ent.len);
+    need += frag_need(list.units, list.size);
+    if (check_insert(dst, dst_dir, &copied, need)) {
+        free(list.units);
+        return 1;
+    }
+
+    // 片段在复制之前按记下的顺序一起分配，与 frag_need 模拟的顺序相同
+    list.refs = malloc(list.size * sizeof(frag_ref) + 1);
+    if (list.refs == NULL) {
+        perror("Copy malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t k = 0; k < list.size; k++) alloc_frag(list.units[k], &list.refs[k]);
+
+    fcb slots[1 + INLINE_SLOTS(INLINE_MAX)]; // 目录项连同内联槽或片段引用
+    size_t slots_size = ENTRY_SLOTS(&copied);
+    copied.created_time = (uint32_t) time(NULL);
+    if (copied.is_file && copied.first == FREE) {
+        read_data(&src_stack[src_stack_size - 1], (pos + 1) * sizeof(fcb), &slots[1], (slots_size - 1) * sizeof(fcb));
+        hole_map hm;
+        load_hole_map(&copied, &slots[1], &hm);
+        if (IS_PACKED(&copied)) copy_frag(&slots[1], copied.len, &list.refs[0]);
+        else if (hm.first != FREE) refs[hm.first]++;
+    } else if (copied.is_file) refs[copied.first]++;
+    else {
+        unsigned short cursor = DATA_START;
+        const frag_ref *next_ref = list.refs;
+        copy_tree(&copied, &cursor, &next_ref);
+    }
+    slots[0] = copied;
+    free(list.units);
+    free(list.refs);
+
+    write_data(dst_dir, dst_dir->len, slots, slots_size * sizeof(fcb));
+    store_dir_fcb(dst_stack, dst_stack_size);
+    refresh_stack(fcb_stack, fcb_stack_size, dst_stack, dst_stack_size);
+    return 0;
+}
+
+/**
+ * fallocate 的实现：文件长度扩展到 n 字节，新增的盘块一次分配、尽量接在链尾之后连续存放，标记为未写入，
+ * 不写数据文件。内联文件和打包文件先改为普通的链，稀疏文件的空洞同样分配为未写入的盘块，
+ * 被共享的盘块先复制，原来最后一个盘块中文件末尾之后的部分清零
+ * @param path 文件路径
+ * @param n 新的字节数，不大于原长度时不做任何事
+ * @return 0：成功；1：失败，已打印原因
+ */
+static int fallocate_path(const char *path, size_t n) {
+    fcb stack[20];
+    size_t stack_size = 0;
+    fcb ent;
+    long pos = locate_src(path, stack, &stack_size, &ent);
+    if (pos < 0) return 1;
+    if (!ent.is_file) {
+        printf("%s: Is a directory\n", path);
+        return 1;
+    }
+    if (n > UINT16_MAX) {
+        printf("%s: File too large\n", path);
+        return 1;
+    }
+    if (n <= ent.len) return 0;
+
+    fcb *dir = &stack[stack_size - 1];
+    fcb slot;
+    hole_map hm;
+    if (IS_SPARSE(&ent)) read_data(dir, (pos + 1) * sizeof(fcb), &slot, sizeof(fcb));
+    load_hole_map(&ent, &slot, &hm);
+
+    // 需要的盘块：新增的盘块和空洞，加上写时复制要复制的盘块（从第一个共享的盘块到链尾）
+    size_t present = __builtin_popcountll(hm.map);
+    size_t need = blocks_for(n) - present + shared_blocks(hm.first, present);
+    size_t free_cnt = 0;
+    for (int k = DATA_START; k < BLOCK_ASSET && free_cnt < need; k++) free_cnt += fat[k] == FREE;
+    if (need > free_cnt) {
+        printf("%s: Not enough space, %zu blocks needed, %zu free\n", path, need, free_cnt);
+        return 1;
+    }
+
+    if (IS_SPARSE(&ent)) { // 空洞先分配为未写入的盘块，之后按普通文件处理
+        fill_holes(&hm, hole_bits(blocks_for(ent.len)));
+        ent.first = hm.first;
+        remove_data(dir, (pos + 1) * sizeof(fcb), sizeof(fcb));
+    }
+    size_t have = blocks_of(&ent); // 已有内容的盘块数，之后的盘块都是预分配的
+    if (ent.first == FREE) {
+        // 取出内联槽或片段中的内容，目录项之后的槽随之删除
+        fcb slots[INLINE_SLOTS(INLINE_MAX)];
+        size_t slots_size = ENTRY_SLOTS(&ent) - 1;
+        char head[BLOCK_SIZE] = {0};
+        if (slots_size) {
+            read_data(dir, (pos + 1) * sizeof(fcb), slots, slots_size * sizeof(fcb));
+            if (IS_PACKED(&ent)) {
+                read_frag(&slots[0], head, ent.len);
+                free_frag(&slots[0], ent.len);
+            } else unpack_inline(slots, head, ent.len);
+            remove_data(dir, (pos + 1) * sizeof(fcb), slots_size * sizeof(fcb));
+        }
+
+        extend_chain(&ent, blocks_for(n));
+        if (ent.len) { // 第一个盘块写入原有内容，其余部分为零
+            write_block(ent.first, head, BLOCK_SIZE);
+            have = 1;
+        }
+    } else {
+        unshare_data(&ent, ent.len, ent.len); // 链尾要接上新盘块，整条链都不能共享
+        size_t tail = ent.len % BLOCK_SIZE;
+        if (tail) {
+            char zeros[BLOCK_SIZE] = {0};
+            write_data(&ent, ent.len, zeros, MIN(BLOCK_SIZE - tail, n - ent.len));
+        } else if (!ent.len) { // 空文件的盘块没有内容，同样作为预分配的盘块
+            dedup_remove(ent.first);
+            have = 0;
+        }
+        extend_chain(&ent, blocks_for(n));
+    }
+
+    size_t k = 0;
+    for (unsigned short b = ent.first; b < BLOCK_ASSET; b = fat[b], k++) {
+        if (k >= have) zlen[b] = ZLEN_UNWRITTEN;
+    }
+    ent.len = n;
+
+    write_data(dir, pos * sizeof(fcb), &ent, sizeof(fcb));
+    store_dir_fcb(stack, stack_size);
+    refresh_stack(fcb_stack, fcb_stack_size, stack, stack_size);
+    return 0;
+}
+
+/**
+ * write 的实现：在文件的 off 处写入 n 字节，off 超过文件长度时中间的部分读出零。
+ * 写入后不超过 FRAG_MAX 字节的内联文件和打包文件整体重新存放；其他文件只分配、修改写入范围内的盘块，
+ * 文件末尾与 off 之间的整块不分配盘块，成为空洞。目录项的槽数变化时目录项移到目录末尾
+ * @return 0：成功；1：失败，已打印原因
+ */
+static int write_path(const char *path, size_t off, const char *data, size_t n) {
+    fcb stack[20];
+    size_t stack_size = 0;
+    fcb ent;
+    long pos = locate_src(path, stack, &stack_size, &ent);
+    if (pos < 0) return 1;
+    if (!ent.is_file) {
+        printf("%s: Is a directory\n", path);
+        return 1;
+    }
+    if (off > UINT16_MAX || off + n > UINT16_MAX) {
+        printf("%s: File too large\n", path);
+        return 1;
+    }
+
+    fcb *dir = &stack[stack_size - 1];
+    fcb slots[1 + INLINE_SLOTS(INLINE_MAX)]; // 目录项连同内联槽、片段引用或 hole_map
+    size_t old_slots = ENTRY_SLOTS(&ent);
+    if (old_slots > 1) read_data(dir, (pos + 1) * sizeof(fcb), &slots[1], (old_slots - 1) * sizeof(fcb));
+
+    // 内联文件和打包文件原来的内容
+    char head[FRAG_MAX] = {0};
+    size_t head_len = 0;
+    if (ent.first == FREE && !IS_SPARSE(&ent)) {
+        head_len = ent.len;
+        if (IS_PACKED(&ent)) read_frag(&slots[1], head, ent.len);
+        else unpack_inline(&slots[1], head, ent.len);
+    }
+
+    fcb old = ent;
+    ent.len = MAX(old.len, off + n);
+    int small = old.first == FREE && !IS_SPARSE(&old) && ent.len <= FRAG_MAX; // 写入后仍是小文件
+    size_t need = 0;
+    size_t new_slots;
+    hole_map hm;
+    uint64_t want = 0; // 要修改的逻辑盘块
+    size_t hi = 0;     // 最后一个要修改的逻辑盘块之后
+    if (small) {
+        new_slots = ENTRY_SLOTS(&ent);
+        unsigned char units = FRAG_UNITS(ent.len);
+        if (IS_PACKED(&ent)) need = frag_need(&units, 1);
+    } else {
+        // 写入范围内的盘块；原来的内容放入第一个盘块；文件末尾与 off 之间已分配的盘块（末尾之后的部分）要清零
+        load_hole_map(&old, &slots[1], &hm);
+        if (n) want = hole_bits((off + n + BLOCK_SIZE - 1) / BLOCK_SIZE) & ~hole_bits(off / BLOCK_SIZE);
+        if (head_len) want |= 1;
+        if (off > old.len)
+            want |= hm.map & hole_bits((off + BLOCK_SIZE - 1) / BLOCK_SIZE) & ~hole_bits(old.len / BLOCK_SIZE);
+
+        hi = want ? HOLE_MAP_BITS - __builtin_clzll(want) : 0;
+        size_t prefix = __builtin_popcountll(hm.map & hole_bits(hi)); // 要重新串起的已分配盘块
+        need = __builtin_popcountll(want & ~hm.map) + shared_blocks(hm.first, prefix);
+        uint64_t all = hole_bits(blocks_for(ent.len));
+        new_slots = ((hm.map | want) & all) == all ? 1 : 2;
+    }
+
+    if (new_slots > old_slots) {
+        if (dir->len + (new_slots - old_slots) * sizeof(fcb) > UINT16_MAX) {
+            printf("%s: Too many entries\n", path);
+            return 1;
+        }
+        need += blocks_for(dir->len + (new_slots - old_slots) * sizeof(fcb)) - blocks_of(dir);
+    }
+    size_t free_cnt = 0;
+    for (int k = DATA_START; k < BLOCK_ASSET && free_cnt < need; k++) free_cnt += fat[k] == FREE;
+    if (need > free_cnt) {
+        printf("%s: Not enough space, %zu blocks needed, %zu free\n", path, need, free_cnt);
+        return 1;
+    }
+
+    if (IS_PACKED(&old)) free_frag(&slots[1], old.len);
+    if (small) {
+        memcpy(head + off, data, n);
+        if (IS_PACKED(&ent)) {
+            frag_ref ref;
+            alloc_frag(FRAG_UNITS(ent.len), &ref);
+            write_frag(&ref, head, ent.len);
+            memcpy(&slots[1], &ref, sizeof(ref));
+        } else pack_inline(&slots[1], head, ent.len);
+    } else {
+        fill_holes(&hm, want);
+        unsigned short b = hm.first;
+        for (size_t i = 0; i < hi; i++) {
+            if (!(hm.map >> i & 1)) continue;
+            if (want >> i & 1) {
+                size_t start = i * BLOCK_SIZE;
+                char buf[BLOCK_SIZE];
+                load_block(b, buf);
+                if (i == 0) memcpy(buf, head, head_len);
+                if (off > old.len && old.len < start + BLOCK_SIZE && off > start) { // 原来的末尾之后补零
+                    size_t from = MAX(old.len, start);
+                    memset(buf + from - start, 0, MIN(off, start + BLOCK_SIZE) - from);
+                }
+                if (n && off < start + BLOCK_SIZE && off + n > start) {
+                    size_t from = MAX(off, start);
+                    memcpy(buf + from - start, data + from - off, MIN(off + n, start + BLOCK_SIZE) - from);
+                }
+                write_block(b, buf, BLOCK_SIZE);
+            }
+            b = fat[b];
+        }
+
+        // 没有空洞时改回普通文件，否则链首记录在 hole_map 中
+        ent.first = new_slots == 1 ? hm.first : FREE;
+        memcpy(&slots[1], &hm, sizeof(hm));
+    }
+
+    slots[0] = ent;
+    if (new_slots == old_slots) write_data(dir, pos * sizeof(fcb), slots, new_slots * sizeof(fcb));
+    else {
+        remove_data(dir, pos * sizeof(fcb), old_slots * sizeof(fcb));
+        write_data(dir, dir->len, slots, new_slots * sizeof(fcb));
+    }
+    store_dir_fcb(stack, stack_size);
+    refresh_stack(fcb_stack, fcb_stack_size, stack, stack_size);
+    return 0;
+}
+
+/**
+ * 读取文件 off 处的 n 字节，文件末尾之后的部分不读取，空洞读出零，不修改虚拟磁盘
+ * @param n_ptr 实际读取的字节数的接收缓冲区
+ * @return 0：成功；1：失败，已打印原因
+ */
+static int read_path(const char *path, size_t off, char *buf, size_t n, size_t *n_ptr) {
+    fcb stack[20];
+    size_t stack_size = 0;
+    fcb ent;
+    long pos = locate_src(path, stack, &stack_size, &ent);
+    if (pos < 0) return 1;
+    if (!ent.is_file) {
+        printf("%s: Is a directory\n", path);
+        return 1;
+    }
+
+    n = off < ent.len ? MIN(n, ent.len - off) : 0;
+    *n_ptr = n;
+    if (n == 0) return 0;
+
+    // 内联槽、片段引用或 hole_map
+    fcb *dir = &stack[stack_size - 1];
+    fcb slots[INLINE_SLOTS(INLINE_MAX)];
+    size_t slots_size = ENTRY_SLOTS(&ent) - 1;
+    if (slots_size) read_data(dir, (pos + 1) * sizeof(fcb), slots, slots_size * sizeof(fcb));
+
+    if (IS_SPARSE(&ent)) { // 按盘块分布从头读到 off + n
+        hole_map hm;
+        load_hole_map(&ent, &slots[0], &hm);
+        char *data = malloc(off + n);
+        if (data == NULL) {
+            perror("Read malloc error!");
+            exit(EXIT_FAILURE);
+        }
+        read_blocks(&hm, data, off + n);
+        memcpy(buf, data + off, n);
+        free(data);
+    } else if (ent.first != FREE) read_data(&ent, off, buf, n);
+    else {
+        char head[FRAG_MAX];
+        if (IS_PACKED(&ent)) read_frag(&slots[0], head, ent.len);
+        else unpack_inline(slots, head, ent.len);
+        memcpy(buf, head + off, n);
+    }
+    return 0;
+}
+
+/**
+ * 移动或重命名文件、目录："mv <源路径> <目标路径>"，目标是已存在的目录时移动到其中，否则移动并改名为目标路径的最后一段
+ */
+static void my_mv() {
+    if (cmd_args_size != 3) { // 参数长度校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+
+    if (!move_path(cmd_args[1], cmd_args[2])) printf("%s: Moved to %s\n", cmd_args[1], cmd_args[2]);
+}
+
+/**
+ * 复制文件："cp <源路径> <目标路径>"；复制目录树："cp -r <源路径> <目标路径>"，目标的含义与 mv 相同。
+ * 复制出的文件与源文件共享盘块，不复制数据
+ */
+static void my_cp() {
+    int recursive = cmd_args_size == 4 && !strcmp(cmd_args[1], "-r");
+    if (cmd_args_size != 3 && !recursive) { // 参数校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+
+    const char *src = cmd_args[cmd_args_size - 2];
+    const char *dst = cmd_args[cmd_args_size - 1];
+    if (!copy_path(src, dst, recursive)) printf("%s: Copied to %s\n", src, dst);
+}
+
+/**
+ * 预分配："fallocate <路径> <字节数>"，文件扩展到指定字节数，新增部分一次分配连续的盘块，
+ * 读取时为零，之后写入时不需要再分配盘块；字节数不大于文件长度时不做任何事
+ */
+static void my_fallocate() {
+    char *end = NULL;
+    unsigned long n = cmd_args_size == 3 ? strtoul(cmd_args[2], &end, 10) : 0;
+    if (cmd_args_size != 3 || end == cmd_args[2] || *end != '\0') { // 参数校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+
+    if (!fallocate_path(cmd_args[1], n)) printf("%s: Allocated %lu bytes\n", cmd_args[1], n);
+}
+
+/**
+ * 按偏移写入："write <路径> <偏移> <内容>"，内容为一个参数，偏移超过文件长度时中间的部分成为空洞
+ */
+static void my_write() {
+    char *end = NULL;
+    unsigned long off = cmd_args_size == 4 ? strtoul(cmd_args[2], &end, 10) : 0;
+    if (cmd_args_size != 4 || end == cmd_args[2] || *end != '\0') { // 参数校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+
+    size_t n = strlen(cmd_args[3]);
+    if (!write_path(cmd_args[1], off, cmd_args[3], n)) printf("%s: Wrote %zu bytes at %lu\n", cmd_args[1], n, off);
+}
+
+/**
+ * 离线去重："dedup"，按目录逐个处理所有文件：先把没有共享的全零盘块改为空洞并释放，
+ * 再把内容相同（并且后继也相同）的盘块合并为共享盘块，稀疏文件合并已分配盘块组成的链。
+ * FAT 中一个盘块只有一个后继，所以只能共享链的相同后缀：内容相同的整个文件、只有开头不同的文件可以合并，
+ * 中间有不同的文件只合并最后一处不同之后的部分。打印节省的盘块数和花费的时间。只合并文件数据，目录盘块不共享
+ */
+static void my_dedup() {
+    if (cmd_args_size > 1) { // 参数长度校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+
+    double start = now();
+    unsigned long hashed = dd_stat.hashed;
+    size_t used = 0;
+    for (int i = DATA_START; i < BLOCK_ASSET; i++) used += fat[i] != FREE;
+
+    fcb stack[sizeof(fcb_stack) / sizeof(fcb)];
+    stack[0] = fcb_stack[0];
+    size_t files = 0;
+    size_t holes = 0;
+    dedup_dir(stack, 1, &files, &holes);
+
+    size_t after = 0;
+    for (int i = DATA_START; i < BLOCK_ASSET; i++) after += fat[i] != FREE;
+    if (after != used) mod_seq++; // 可能只修改了 FAT
+
+    double seconds = now() - start;
+    dd_stat.saved += used - after;
+    dd_stat.seconds += seconds;
+    unsigned long scanned = dd_stat.hashed - hashed;
+    printf("Deduplicated %zu files, %lu blocks scanned, %zu blocks saved (%zu zero blocks), %.1f ms, %.1f MB/s\n",
+           files, scanned, used - after, holes, seconds * 1000,
+           seconds > 0 ? scanned * BLOCK_SIZE / seconds / 1e6 : 0.0);
+}
 
-        fcb tar_fcb;
-        if (!strcmp(paths[i], "..")) { // 返回上一级目录
-            if (tmp_fcb_stack_size == 1) { // 当前在根目录，没有上一级目录了，直接报错
-                printf("%s: No such directory\n", cmd_args[1]);
-                return;
-            }
+/**
+ * 离线去重目录栈栈顶的目录，之后深度优先处理子目录。全零盘块改为空洞时目录项可能移到目录末尾、目录变长，
+ * 所以改完后重新读取目录
+ * @param stack 从根目录到该目录的 FCB 栈，容量与 fcb_stack 相同，目录变化时随之更新
+ * @param files_ptr 处理的文件数，累加
+ * @param holes_ptr 改为空洞的全零盘块数，累加
+ */
+static void dedup_dir(fcb stack[], size_t stack_size, size_t *files_ptr, size_t *holes_ptr) {
+    fcb *dir_fcb_ptr = &stack[stack_size - 1];
+    fcb *dir = malloc(dir_fcb_ptr->len + 1);
+    if (dir == NULL) {
+        perror("Dedup malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    size_t dir_size = dir_fcb_ptr->len / sizeof(fcb);
+    get_data_from_dist(dir, dir_fcb_ptr->first, dir_fcb_ptr->len);
+    for (size_t k = 0; k < dir_size; k = next_entry(dir, k, dir_size)) {
+        if (!dir[k].is_file) continue;
+        fcb ent;
+        size_t pos = find_entry(dir_fcb_ptr, dir[k].filename, 1, &ent);
+        if (pos < dir_fcb_ptr->len / sizeof(fcb)) *holes_ptr += zero_holes(stack, stack_size, pos, ent);
+    }
 
-            tmp_fcb_stack_size--; // 出栈
-            tar_fcb = tmp_fcb_stack[tmp_fcb_stack_size - 1];
-        } else { // 进入下一级目录
-            // 不存在直接打印错误信息并退出
-            if (get_fcb_from(&tmp_fcb_stack[tmp_fcb_stack_size - 1], paths[i], 0, &tar_fcb)) {
-                printf("%s: No such directory\n", cmd_args[1]);
-                return;
+    dir = realloc(dir, dir_fcb_ptr->len + 1);
+    if (dir == NULL) {
+        perror("Dedup malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    dir_size = dir_fcb_ptr->len / sizeof(fcb);
+    get_data_from_dist(dir, dir_fcb_ptr->first, dir_fcb_ptr->len);
+
+    // 目录中有文件的 first 或 hole_map 改变时整个目录写回一次
+    int changed = 0;
+    for (size_t k = 0; k < dir_size; k = next_entry(dir, k, dir_size)) {
+        if (!dir[k].is_file) continue;
+        if (IS_SPARSE(&dir[k]) && k + 1 < dir_size) {
+            hole_map hm;
+            memcpy(&hm, &dir[k + 1], sizeof(hm));
+            if (dedup_sparse(&dir[k], &hm)) {
+                memcpy(&dir[k + 1], &hm, sizeof(hm));
+                changed = 1;
             }
-
-            tmp_fcb_stack[tmp_fcb_stack_size++] = tar_fcb; // 找到目标目录后将 FCB 入栈
-        }
+        } else if (dir[k].first != FREE) changed |= dedup_file(&dir[k]);
+        else continue; // 内联文件和打包文件没有自己的盘块
+        (*files_ptr)++;
     }
+    if (changed) write_data(dir_fcb_ptr, 0, dir, dir_fcb_ptr->len); // 长度不变，目录盘块不共享，上一级目录不需要更新
 
-    // 这时已经找到了最终目标目录
-    // 维护全局变量 fcb_stack
-    memcpy(fcb_stack, tmp_fcb_stack, tmp_fcb_stack_size * sizeof(fcb));
-    fcb_stack_size = tmp_fcb_stack_size;
+    // 子目录的目录项在上面没有改变；子目录变化时写回本目录中自己的目录项，本目录的长度不变
+    for (size_t k = 0; k < dir_size && stack_size < sizeof(fcb_stack) / sizeof(fcb); k = next_entry(dir, k, dir_size)) {
+        if (dir[k].is_file) continue;
+        stack[stack_size] = dir[k];
+        dedup_dir(stack, stack_size + 1, files_ptr, holes_ptr);
+    }
+    free(dir);
 }
 
 /**
- * 创建文件夹，路径段不能含有 ".." 和 "."。
+ * 查看磁盘使用情况，块缓存模式下同时列出缓存命中统计
  */
-static void my_mkdir() {
-    if (cmd_args_size != 2) { // 参数长度校验
+static void my_stat() {
+    if (cmd_args_size > 1) { // 参数长度校验
         printf("Unknown command: %s\n", cmd_arg);
         return;
     }
 
-    // 解析路径
-    char paths[16][16];
-    size_t paths_size = 0;
-    if (parse_path(cmd_args[1], paths, &paths_size)) {
+    int used = 0;
+    int compressed = 0;
+    int unwritten = 0; // 预分配未写入的盘块数
+    int shared = 0;
+    int fragments = 0; // 链中后继不是下一个盘块的数据盘块数，越少链越连续
+    int packed = 0;    // 片段盘块数
+    int units = 0;     // 片段盘块中已用的单元数
+    for (size_t i = 0; i < BLOCK_ASSET; i++) {
+        if (fat[i] != FREE) used++;
+        if (fat[i] != FREE && zlen[i] == ZLEN_UNWRITTEN) unwritten++;
+        else if (fat[i] != FREE && zlen[i]) compressed++;
+        if (fat[i] != FREE && refs[i]) shared++;
+        if (i >= DATA_START && fat[i] != FREE && fat[i] != END && fat[i] != i + 1) fragments++;
+        if (fat[i] != FREE && frags[i]) {
+            packed++;
+            units += __builtin_popcount(frags[i]);
+        }
+    }
+    printf("blocks: %d, used: %d, free: %d, compressed: %d, unwritten: %d, shared: %d, fragments: %d\n", BLOCK_ASSET,
+           used, BLOCK_ASSET - used, compressed, unwritten, shared, fragments);
+    printf("packed blocks: %d, used units: %d/%d\n", packed, units, packed * FRAG_BLOCK_UNITS);
+    if (sys_opt.dedup || dd_stat.hashed || dd_stat.copied) {
+        printf("dedup index: %zu, hashed: %lu, saved: %lu, copied: %lu, time: %.1f ms\n", dedup_size(),
+               dd_stat.hashed, dd_stat.saved, dd_stat.copied, dd_stat.seconds * 1000);
+    }
+
+    if (sys_opt.cache_size) {
+        size_t frame_cnt;
+        cache_stat stat;
+        cache_get_stat(&frame_cnt, &stat);
+        printf("cache frames: %zu, hits: %lu, misses: %lu, prefetches: %lu, evictions: %lu, writebacks: %lu\n",
+               frame_cnt, stat.hits, stat.misses, stat.prefetches, stat.evictions, stat.writebacks);
+    }
+    printf("aio backend: %s, data files: %zu, stripe unit: %d blocks\n", aio_backend_name(io_ctx), stripe_count(),
+           STRIPE_UNIT);
+
+    static const char *verify_modes[] = {"lazy", "mount", "off"};
+    printf("checksum: %s, verify: %s, errors: %lu\n", crc32c_kernel_name(), verify_modes[sys_opt.verify], crc_errors);
+
+    static const char *sync_modes[] = {"none", "cmd", "group"};
+    wb_stat wstat;
+    wb_get_stat(&wstat);
+    printf("writeback interval: %u ms, dirty: %zu, flushes: %lu, flushed blocks: %lu, flushed KiB: %lu\n",
+           sys_opt.flush_interval, dirty_cnt, wstat.flushes, wstat.blocks, wstat.bytes / 1024);
+    printf("sync mode: %s, commits: %lu, fsyncs: %lu\n", sync_modes[sys_opt.sync_mode], wstat.commits, wstat.fsyncs);
+}
+
+/**
+ * 立即回写所有脏块并落盘，等待完成
+ */
+static void my_sync() {
+    if (cmd_args_size > 1) { // 参数长度校验
         printf("Unknown command: %s\n", cmd_arg);
         return;
     }
-    if (paths_size == 0) return; // 如果解析后的路径为空，直接返回
 
-    // 校验合法性
-    for (int i = 0; i < paths_size; ++i) {
-        if (!strcmp(paths[i], "..") || !strcmp(paths[i], ".")) {
-            printf("%s: Path can't contain \".\" or \"..\"\n", cmd_arg);
-            return;
-        }
-    }
+    wb_sync();
 
-    fcb tmp_fcb_stack[36]; // 临时 fcb 栈
-    size_t tmp_fcb_stack_size = 0;
-    int i = 0;
-    if (!strcmp(paths[0], "/")) { // 绝对路径
-        i = 1;
-        tmp_fcb_stack[tmp_fcb_stack_size++] = fcb_stack[0];
-    } else { // 相对路径
-        i = 0;
-        memcpy(tmp_fcb_stack, fcb_stack, fcb_stack_size * sizeof(fcb));
-        tmp_fcb_stack_size = fcb_stack_size;
+    printf("Done\n");
+}
+
+/**
+ * fsck 读取盘块，多个线程同时调用。块缓存不是线程安全的，块缓存模式下直接读取数据文件到每个线程自己的缓冲区
+ */
+static const char *fsck_read_block(unsigned short block) {
+    static _Thread_local char buf[BLOCK_SIZE];
+    if (dist != NULL) return dist + (size_t) block * BLOCK_SIZE;
+
+    if (stripe_pread(buf, block, 1)) {
+        perror("Data file read error!");
+        exit(EXIT_FAILURE);
     }
+    return buf;
+}
 
-    // 遍历路径段
-    while (1) {
-        fcb tar_fcb;
-        fcb *cur_fcb_ptr = &tmp_fcb_stack[tmp_fcb_stack_size - 1];
-        fcb *prev_fcb_ptr = tmp_fcb_stack_size == 1 ? NULL : &tmp_fcb_stack[tmp_fcb_stack_size - 2];
+static void fsck_write_dir(fcb *dir_fcb_ptr, const fcb dir[], size_t dir_size) {
+    rewrite_data(dir_fcb_ptr, (char *) dir, dir_size * sizeof(fcb));
+}
 
-        if (i == paths_size - 1) { // 最后一个路径段
-            // 存在目录，直接报错
-            if (!get_fcb_from(cur_fcb_ptr, paths[i], 0, &tar_fcb)) {
-                printf("%s: Directory already exist\n", cmd_arg);
-                return;
-            }
+static void fsck_write_root(const fcb *root_fcb_ptr) {
+    write_meta(ROOT_FCB_OFFSET, root_fcb_ptr, sizeof(fcb));
+}
 
-            create_fcb(prev_fcb_ptr, cur_fcb_ptr, paths[i], &tar_fcb, 0);
-            break;
-        }
+/**
+ * 检查文件系统一致性，"fsck -y" 同时修复，修复后回到根目录
+ */
+static void my_fsck() {
+    int repair = 0;
+    if (cmd_args_size == 2 && !strcmp(cmd_args[1], "-y")) repair = 1;
+    else if (cmd_args_size > 1) { // 参数校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+    if (txn.active) { // fsck 直接读写虚拟磁盘，看不到事务中的修改
+        printf("Can't fsck in a transaction\n");
+        return;
+    }
 
-        // 不存在目录，需要创建
-        if (get_fcb_from(cur_fcb_ptr, paths[i], 0, &tar_fcb))
-            create_fcb(prev_fcb_ptr, cur_fcb_ptr, paths[i], &tar_fcb, 0);
+    if (sys_opt.cache_size) wb_sync(); // 块缓存模式下直接读数据文件，先写回脏帧
 
-        tmp_fcb_stack[tmp_fcb_stack_size++] = tar_fcb;
+    fcb root_dir_fcb;
+    read_meta(ROOT_FCB_OFFSET, &root_dir_fcb, sizeof(fcb));
+
+    fsck_ops ops = {fsck_read_block, fsck_write_dir, fsck_write_root};
+    fsck_report report;
+    size_t problems = fsck_run(fat, zlen, refs, frags, &root_dir_fcb, repair, &ops, &report);
+    fsck_print_report(&report);
+
+    if (problems && repair) { // 目录可能被修改，FCB 栈中的副本已经失效
+        fcb_stack_size = 0;
+        fcb_stack[fcb_stack_size++] = root_dir_fcb;
+        printf("Repaired\n");
     }
+}
 
-    // 维护 fcb_stack
-    for (int j = 0; j < fcb_stack_size && !strcmp(tmp_fcb_stack[j].filename, fcb_stack[j].filename); ++j) {
-        fcb_stack[j] = tmp_fcb_stack[j];
+/**
+ * 打印目录树节点相对根节点的路径
+ */
+static void print_node(const host_tree *tree, int idx) {
+    const tree_node *nd = &tree->nodes[idx];
+    if (nd->parent > 0) {
+        print_node(tree, nd->parent);
+        printf("/");
     }
+    printf("%s", nd->name);
+}
 
-    printf("%s: Create directory success\n", cmd_args[1]);
+static int cmp_name(const void *a, const void *b) {
+    return strcmp(a, b);
 }
 
 /**
- * 删除指定目录。
- * 路径不能包含 "." 和 ".."
+ * 导入的节点在所在目录中占用的字节数，小文件连同内联槽或片段引用
  */
-static void my_rmdir() {
-//    if (cmd_args_size != 2) { // 参数长度校验
-//        printf("Unknown command: %s\n", cmd_arg);
-//        return;
-//    }
-//
-//    // 解析路径
-//    char paths[16][16];
-//    size_t paths_size = 0;
-//    if (parse_path(cmd_args[1], paths, &paths_size)) {
-//        printf("Unknown command: %s\n", cmd_arg);
-//        return;
-//    }
-//    if (paths_size == 0) return; // 如果解析后的路径为空，直接返回
-//
-//    // 校验合法性，路径不能包含 "." 和 ".."
-//    for (int i = 0; i < paths_size; ++i) {
-//        if (!strcmp(paths[i], "..") || !strcmp(paths[i], ".")) {
-//            printf("%s: Path can't contain \".\" or \"..\"\n", cmd_arg);
-//            return;
-//        }
-//    }
-//
-//    // 校验当前位置是否是目标删除目录或在目标删除目录中
-//    for (int i = 0, j = 0;; i++, j++) {
-//        if (j == paths_size) {
-//            printf("%s: Can't remove directory where you in", cmd_arg);
-//            return;
-//        }
-//
-//        if (i == fcb_stack_size || strcmp(fcb_stack[i].filename, paths[j]) != 0) break;
-//    }
-//
-//    fcb prev_fcb; // 上一级目录的 FCB
-//    fcb cur_fcb; // 当前目录的 FCB
-//    int k = 0;
-//    if (!strcmp(paths[0], "/")) { // 绝对路径
-//        k = 1;
-//        cur_fcb = blk0.root_dir_fcb;
-//    } else { // 相对路径
-//        k = 0;
-//        cur_fcb = fcb_stack[fcb_stack_size - 1];
-//        if (fcb_stack_size > 1) prev_fcb = fcb_stack[fcb_stack_size - 2];
-//    }
-//
-//    // 遍历 paths，将 cur_fcb 移动到目标删除目录，同时维护 prev_fcb
-//    for (; k < paths_size; k++) {
-//        fcb tar_fcb;
-//
-//        // 不存在目录，返回错误
-//        if (get_fcb_from(&cur_fcb, paths[k], 0, &tar_fcb)) {
-//            printf("%s: No such directory\n", cmd_arg);
-//            return;
-//        }
-//
-//        prev_fcb = cur_fcb;
-//        cur_fcb = tar_fcb;
-//    }
-//
-//    // 删除目录
-//    rmfcb_in(&prev_fcb, &cur_fcb);
+static size_t node_entry_size(const tree_node *nd) {
+    if (nd->is_file && nd->len <= INLINE_MAX) return (1 + INLINE_SLOTS(nd->len)) * sizeof(fcb);
+    return (nd->is_file && nd->len <= FRAG_MAX ? 2 : 1) * sizeof(fcb);
 }
 
 /**
- * 创建文件，路径段不能含有 ".." 和 "."。
+ * 导入的目录的内容字节数
  */
-static void my_create() {
-    if (cmd_args_size != 2) { // 参数长度校验
-        printf("Unknown command: %s\n", cmd_arg);
-        return;
+static size_t node_dir_len(const host_tree *tree, const tree_node *nd) {
+    size_t len = 0;
+    for (int c = nd->first_child; c < nd->first_child + nd->child_cnt; c++) len += node_entry_size(&tree->nodes[c]);
+    return len;
+}
+
+/**
+ * 生成导入的目录的内容：子节点的目录项，小文件的内容放进紧跟的内联槽，打包文件紧跟片段引用
+ * @param entries 每个节点的目录项
+ * @param packed 每个打包文件节点的片段
+ * @param dir 接收缓冲区，node_dir_len 字节
+ */
+static void pack_node_dir(const host_tree *tree, const fcb entries[], const frag_ref packed[], const tree_node *nd,
+                          fcb dir[]) {
+    size_t k = 0;
+    for (int c = nd->first_child; c < nd->first_child + nd->child_cnt; c++) {
+        dir[k++] = entries[c];
+        if (IS_PACKED(&entries[c])) memcpy(&dir[k++], &packed[c], sizeof(fcb));
+        if (!IS_INLINE(&entries[c])) continue;
+        pack_inline(&dir[k], tree->nodes[c].data, tree->nodes[c].len);
+        k += INLINE_SLOTS(tree->nodes[c].len);
     }
+}
 
-    // 解析路径
-    char paths[16][16];
-    size_t paths_size = 0;
-    if (parse_path(cmd_args[1], paths, &paths_size)) {
-        printf("Unknown command: %s\n", cmd_arg);
-        return;
+/**
+ * 检查导入的目录树能否放进目标目录：名称、重名（不区分扩展名）、目录大小、目录层级深度
+ * @param tree 目录树
+ * @param dir_fcb_ptr 目标目录 FCB
+ * @param depth 目标目录所在的层级，根目录为 1
+ * @return 出错数量
+ */
+static size_t check_import(const host_tree *tree, const fcb *dir_fcb_ptr, size_t depth) {
+    size_t errors = 0;
+    size_t *depths = malloc(tree->size * sizeof(size_t));
+    if (depths == NULL) {
+        perror("Import malloc error!");
+        exit(EXIT_FAILURE);
     }
-    if (paths_size == 0) return; // 如果解析后的路径为空，直接返回
+    depths[0] = depth;
 
-    // 校验是否含有 "." 和 ".."
-    for (int i = 0; i < paths_size; ++i) {
-        if (!strcmp(paths[i], "..") || !strcmp(paths[i], ".")) {
-            printf("%s: Path can't contain \".\" or \"..\"\n", cmd_arg);
-            return;
+    for (size_t i = 0; i < tree->size; i++) {
+        const tree_node *nd = &tree->nodes[i];
+        if (i > 0) depths[i] = depths[nd->parent] + 1;
+        if (nd->is_file) continue;
+
+        if (depths[i] > sizeof(fcb_stack) / sizeof(fcb)) {
+            print_node(tree, (int) i);
+            printf(": Too deep\n");
+            errors++;
+        }
+        if ((i == 0 ? dir_fcb_ptr->len : 0) + node_dir_len(tree, nd) > UINT16_MAX) {
+            print_node(tree, (int) i);
+            printf(": Too many entries\n");
+            errors++;
+            continue;
+        }
+
+        // 不包括扩展名的名称排序后相邻比较找出重名
+        char (*names)[16] = malloc(nd->child_cnt * sizeof(names[0]) + 1);
+        if (names == NULL) {
+            perror("Import malloc error!");
+            exit(EXIT_FAILURE);
+        }
+        for (int c = 0; c < nd->child_cnt; c++) {
+            const char *name = tree->nodes[nd->first_child + c].name;
+            size_t filename_size = strcspn(name, ".");
+            memcpy(names[c], name, filename_size);
+            names[c][filename_size] = '\0';
+
+            if (filename_size == 0 || !name_fits(name)) {
+                print_node(tree, nd->first_child + c);
+                printf(": Bad name\n");
+                errors++;
+            } else if (i == 0 && find_entry(dir_fcb_ptr, names[c], SCAN_ANY_TYPE, NULL) != dir_fcb_ptr->len / sizeof(fcb)) {
+                print_node(tree, nd->first_child + c);
+                printf(": Already exist\n");
+                errors++;
+            }
         }
+        qsort(names, nd->child_cnt, sizeof(names[0]), cmp_name);
+        for (int c = 1; c < nd->child_cnt; c++) {
+            if (strcmp(names[c - 1], names[c]) != 0) continue;
+            if (i > 0) {
+                print_node(tree, (int) i);
+                printf("/");
+            }
+            printf("%s: Duplicate name\n", names[c]);
+            errors++;
+        }
+        free(names);
     }
 
-    fcb tmp_fcb_stack[32];
-    size_t tmp_fcb_stack_size = 0;
-    int i = 0;
-    if (!strcmp(paths[0], "/")) { // 绝对路径
-        i = 1;
-        tmp_fcb_stack[tmp_fcb_stack_size++] = fcb_stack[0];
-    } else { // 相对路径
-        i = 0;
-        memcpy(tmp_fcb_stack, fcb_stack, fcb_stack_size * sizeof(fcb));
-        tmp_fcb_stack_size = fcb_stack_size;
+    free(depths);
+    return errors;
+}
+
+/**
+ * 导入宿主机目录树："import <宿主机目录> <路径>"，宿主机目录下的内容放进已存在的目录。
+ * 多线程读入整棵树并检查，有错误时不做任何修改；盘块按节点顺序连续分配，每条链只写一次，
+ * 小文件内联在目录中，不到一个盘块的文件打包进片段盘块，目标目录只追加一次新目录项
+ */
+static void my_import() {
+    if (cmd_args_size != 3) { // 参数长度校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
     }
 
-    // 遍历路径段
-    while (1) {
-        fcb tar_fcb;
-        fcb *prev_dir_fcb_ptr = tmp_fcb_stack_size == 1 ? NULL : &tmp_fcb_stack[tmp_fcb_stack_size - 2];
-        fcb *cur_dir_fcb_ptr = &tmp_fcb_stack[tmp_fcb_stack_size - 1];
+    fcb tmp_fcb_stack[20];
+    size_t tmp_fcb_stack_size = 0;
+    if (resolve_dir(cmd_args[2], tmp_fcb_stack, &tmp_fcb_stack_size)) {
+        printf("%s: No such directory\n", cmd_args[2]);
+        return;
+    }
+    fcb *cur_dir_fcb_ptr = &tmp_fcb_stack[tmp_fcb_stack_size - 1];
+    fcb *prev_dir_fcb_ptr = tmp_fcb_stack_size == 1 ? NULL : &tmp_fcb_stack[tmp_fcb_stack_size - 2];
+
+    // 多线程读入宿主机目录树，文件大小受 len 字段限制
+    host_tree tree;
+    size_t errors = tree_load(cmd_args[1], UINT16_MAX, &tree);
+    if (errors == 0) errors = check_import(&tree, cur_dir_fcb_ptr, tmp_fcb_stack_size);
+
+    // 需要的盘块：每个目录和不能打包的文件一条链，新的片段盘块，再加上目标目录变长后多出的盘块
+    size_t need = 0;
+    size_t files = 0;
+    unsigned char *units = malloc(tree.size);
+    if (units == NULL) {
+        perror("Import malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    size_t units_size = 0;
+    for (size_t i = 1; i < tree.size; i++) {
+        const tree_node *nd = &tree.nodes[i];
+        if (!nd->is_file && nd->child_cnt) need += blocks_for(node_dir_len(&tree, nd));
+        else if (nd->len > FRAG_MAX) need += blocks_for(nd->len);
+        else if (nd->len > INLINE_MAX) units[units_size++] = FRAG_UNITS(nd->len);
+        files += nd->is_file;
+    }
+    need += frag_need(units, units_size);
+    free(units);
+    size_t add = node_dir_len(&tree, &tree.nodes[0]);
+    need += blocks_for(cur_dir_fcb_ptr->len + add) - blocks_of(cur_dir_fcb_ptr);
+    size_t free_cnt = 0;
+    for (int i = DATA_START; i < BLOCK_ASSET; i++) free_cnt += fat[i] == FREE;
+    if (errors == 0 && need > free_cnt) {
+        printf("%s: Not enough space, %zu blocks needed, %zu free\n", cmd_args[1], need, free_cnt);
+        errors++;
+    }
+    if (errors || add == 0) {
+        if (errors) printf("%s: %zu errors, nothing imported\n", cmd_args[1], errors);
+        tree_free(&tree);
+        return;
+    }
 
-        // 最后一个路径段为文件名
-        if (i == paths_size - 1) {
-            if (!get_fcb_from(cur_dir_fcb_ptr, paths[i], 1, &tar_fcb)) {
-                printf("%s: File already exist\n", cmd_arg);
-                return;
-            }
+    // 先按节点顺序分配片段并写入打包文件，与 frag_need 模拟的顺序相同
+    fcb *entries = calloc(tree.size, sizeof(fcb));
+    frag_ref *packed = calloc(tree.size, sizeof(frag_ref));
+    if (entries == NULL || packed == NULL) {
+        perror("Import malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 1; i < tree.size; i++) {
+        const tree_node *nd = &tree.nodes[i];
+        if (!nd->is_file || nd->len <= INLINE_MAX || nd->len > FRAG_MAX) continue;
+        alloc_frag(FRAG_UNITS(nd->len), &packed[i]);
+        write_frag(&packed[i], nd->data, nd->len);
+    }
 
-            create_fcb(prev_dir_fcb_ptr, cur_dir_fcb_ptr, paths[i], &tar_fcb, 1);
-            break;
-        }
+    // 生成每个节点的目录项并分配盘块，一个目录的子节点编号连续，子节点的目录项（连同槽）就是该目录的内容
+    unsigned short cursor = DATA_START;
+    for (size_t i = 1; i < tree.size; i++) {
+        const tree_node *nd = &tree.nodes[i];
+        fcb *f = &entries[i];
+        size_t filename_size = strcspn(nd->name, ".");
+        memcpy(f->filename, nd->name, filename_size);
+        strcpy(f->ext, nd->name + filename_size);
+        f->is_file = nd->is_file;
+        f->created_time = nd->mtime;
+        f->len = nd->is_file ? nd->len : node_dir_len(&tree, nd);
+        if (f->is_file ? f->len <= FRAG_MAX : f->len == 0) f->first = FREE; // 小文件内联或打包，空目录推迟分配
+        else if (!(sys_opt.dedup && f->is_file)) f->first = alloc_run(blocks_for(f->len), &cursor);
+    }
 
-        // 不存在目录，需要创建
-        if (get_fcb_from(cur_dir_fcb_ptr, paths[i], 0, &tar_fcb))
-            create_fcb(prev_dir_fcb_ptr, cur_dir_fcb_ptr, paths[i], &tar_fcb, 0);
+    // 在线去重时文件先写入，合并到已有盘块后 first 才确定，目录内容要用到子节点的 first
+    size_t allocated = need;
+    for (size_t i = 1; i < tree.size && sys_opt.dedup; i++) {
+        const tree_node *nd = &tree.nodes[i];
+        if (nd->is_file && nd->len > FRAG_MAX)
+            allocated -= blocks_for(nd->len) - write_dedup(&entries[i], nd->data, nd->len, &cursor);
+    }
 
-        tmp_fcb_stack[tmp_fcb_stack_size++] = tar_fcb;
+    // 每条链只写一次
+    fcb *dir = malloc(UINT16_MAX + 1);
+    if (dir == NULL) {
+        perror("Import malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 1; i < tree.size; i++) {
+        const tree_node *nd = &tree.nodes[i];
+        if (entries[i].first == FREE || (nd->is_file && sys_opt.dedup)) continue;
+        if (nd->is_file) write_chain(entries[i].first, nd->data, entries[i].len);
+        else {
+            pack_node_dir(&tree, entries, packed, nd, dir);
+            write_chain(entries[i].first, (const char *) dir, entries[i].len);
+        }
     }
 
+    // 新目录项一次追加到目标目录，再更新上一级目录中的目录项
+    pack_node_dir(&tree, entries, packed, &tree.nodes[0], dir);
+    write_data(cur_dir_fcb_ptr, cur_dir_fcb_ptr->len, dir, add);
+    free(dir);
+    if (prev_dir_fcb_ptr == NULL) write_meta(ROOT_FCB_OFFSET, cur_dir_fcb_ptr, sizeof(fcb));
+    else update_entry(prev_dir_fcb_ptr, cur_dir_fcb_ptr);
+
     // 维护 fcb_stack
-    for (int j = 0; j < fcb_stack_size && !strcmp(tmp_fcb_stack[j].filename, fcb_stack[j].filename); ++j) {
+    for (size_t j = 0; j < fcb_stack_size && j < tmp_fcb_stack_size &&
+                    !strcmp(tmp_fcb_stack[j].filename, fcb_stack[j].filename); ++j) {
         fcb_stack[j] = tmp_fcb_stack[j];
     }
 
-    printf("%s: File created\n", cmd_arg);
+    printf("%s: Imported %zu directories, %zu files, %zu blocks\n", cmd_args[1], tree.size - 1 - files, files, allocated);
+    free(entries);
+    free(packed);
+    tree_free(&tree);
+}
+
+/**
+ * 导出目录树到宿主机："export <路径> <宿主机目录>"，宿主机目录不存在时创建，已存在的同名文件被覆盖。
+ * 逐个目录读出整棵树后多线程写入宿主机
+ */
+static void my_export() {
+    if (cmd_args_size != 3) { // 参数长度校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
+    }
+
+    fcb tmp_fcb_stack[20];
+    size_t tmp_fcb_stack_size = 0;
+    if (resolve_dir(cmd_args[1], tmp_fcb_stack, &tmp_fcb_stack_size)) {
+        printf("%s: No such directory\n", cmd_args[1]);
+        return;
+    }
+
+    // 按层读出目录树，node_fcbs 与目录树节点一一对应
+    host_tree tree;
+    tree_init(&tree);
+    fcb *node_fcbs = malloc(tree.cap * sizeof(fcb));
+    if (node_fcbs == NULL) {
+        perror("Export malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    node_fcbs[0] = tmp_fcb_stack[tmp_fcb_stack_size - 1];
+
+    size_t files = 0;
+    for (size_t i = 0; i < tree.size; i++) {
+        if (tree.nodes[i].is_file) continue;
+
+        fcb dir_fcb = node_fcbs[i];
+        size_t dir_size = dir_fcb.len / sizeof(fcb);
+        fcb *dir = malloc(dir_fcb.len + 1);
+        if (dir == NULL) {
+            perror("Export malloc error!");
+            exit(EXIT_FAILURE);
+        }
+        get_data_from_dist(dir, dir_fcb.first, dir_fcb.len);
+
+        size_t entries_size = 0;
+        for (size_t k = 0; k < dir_size; k = next_entry(dir, k, dir_size)) entries_size++;
+        int first = tree_add(&tree, (int) i, entries_size);
+        node_fcbs = realloc(node_fcbs, tree.cap * sizeof(fcb));
+        if (node_fcbs == NULL) {
+            perror("Export malloc error!");
+            exit(EXIT_FAILURE);
+        }
+        int c = first;
+        for (size_t k = 0; k < dir_size; k = next_entry(dir, k, dir_size), c++) {
+            tree_node *nd = &tree.nodes[c];
+            const fcb *f = &dir[k];
+            node_fcbs[c] = *f;
+            snprintf(nd->name, sizeof(nd->name), "%s%s", f->filename, f->ext);
+            nd->is_file = f->is_file;
+            nd->mtime = f->created_time;
+            if (!f->is_file) continue;
+
+            nd->len = f->len;
+            nd->data = malloc(f->len + 1);
+            if (nd->data == NULL) {
+                perror("Export malloc error!");
+                exit(EXIT_FAILURE);
+            }
+            if (IS_PACKED(f)) { // 内容在片段盘块中，片段引用不完整时按全零处理
+                if (k + 1 < dir_size) read_frag(&dir[k + 1], nd->data, f->len);
+                else memset(nd->data, 0, f->len);
+            } else if (IS_SPARSE(f)) { // 空洞填零，hole_map 不完整时按全是空洞处理
+                hole_map hm;
+                load_hole_map(f, k + 1 < dir_size ? &dir[k + 1] : NULL, &hm);
+                read_blocks(&hm, nd->data, f->len);
+            } else if (!IS_INLINE(f)) get_data_from_dist(nd->data, f->first, f->len);
+            else { // 内容在目录中，不完整的内联槽按全零处理
+                size_t avail = (next_entry(dir, k, dir_size) - k - 1) * INLINE_SLOT_DATA;
+                memset(nd->data, 0, f->len);
+                unpack_inline(&dir[k + 1], nd->data, MIN(f->len, avail));
+            }
+            files++;
+        }
+        free(dir);
+    }
+    free(node_fcbs);
+
+    // 多线程写入宿主机
+    size_t errors = tree_store(cmd_args[2], &tree);
+    if (errors) printf("%s: %zu errors\n", cmd_args[2], errors);
+    printf("%s: Exported %zu directories, %zu files\n", cmd_args[1], tree.size - 1 - files, files);
+    tree_free(&tree);
 }
 
 /**
- * 删除文件，路径不能包含 "." 和 ".."
+ * 开始事务："begin"，之后的命令只修改事务中的副本，commit 时一次写回，abort 时全部丢弃
  */
-static void my_rm() {
-    if (cmd_args_size != 2) { // 参数长度校验
+static void my_begin() {
+    if (cmd_args_size > 1) { // 参数长度校验
         printf("Unknown command: %s\n", cmd_arg);
         return;
     }
 
-    // 解析路径
-    char paths[16][16];
-    size_t paths_size = 0;
-    if (parse_path(cmd_args[1], paths, &paths_size)) {
+    if (txn_begin()) printf("Transaction already in progress\n");
+}
+
+/**
+ * 提交事务："commit"，事务中修改过的盘块各写回一次，FAT 和侧表随后一起持久化
+ */
+static void my_commit() {
+    if (cmd_args_size > 1) { // 参数长度校验
         printf("Unknown command: %s\n", cmd_arg);
         return;
     }
-    if (paths_size == 0) return; // 如果解析后的路径为空，直接返回
-
-    // 校验是否含有 "." 和 ".."
-    for (int i = 0; i < paths_size; ++i) {
-        if (!strcmp(paths[i], "..") || !strcmp(paths[i], ".")) {
-            printf("%s: Path can't contain \".\" or \"..\"\n", cmd_arg);
-            return;
-        }
-    }
-
-    fcb tmp_fcb_stack[32];
-    size_t tmp_fcb_stack_size = 0;
-    int i = 0;
-    if (!strcmp(paths[0], "/")) { // 绝对路径
-        i = 1;
-        tmp_fcb_stack[tmp_fcb_stack_size++] = fcb_stack[0];
-    } else { // 相对路径
-        i = 0;
-        memcpy(tmp_fcb_stack, fcb_stack, fcb_stack_size * sizeof(fcb));
-        tmp_fcb_stack_size = fcb_stack_size;
+    if (!txn.active) {
+        printf("No transaction in progress\n");
+        return;
     }
 
-    // 遍历 paths，将 cur_fcb 移动到目标文件
-    while (1) {
-        fcb tar_fcb;
-        fcb *prev_dir_fcb_ptr = tmp_fcb_stack_size == 1 ? NULL : &tmp_fcb_stack[tmp_fcb_stack_size - 2];
-        fcb *cur_dir_fcb_ptr = &tmp_fcb_stack[tmp_fcb_stack_size - 1];
-
-        // 最后一个路径段为文件名
-        if (i == paths_size - 1) {
-            // 如果不存在目标文件
-            if (get_fcb_from(cur_dir_fcb_ptr, paths[i], 1, &tar_fcb)) {
-                printf("%s: No such file\n", cmd_arg);
-                return;
-            }
-
-            rm_file(prev_dir_fcb_ptr, cur_dir_fcb_ptr, &tar_fcb);
-            break;
-        }
-
-        // 不存在目录，返回错误
-        if (get_fcb_from(cur_dir_fcb_ptr, paths[i], 0, &tar_fcb)) {
-            printf("%s: No such file\n", cmd_arg);
-            return;
-        }
+    printf("Committed %zu blocks\n", txn_commit());
+}
 
-        tmp_fcb_stack[tmp_fcb_stack_size++] = tar_fcb;
+/**
+ * 放弃事务："abort"，恢复事务开始时的 FAT 和当前目录
+ */
+static void my_abort() {
+    if (cmd_args_size > 1) { // 参数长度校验
+        printf("Unknown command: %s\n", cmd_arg);
+        return;
     }
 
-    // 维护 fcb_stack
-    for (int j = 0; j < fcb_stack_size && !strcmp(tmp_fcb_stack[j].filename, fcb_stack[j].filename); ++j) {
-        fcb_stack[j] = tmp_fcb_stack[j];
-    }
+    if (txn_abort()) printf("No transaction in progress\n");
+    else printf("Aborted\n");
+}
 
-    printf("%s: File removed\n", cmd_arg);
+/**
+ * 命令轨迹："trace record <宿主机文件>" 开始把之后在命令行执行的命令和耗时记录到文件中，
+ * "trace stop" 停止记录，退出时自动停止。记录的轨迹可以用 file_system_replay 重放
+ */
+static void my_trace() {
+    if (cmd_args_size == 3 && !strcmp(cmd_args[1], "record")) {
+        char path[256];
+        cur_path(path);
+        if (!trace_start(cmd_args[2], path)) printf("%s: Recording\n", cmd_args[2]);
+    } else if (cmd_args_size == 2 && !strcmp(cmd_args[1], "stop")) {
+        size_t count;
+        if (!trace_stop(&count)) printf("Recorded %zu commands\n", count);
+    } else printf("Unknown command: %s\n", cmd_arg);
 }
 
 /**
@@ -647,7 +2841,7 @@ static void my_rm() {
  * @param dest_size_ptr 数组长度接收缓冲区
  * @return 0：格式正确；1：格式错误
  */
-static int parse_path(const char src[16], char dest[16][16], size_t *dest_size_ptr) {
+static int parse_path(const char *src, char dest[16][16], size_t *dest_size_ptr) {
     char tmp_dest[16][16];
     size_t tmp_dest_size = 0;
 
@@ -669,51 +2863,537 @@ static int parse_path(const char src[16], char dest[16][16], size_t *dest_size_p
             j = 0;
             flag = 1;
         } else {
+            if (j == sizeof(tmp_dest[0]) - 1 || tmp_dest_size == sizeof(tmp_dest) / sizeof(tmp_dest[0]))
+                return 1; // 路径段过长或过多
             tmp_dest[tmp_dest_size][j++] = src[i];
             flag = 0;
         }
 
-        i++;
+        i++;
+    }
+
+//    // 优化，缩短路径长度，如 "./a/b/../.././.." --> ".."
+//    for (int k = 0; k < tmp_dest_size; ++k) {
+//        // 如果是 "." 直接跳过
+//        if (!strcmp(tmp_dest[k], ".")) continue;
+//
+//        // 如果不是 ".." 直接加入
+//        // 如果是 ".." 并且当前路径段长度为 0 或上一个也是 ".." 或上一个是根路径 "/"，直接加入
+//        // 否则回退一个路径段
+//        if (strcmp(tmp_dest[k], "..") != 0) strcpy(dest[(*dest_size_ptr)++], tmp_dest[k]);
+//        else if (*dest_size_ptr == 0 || !strcmp(dest[(*dest_size_ptr) - 1], "..") ||
+//                 !strcmp(dest[(*dest_size_ptr) - 1], "/"))
+//            strcpy(dest[(*dest_size_ptr)++], "..");
+//        else (*dest_size_ptr)--;
+//    }
+
+    memcpy(dest, tmp_dest, sizeof(tmp_dest));
+    *dest_size_ptr = tmp_dest_size;
+
+    return 0;
+}
+
+/**
+ * 按路径找到目录，得到从根目录到该目录的 FCB 栈，空路径表示当前目录
+ * @param path 路径，可以包含 "." 和 ".."
+ * @param stack FCB 栈接收缓冲区，容量与 fcb_stack 相同
+ * @param stack_size_ptr 栈大小接收缓冲区
+ * @return 0：找到；1：路径格式错误或目录不存在
+ */
+static int resolve_dir(const char *path, fcb stack[20], size_t *stack_size_ptr) {
+    // 用户输入的路径，"a/b/c" --> ["a", "b", "c"]
+    char paths[16][16];
+    size_t paths_size = 0;
+    if (parse_path(path, paths, &paths_size)) return 1;
+
+    size_t stack_size = 0;
+    size_t i = 0;
+    if (paths_size > 0 && !strcmp(paths[0], "/")) { // 绝对路径，以 "/" 起始的路径
+        i = 1;
+
+        // 根目录 FCB 入栈
+        stack[stack_size++] = fcb_stack[0];
+    } else { // 相对路径
+        // 将当前 FCB 栈信息拷贝一份
+        memcpy(stack, fcb_stack, fcb_stack_size * sizeof(fcb));
+        stack_size = fcb_stack_size;
+    }
+
+    // 遍历每一段路径
+    for (; i < paths_size; ++i) {
+        // 遇到 "." 则可以直接跳过
+        if (!strcmp(paths[i], ".")) continue;
+
+        if (!strcmp(paths[i], "..")) { // 返回上一级目录
+            if (stack_size == 1) return 1; // 当前在根目录，没有上一级目录了
+            stack_size--; // 出栈
+            continue;
+        }
+
+        // 进入下一级目录，找到目标目录后将 FCB 入栈
+        if (stack_size == sizeof(fcb_stack) / sizeof(fcb)) return 1;
+        if (get_fcb_from(&stack[stack_size - 1], paths[i], 0, &stack[stack_size])) return 1;
+        stack_size++;
+    }
+
+    *stack_size_ptr = stack_size;
+    return 0;
+}
+
+/**
+ * 判断名称能否放进目录项，扩展名（包括 '.'）最长 sizeof(ext) - 1 字节
+ * @param name 路径段
+ * @return 1：能；0：扩展名过长
+ */
+static int name_fits(const char *name) {
+    const char *dot = strchr(name, '.');
+    return dot == NULL || strlen(dot) < sizeof(((fcb *) NULL)->ext);
+}
+
+/**
+ * 从虚拟磁盘中读取数据，压缩过的盘块会先解压
+ * @param dest 接收缓冲区
+ * @param first_block 第一个磁盘块
+ * @param n 要读取的字节数
+ */
+static void get_data_from_dist(void *dest, unsigned short first_block, size_t n) {
+    size_t dest_offset = 0;
+    size_t prefetched = 0; // 已预读到的数据位置
+    unsigned short cur_block = first_block;
+
+    while (n - dest_offset > 0) {
+        size_t to_read = MIN(BLOCK_SIZE, n - dest_offset);
+        // 块缓存模式下沿 FAT 链每次预读之后 CACHE_PREFETCH_MAX 个要读的盘块
+        if (sys_opt.cache_size && n > BLOCK_SIZE && dest_offset == prefetched) {
+            unsigned short blocks[CACHE_PREFETCH_MAX];
+            size_t blocks_size = 0;
+            for (unsigned short b = cur_block; b < BLOCK_ASSET && blocks_size < CACHE_PREFETCH_MAX &&
+                                               prefetched < n; b = fat[b], prefetched += BLOCK_SIZE)
+                blocks[blocks_size++] = b;
+            cache_prefetch(blocks, blocks_size);
+        }
+        if (cur_block >= BLOCK_ASSET) { // 链比长度短，目录项损坏
+            printf("Block chain too short\n");
+            memset(dest + dest_offset, 0, n - dest_offset);
+            return;
+        }
+        char buf[BLOCK_SIZE];
+        memcpy(dest + dest_offset, view_block(cur_block, buf), to_read);
+
+        dest_offset += to_read;
+        cur_block = fat[cur_block];
+    }
+}
+
+/**
+ * 从数据的 off 处读取 n 字节，只访问这段数据所在的盘块
+ * @param tar_fcb_ptr 目标 FCB
+ * @param off 读取位置
+ * @param dest 接收缓冲区
+ * @param n 字节数，off + n 不超过 len
+ */
+static void read_data(const fcb *tar_fcb_ptr, size_t off, void *dest, size_t n) {
+    unsigned short cur_block = tar_fcb_ptr->first;
+    for (size_t i = 0; i < off / BLOCK_SIZE && cur_block < BLOCK_ASSET; i++) cur_block = fat[cur_block];
+
+    for (size_t done = 0; done < n; cur_block = fat[cur_block]) {
+        if (cur_block >= BLOCK_ASSET) { // 链比长度短，目录项损坏
+            printf("Block chain too short\n");
+            memset((char *) dest + done, 0, n - done);
+            return;
+        }
+        char buf[BLOCK_SIZE];
+        size_t block_offset = (off + done) % BLOCK_SIZE;
+        size_t to_read = MIN(BLOCK_SIZE - block_offset, n - done);
+        memcpy((char *) dest + done, view_block(cur_block, buf) + block_offset, to_read);
+        done += to_read;
+    }
+}
+
+/**
+ * 目录中下一个目录项的下标，跳过内联文件的内联槽，目录末尾的内联槽不完整时到目录末尾为止
+ * @param dir 目录
+ * @param k 当前目录项的下标
+ * @param dir_size 目录项数量（包括内联槽）
+ */
+static size_t next_entry(const fcb dir[], size_t k, size_t dir_size) {
+    return k + MIN(ENTRY_SLOTS(&dir[k]), dir_size - k);
+}
+
+/**
+ * 把内联文件的内容写入内联槽
+ * @param slots INLINE_SLOTS(n) 个内联槽
+ * @param data 文件内容
+ * @param n 字节数，不超过 INLINE_MAX
+ */
+static void pack_inline(fcb slots[], const char *data, size_t n) {
+    for (size_t k = 0; k < INLINE_SLOTS(n); k++) {
+        char *slot = (char *) &slots[k];
+        size_t off = k * INLINE_SLOT_DATA;
+        memset(slot, 0, sizeof(fcb));
+        memcpy(slot + 1, data + off, MIN(INLINE_SLOT_DATA, n - off));
+    }
+}
+
+/**
+ * 从内联槽中取出内联文件的内容
+ * @param slots INLINE_SLOTS(n) 个内联槽
+ * @param data 接收缓冲区
+ * @param n 字节数，不超过 INLINE_MAX
+ */
+static void unpack_inline(const fcb slots[], char *data, size_t n) {
+    for (size_t off = 0; off < n; off += INLINE_SLOT_DATA)
+        memcpy(data + off, (const char *) &slots[off / INLINE_SLOT_DATA] + 1, MIN(INLINE_SLOT_DATA, n - off));
+}
+
+/**
+ * n 个片段单元在位图中的掩码（从第 0 位开始）
+ */
+static uint32_t frag_mask(size_t n) {
+    return (uint32_t) (((uint64_t) 1 << n) - 1);
+}
+
+/**
+ * 在片段盘块中找能放下 n 个连续单元的位置（首次适应），找到后在位图中标记为已用
+ * @param map 片段位图，只在位图不为 0 的盘块中查找
+ * @param n 单元数
+ * @param unit_ptr 起始单元号接收缓冲区
+ * @return 盘块号；BLOCK_ASSET：放不下
+ */
+static size_t fit_frag(uint32_t map[], size_t n, uint8_t *unit_ptr) {
+    uint32_t mask = frag_mask(n);
+    for (size_t b = DATA_START; b < BLOCK_ASSET; b++) {
+        // 不是片段盘块，或空闲单元总数都不够时不用逐位找
+        if (!map[b] || FRAG_BLOCK_UNITS - (size_t) __builtin_popcount(map[b]) < n) continue;
+        for (size_t u = 0; u + n <= FRAG_BLOCK_UNITS; u++) {
+            if (map[b] & (mask << u)) continue;
+            map[b] |= mask << u;
+            *unit_ptr = u;
+            return b;
+        }
+    }
+    return BLOCK_ASSET;
+}
+
+/**
+ * 按顺序分配一组片段需要的新片段盘块数：在位图副本上模拟 alloc_frag，与之后按同样顺序实际分配的结果相同
+ * @param units 每个片段的单元数
+ * @param n 片段数量
+ */
+static size_t frag_need(const unsigned char units[], size_t n) {
+    if (n == 0) return 0;
+
+    uint32_t *map = malloc(sizeof(frags));
+    if (map == NULL) {
+        perror("Fragment malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(map, frags, sizeof(frags));
+
+    size_t added = 0;
+    size_t next = DATA_START; // 模拟 next_free_block，新片段盘块的位图不为 0
+    for (size_t k = 0; k < n; k++) {
+        uint8_t unit;
+        if (fit_frag(map, units[k], &unit) < BLOCK_ASSET) continue;
+        while (next < BLOCK_ASSET && (fat[next] != FREE || map[next])) next++;
+        if (next < BLOCK_ASSET) map[next] = frag_mask(units[k]);
+        added++;
+    }
+    free(map);
+    return added;
+}
+
+/**
+ * 分配 n 个连续的片段单元，已有的片段盘块都放不下时取一个空闲盘块作为新的片段盘块。调用前需确认空闲盘块足够
+ * @param n 单元数
+ * @param ref 片段引用接收缓冲区
+ */
+static void alloc_frag(size_t n, frag_ref *ref) {
+    memset(ref, 0, sizeof(frag_ref));
+    size_t b = fit_frag(frags, n, &ref->unit);
+    if (b == BLOCK_ASSET) {
+        b = next_free_block();
+        fat[b] = END;
+        zlen[b] = 0; // 片段盘块不压缩，片段直接在盘块中读写
+        memset(block_ptr(b, 1), 0, BLOCK_SIZE);
+        frags[b] = frag_mask(n);
+    }
+    ref->block = b;
+}
+
+/**
+ * 取出片段引用，引用损坏（盘块不是片段盘块或越过盘块末尾）时返回 1
+ * @param slot 片段引用所在的槽
+ * @param n 片段字节数
+ */
+static int load_frag_ref(const fcb *slot, size_t n, frag_ref *ref) {
+    memcpy(ref, slot, sizeof(frag_ref));
+    return ref->block < DATA_START || ref->block >= BLOCK_ASSET || !frags[ref->block] ||
+           (size_t) ref->unit * FRAG_UNIT + n > BLOCK_SIZE;
+}
+
+/**
+ * 释放片段占用的单元，片段盘块的单元全部空闲时释放盘块
+ * @param slot 片段引用所在的槽
+ * @param n 片段字节数
+ */
+static void free_frag(const fcb *slot, size_t n) {
+    frag_ref ref;
+    if (load_frag_ref(slot, n, &ref)) return;
+
+    frags[ref.block] &= ~(frag_mask(FRAG_UNITS(n)) << ref.unit);
+    if (!frags[ref.block]) fat[ref.block] = FREE;
+}
+
+/**
+ * 读出片段内容
+ * @param slot 片段引用所在的槽
+ * @param data 接收缓冲区
+ * @param n 字节数
+ */
+static void read_frag(const fcb *slot, char *data, size_t n) {
+    frag_ref ref;
+    if (load_frag_ref(slot, n, &ref)) { // 目录项损坏
+        printf("Bad fragment reference\n");
+        memset(data, 0, n);
+        return;
+    }
+    char buf[BLOCK_SIZE];
+    memcpy(data, view_block(ref.block, buf) + (size_t) ref.unit * FRAG_UNIT, n);
+}
+
+/**
+ * 把内容写入已分配的片段
+ * @param ref 片段引用
+ * @param data 字节数据
+ * @param n 字节数
+ */
+static void write_frag(const frag_ref *ref, const char *data, size_t n) {
+    memcpy(block_ptr(ref->block, 1) + (size_t) ref->unit * FRAG_UNIT, data, n);
+}
+
+/**
+ * 把片段内容复制到另一个已分配的片段，槽中的引用改为新片段
+ * @param slot 源片段引用所在的槽
+ * @param n 字节数
+ * @param ref 新片段
+ */
+static void copy_frag(fcb *slot, size_t n, const frag_ref *ref) {
+    char data[FRAG_MAX];
+    read_frag(slot, data, n);
+    write_frag(ref, data, n);
+    memcpy(slot, ref, sizeof(frag_ref));
+}
+
+/**
+ * 前 n 个逻辑盘块的位掩码
+ */
+static uint64_t hole_bits(size_t n) {
+    return n >= HOLE_MAP_BITS ? ~(uint64_t) 0 : ((uint64_t) 1 << n) - 1;
+}
+
+/**
+ * 取出文件的盘块分布：稀疏文件从 hole_map 中读出，普通文件的盘块全部已分配，内联文件和打包文件没有盘块
+ * @param f 文件 FCB
+ * @param slot 紧跟目录项的槽，只有稀疏文件会读取；为 NULL 时（目录项不完整）按全是空洞处理
+ * @param hm 接收缓冲区
+ */
+static void load_hole_map(const fcb *f, const fcb *slot, hole_map *hm) {
+    memset(hm, 0, sizeof(hole_map));
+    if (IS_SPARSE(f)) {
+        if (slot != NULL) memcpy(hm, slot, sizeof(hole_map));
+    } else if (f->first != FREE) {
+        hm->first = f->first;
+        hm->map = hole_bits(blocks_for(f->len));
+    }
+}
+
+/**
+ * 链的前 n 个盘块中写时复制要复制的盘块数，从第一个共享的盘块开始都要复制
+ * @param first 第一个盘块号
+ * @param n 盘块数
+ */
+static size_t shared_blocks(unsigned short first, size_t n) {
+    size_t cnt = 0;
+    int shared = 0;
+    for (unsigned short b = first; n > 0 && b >= DATA_START && b < BLOCK_ASSET; b = fat[b], n--) {
+        shared |= refs[b] != 0;
+        cnt += shared;
+    }
+    return cnt;
+}
+
+/**
+ * 给空洞分配盘块：want 中还是空洞的逻辑盘块一次分配、尽量连续，标记为未写入（读出全零），按逻辑顺序插入链中。
+ * 最后一个插入位置之前的盘块先写时复制，之后的部分（可能被共享）不变。调用前需确认空闲盘块足够
+ * @param hm 文件的盘块分布，first 和 map 会改变
+ * @param want 要分配的逻辑盘块的位掩码，已分配的位不变
+ */
+static void fill_holes(hole_map *hm, uint64_t want) {
+    size_t hi = want ? HOLE_MAP_BITS - __builtin_clzll(want) : 0; // 最后一个要分配的逻辑盘块之后
+    fcb chain = {.first = hm->first};
+    size_t prefix = __builtin_popcountll(hm->map & hole_bits(hi)); // 链中要重新串起的盘块数
+    if (prefix) unshare_data(&chain, prefix * BLOCK_SIZE, prefix * BLOCK_SIZE);
+    hm->first = chain.first;
+
+    uint64_t holes = want & ~hm->map;
+    if (!holes) return;
+
+    // 插入位置之前的已分配盘块，goal 为第一个空洞之前的盘块之后，新盘块尽量接在它后面
+    unsigned short blk[HOLE_MAP_BITS];
+    unsigned short b = hm->first;
+    unsigned short goal = DATA_START;
+    for (size_t i = 0; i < hi; i++) {
+        blk[i] = FREE;
+        if (!(hm->map >> i & 1)) continue;
+        blk[i] = b;
+        if (i < (size_t) __builtin_ctzll(holes)) goal = b + 1;
+        b = fat[b];
+    }
+    unsigned short rest = hm->map & ~hole_bits(hi) ? b : END; // 不变的后半段
+
+    unsigned short nb = alloc_extent(__builtin_popcountll(holes), goal);
+    for (size_t i = 0; i < hi; i++) {
+        if (!(holes >> i & 1)) continue;
+        blk[i] = nb;
+        zlen[nb] = ZLEN_UNWRITTEN;
+        nb = fat[nb];
+    }
+
+    unsigned short *link = &hm->first; // 当前盘块的引用，hole_map 的 first 或上一个盘块的 FAT 项
+    for (size_t i = 0; i < hi; i++) {
+        if (blk[i] == FREE) continue;
+        *link = blk[i];
+        link = &fat[blk[i]];
+    }
+    *link = rest;
+    hm->map |= holes;
+}
+
+/**
+ * 按盘块分布读出文件内容，空洞直接填零，不访问数据文件
+ * @param hm 文件的盘块分布
+ * @param data 接收缓冲区
+ * @param n 字节数
+ */
+static void read_blocks(const hole_map *hm, char *data, size_t n) {
+    unsigned short b = hm->first;
+    for (size_t i = 0, off = 0; off < n; i++, off += BLOCK_SIZE) {
+        size_t to_read = MIN(BLOCK_SIZE, n - off);
+        if (!(hm->map >> i & 1)) {
+            memset(data + off, 0, to_read);
+            continue;
+        }
+        if (b < DATA_START || b >= BLOCK_ASSET) { // 链比位图短，目录项损坏
+            printf("Block chain too short\n");
+            memset(data + off, 0, n - off);
+            return;
+        }
+        char buf[BLOCK_SIZE];
+        memcpy(data + off, view_block(b, buf), to_read);
+        b = fat[b];
+    }
+}
+
+/**
+ * 获取盘块数据的只读视图，未压缩的盘块直接引用虚拟磁盘（块缓存模式下为缓存帧），不复制；压缩块解压到 buf，
+ * 预分配未写入的盘块在 buf 中填零
+ * @param block 盘块号
+ * @param buf 解压缓冲区，BLOCK_SIZE 字节
+ * @return 盘块数据地址，块缓存模式下只在下一次访问盘块之前有效
+ */
+static const char *view_block(unsigned short block, char *buf) {
+    if (zlen[block] == ZLEN_UNWRITTEN) return memset(buf, 0, BLOCK_SIZE); // 预分配未写入的盘块不访问数据文件
+    if (!zlen[block]) return block_ptr(block, 0);
+
+    if (lz_decompress(block_ptr(block, 0), zlen[block], buf, BLOCK_SIZE) == 0) {
+        printf("Block %d: Decompress error\n", block);
+        memset(buf, 0, BLOCK_SIZE);
     }
+    return buf;
+}
 
-//    // 优化，缩短路径长度，如 "./a/b/../.././.." --> ".."
-//    for (int k = 0; k < tmp_dest_size; ++k) {
-//        // 如果是 "." 直接跳过
-//        if (!strcmp(tmp_dest[k], ".")) continue;
-//
-//        // 如果不是 ".." 直接加入
-//        // 如果是 ".." 并且当前路径段长度为 0 或上一个也是 ".." 或上一个是根路径 "/"，直接加入
-//        // 否则回退一个路径段
-//        if (strcmp(tmp_dest[k], "..") != 0) strcpy(dest[(*dest_size_ptr)++], tmp_dest[k]);
-//        else if (*dest_size_ptr == 0 || !strcmp(dest[(*dest_size_ptr) - 1], "..") ||
-//                 !strcmp(dest[(*dest_size_ptr) - 1], "/"))
-//            strcpy(dest[(*dest_size_ptr)++], "..");
-//        else (*dest_size_ptr)--;
-//    }
+/**
+ * 按盘块遍历目录项，完整位于盘块内的目录项直接引用盘块数据，只有跨越盘块边界的目录项复制到临时缓冲区。
+ * visit 中不能访问其他盘块
+ * @param dir_fcb_ptr 目录 FCB
+ * @param visit 每次传入一段连续的目录项及第一项的下标
+ * @return 1：被 visit 停止；0：遍历完
+ */
+static int scan_dir(const fcb *dir_fcb_ptr, entry_visit_fn visit, void *arg) {
+    _Alignas(fcb) char buf[BLOCK_SIZE];
+    fcb tmp;             // 跨盘块的目录项
+    size_t tmp_size = 0; // 跨盘块的目录项已复制的字节数
+    unsigned short cur_block = dir_fcb_ptr->first;
+
+    for (size_t pos = 0; pos < dir_fcb_ptr->len; pos += BLOCK_SIZE, cur_block = fat[cur_block]) {
+        if (cur_block >= BLOCK_ASSET) { // 链比长度短，目录项损坏
+            printf("Block chain too short\n");
+            return 0;
+        }
 
-    memcpy(dest, tmp_dest, sizeof(tmp_dest));
-    *dest_size_ptr = tmp_dest_size;
+        const char *data = view_block(cur_block, buf);
+        size_t avail = MIN(BLOCK_SIZE, dir_fcb_ptr->len - pos);
+        size_t off = 0;
+
+        if (tmp_size) { // 补全上一个盘块末尾的目录项
+            off = sizeof(fcb) - tmp_size;
+            memcpy((char *) &tmp + tmp_size, data, off);
+            tmp_size = 0;
+            if (visit(&tmp, 1, pos / sizeof(fcb), arg)) return 1;
+        }
+
+        size_t cnt = (avail - off) / sizeof(fcb);
+        if (cnt && visit((const fcb *) (data + off), cnt, (pos + off) / sizeof(fcb), arg)) return 1;
 
+        off += cnt * sizeof(fcb);
+        if (off < avail) {
+            tmp_size = avail - off;
+            memcpy(&tmp, data + off, tmp_size);
+        }
+    }
     return 0;
 }
 
+typedef struct find_arg {
+    const char *name; // 要查找的名称
+    int is_file;      // 文件、目录或 SCAN_ANY_TYPE
+    size_t pos;       // 找到的目录项下标
+    fcb *fcb_ptr;     // 找到的目录项接收缓冲区，可以为 NULL
+} find_arg;
+
+static int find_visit(const fcb entries[], size_t n, size_t base, void *arg) {
+    find_arg *find = arg;
+    size_t i = dir_find(entries, n, find->name, find->is_file);
+    if (i == n) return 0;
+
+    find->pos = base + i;
+    if (find->fcb_ptr != NULL) *find->fcb_ptr = entries[i];
+    return 1;
+}
+
 /**
- * 从虚拟磁盘中读取数据
- * @param dest 接收缓冲区
- * @param first_block 第一个磁盘块
- * @param n 要读取的字节数
+ * 在目录中按名称查找目录项，直接在盘块数据上查找，不复制目录
+ * @param dir_fcb_ptr 目录 FCB
+ * @param name 名称（不包括扩展名）
+ * @param is_file 0：目录；1：文件；SCAN_ANY_TYPE：不区分
+ * @param fcb_ptr 找到的目录项接收缓冲区，可以为 NULL
+ * @return 目录项下标；目录项数量：不存在
  */
-static void get_data_from_dist(void *dest, unsigned short first_block, size_t n) {
-    size_t dest_offset = 0;
-    unsigned short cur_block = first_block;
-
-    while (n - dest_offset > 0) {
-        size_t to_read = MIN(BLOCK_SIZE, n - dest_offset);
-        memcpy(dest + dest_offset, dist + cur_block * BLOCK_SIZE, to_read);
+static size_t find_entry(const fcb *dir_fcb_ptr, const char *name, int is_file, fcb *fcb_ptr) {
+    find_arg find = {name, is_file, dir_fcb_ptr->len / sizeof(fcb), fcb_ptr};
+    scan_dir(dir_fcb_ptr, find_visit, &find);
+    return find.pos;
+}
 
-        dest_offset += to_read;
-        cur_block = fat[cur_block];
-    }
+/**
+ * 用新的 FCB 覆盖目录中同名同类型的目录项，只写入这一个目录项
+ * @param dir_fcb_ptr 目录 FCB
+ * @param fcb_ptr 新的 FCB
+ */
+static void update_entry(fcb *dir_fcb_ptr, const fcb *fcb_ptr) {
+    size_t pos = find_entry(dir_fcb_ptr, fcb_ptr->filename, fcb_ptr->is_file, NULL);
+    if (pos < dir_fcb_ptr->len / sizeof(fcb)) write_data(dir_fcb_ptr, pos * sizeof(fcb), fcb_ptr, sizeof(fcb));
 }
 
 /**
@@ -725,19 +3405,7 @@ static void get_data_from_dist(void *dest, unsigned short first_block, size_t n)
  * @return 返回0：目标存在；返回1：不存在
  */
 static int get_fcb_from(fcb *dir_fcb_ptr, char filename[16], unsigned char is_file, fcb *fcb_ptr) {
-    fcb dir[36];
-    size_t dir_len = 0;
-    get_dir(dir_fcb_ptr, dir, &dir_len);
-
-    int res = 1; // 存在标志位
-    for (int i = 0; i < dir_len; i++) {
-        if (dir[i].is_file == is_file && !strcmp(dir[i].filename, filename)) {
-            *fcb_ptr = dir[i];
-            res = 0;
-            break;
-        }
-    }
-    return res;
+    return find_entry(dir_fcb_ptr, filename, is_file, fcb_ptr) == dir_fcb_ptr->len / sizeof(fcb);
 }
 
 /**
@@ -752,218 +3420,727 @@ static unsigned short next_free_block(void) {
 }
 
 /**
- * 在指定目录下创建空目录或空文件
- * @param prev_dir_fcb_ptr 目标目录的上一级目录 FCB，如果为 NULL 表示目标目录是根目录
- * @param cur_dir_fcb_ptr 目标目录的 FCB
- * @param name 要创建目录或文件（包括扩展名）的名称
- * @param fcb_ptr 新 FCB 的接收缓冲区
- * @param is_file 创建目录还是创建文件
- * @return 0：成功创建；1：当前目录下有重名
+ * 将数据重新写回目标 FCB 的虚拟磁盘（不会更新上一级目录）
+ * @param tar_fcb_ptr 目标 FCB
+ * @param data 字节数据
+ * @param n 字节数
  */
-static int create_fcb(fcb *prev_dir_fcb_ptr, fcb *cur_dir_fcb_ptr, char *name, fcb *fcb_ptr, unsigned char is_file) {
-    // 截取不包含扩展名的名称
-    char filename[16];
-    size_t filename_size = 0;
-    for (int i = 0;; i++) {
-        if (name[i] == '\0' || name[i] == '.') {
-            filename[filename_size] = '\0';
-            break;
-        }
-        filename[filename_size++] = name[i];
+static void rewrite_data(fcb *tar_fcb_ptr, char data[], size_t n) {
+    unshare_data(tar_fcb_ptr, 0, n);
+    extend_chain(tar_fcb_ptr, blocks_for(n)); // 知道最终大小后一次分配，不再逐块分配
+
+    size_t data_offset = 0;
+    unsigned short cur_block = tar_fcb_ptr->first;
+    while (1) {
+        size_t to_write = MIN(n - data_offset, BLOCK_SIZE);
+        write_block(cur_block, data + data_offset, to_write);
+
+        data_offset += to_write;
+        if (data_offset == n) break;
+        cur_block = fat[cur_block];
     }
 
-    // 判断是否有重名
-    fcb cur_dir[36];
-    size_t cur_dir_size = 0;
-    get_dir(cur_dir_fcb_ptr, cur_dir, &cur_dir_size);
-    for (int i = 0; i < cur_dir_size; ++i) {
-        if (!strcmp(cur_dir[i].filename, filename)) { // 重名了
-            return 1;
+    // 数据可能变少了，需要释放磁盘块
+    if (fat[cur_block] != END) {
+        unsigned short clean_first = fat[cur_block];
+        fat[cur_block] = END;
+        release_chain(clean_first);
+    }
+
+    // 维护 FCB 的 len 字段
+    tar_fcb_ptr->len = n;
+}
+
+/**
+ * 数据占用的盘块数，空数据也占一个盘块
+ */
+static size_t blocks_for(size_t n) {
+    return n ? (n + BLOCK_SIZE - 1) / BLOCK_SIZE : 1;
+}
+
+/**
+ * 释放一条链：沿链减少引用，没有其他引用的盘块设为 FREE；遇到仍被共享的盘块时停止，之后的盘块属于共享的链
+ * @param first 第一个盘块号
+ */
+static void release_chain(unsigned short first) {
+    if (first == FREE) return; // 内联文件没有盘块
+
+    for (unsigned short b = first; b < BLOCK_ASSET;) {
+        if (refs[b]) {
+            refs[b]--;
+            return;
         }
+        unsigned short next = fat[b];
+        fat[b] = FREE;
+        b = next;
     }
+}
 
-    // 创建 FCB
-    fcb new_dir;
-    strcpy(new_dir.filename, filename);
-    strcpy(new_dir.ext, name + filename_size);
-    new_dir.is_file = is_file;
-    time(&(new_dir.created_time));
-    new_dir.len = 0;
-    fat[new_dir.first = next_free_block()] = END;
-    // 插入到当前目录中
-    cur_dir[cur_dir_size++] = new_dir;
-
-    // 将当前目录重新写回虚拟磁盘
-    char buf[1024];
-    memcpy(buf, cur_dir, cur_dir_size * sizeof(fcb));
-    size_t buf_size = cur_dir_size * sizeof(fcb);
-    rewrite_data(cur_dir_fcb_ptr, buf, buf_size);
-
-    // 将上一级目录重新写回虚拟磁盘
-    if (prev_dir_fcb_ptr == NULL) // 当前目录是根目录，要特殊维护
-        // 维护根目录的 FCB 到虚拟磁盘中
-        memcpy(dist + ROOT_FCB_OFFSET, cur_dir_fcb_ptr, sizeof(fcb));
-    else {
-        fcb prev_dir[36];
-        size_t prev_dir_size = 0;
-        get_dir(prev_dir_fcb_ptr, prev_dir, &prev_dir_size);
-        for (int i = 0; i < prev_dir_size; ++i) {
-            if (prev_dir[i].is_file == cur_dir_fcb_ptr->is_file &&
-                !strcmp(prev_dir[i].filename, cur_dir_fcb_ptr->filename)) {
-                prev_dir[i] = *cur_dir_fcb_ptr;
-                break;
+/**
+ * 写时复制：保证数据前 n 字节所在的盘块（n 超过链的容量时为整条链）只属于这条链，之后可以原地修改。
+ * FAT 中一个盘块只有一个后继，只能共享链尾，所以从第一个共享的盘块到修改位置之间的盘块都要复制，
+ * 在共享的长文件末尾附近修改时代价与文件长度成正比（stat 的 copied 统计复制的盘块数）。
+ * 复制的最后一个盘块之后的部分仍然共享；随后会被整个覆盖的盘块只分配不复制内容。调用前需确认空闲盘块足够
+ * @param tar_fcb_ptr 目标 FCB，链首盘块被复制时 first 会改变，由调用者写回
+ * @param keep 内容需要保留的范围，[keep, n) 中整个盘块由调用者覆盖
+ * @param n 要修改的范围（从数据开头算起的字节数）
+ */
+static void unshare_data(fcb *tar_fcb_ptr, size_t keep, size_t n) {
+    unsigned short *link = &tar_fcb_ptr->first; // 当前盘块的引用，FCB 的 first 或上一个盘块的 FAT 项
+    for (size_t k = 0; k < blocks_for(n) && *link >= DATA_START && *link < BLOCK_ASSET; k++, link = &fat[*link]) {
+        unsigned short b = *link;
+        if (!refs[b]) continue;
+
+        // 新盘块接管这条链对 b 的引用，同时多了一个对 b 的后继的引用，所以后面的盘块也会被复制
+        unsigned short copy = next_free_block();
+        size_t pos = k * BLOCK_SIZE;
+        if (pos >= keep && pos + BLOCK_SIZE <= n) zlen[copy] = ZLEN_UNWRITTEN; // 将被覆盖，当作预分配的盘块
+        else {
+            if (zlen[b] != ZLEN_UNWRITTEN) { // 预分配未写入的盘块只复制标记
+                char buf[BLOCK_SIZE];
+                memcpy(buf, block_ptr(b, 0), BLOCK_SIZE); // 块缓存模式下访问新盘块可能淘汰 b 所在的缓存帧
+                memcpy(block_ptr(copy, 1), buf, BLOCK_SIZE);
+                dd_stat.copied++;
             }
+            zlen[copy] = zlen[b];
         }
+        fat[copy] = fat[b];
+        if (fat[b] != END) refs[fat[b]]++;
+        refs[b]--;
+        *link = copy;
+    }
+}
 
-        // 将上一级目录重新写回虚拟磁盘
-        memcpy(buf, prev_dir, prev_dir_size * sizeof(fcb));
-        buf_size = prev_dir_size * sizeof(fcb);
-        rewrite_data(prev_dir_fcb_ptr, buf, buf_size);
+/**
+ * 当前单调时钟（秒）
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * 读出整个盘块的内容，压缩块解压后补零，预分配未写入的盘块为全零
+ * @param buf 接收缓冲区，BLOCK_SIZE 字节
+ */
+static void load_block(unsigned short block, char *buf) {
+    if (zlen[block] == ZLEN_UNWRITTEN) {
+        memset(buf, 0, BLOCK_SIZE);
+        return;
+    }
+    if (!zlen[block]) {
+        memcpy(buf, block_ptr(block, 0), BLOCK_SIZE);
+        return;
     }
 
-    // 将新 FCB 赋值到接收缓冲区
-    *fcb_ptr = new_dir;
+    size_t n = lz_decompress(block_ptr(block, 0), zlen[block], buf, BLOCK_SIZE);
+    memset(buf + n, 0, BLOCK_SIZE - n);
+}
+
+typedef struct dedup_arg {
+    const char *data;    // 要合并的内容，BLOCK_SIZE 字节
+    unsigned short succ; // 要求的后继
+} dedup_arg;
 
-    return 0;
+/**
+ * 核对候选盘块：仍然是数据盘块、后继没有变、内容完全相同
+ */
+static int dedup_same(unsigned short block, void *arg) {
+    const dedup_arg *want = arg;
+    if (block < DATA_START || fat[block] != want->succ) return 0;
+
+    char buf[BLOCK_SIZE];
+    load_block(block, buf);
+    return !memcmp(buf, want->data, BLOCK_SIZE);
+}
+
+/**
+ * 查找内容和后继都相同的已有盘块，整个盘块参与比较
+ * @param data 盘块内容，BLOCK_SIZE 字节
+ * @param fp_ptr 内容指纹接收缓冲区
+ * @return 盘块号；END：没有
+ */
+static unsigned short dedup_lookup(const char *data, unsigned short succ, unsigned int *fp_ptr) {
+    dedup_arg want = {data, succ};
+    *fp_ptr = crc32c(0, data, BLOCK_SIZE);
+    dd_stat.hashed++;
+    return dedup_find(*fp_ptr, succ, dedup_same, &want);
 }
 
 /**
- * 在指定目录中删除目录或文件
- * @param dir_ptr 指定目录
- * @param fcb_ptr 目标 FCB，可能是目录，可能是文件
+ * 在线去重写入一条新的文件数据链：从链尾开始查找内容和后继都相同的已有盘块，
+ * 能合并的最长后缀只增加引用数，剩下的前缀连续分配并写入，调用前需确认空闲盘块足够。
+ * 最后一个盘块补零写满，保证盘块内容与文件长度无关，可以被其他文件合并
+ * @param tar_fcb_ptr 目标 FCB，写入 first
+ * @param data 字节数据
+ * @param n 字节数
+ * @param cursor_ptr 分配游标
+ * @return 分配的盘块数
  */
-static void rmfcb_in(fcb *dir_ptr, fcb *fcb_ptr) {
-    // 获取指定目录
-    fcb dir[20];
-    size_t dir_size = 0;
-    get_dir(dir_ptr, dir, &dir_size);
+static size_t write_dedup(fcb *tar_fcb_ptr, const char *data, size_t n, unsigned short *cursor_ptr) {
+    double start = now();
+    size_t cnt = blocks_for(n);
+    unsigned int fps[cnt];
+    char last[BLOCK_SIZE];
+    memset(last, 0, BLOCK_SIZE);
+    memcpy(last, data + (cnt - 1) * BLOCK_SIZE, n - (cnt - 1) * BLOCK_SIZE);
+
+    // 合并最长的后缀，suffix 是已合并部分的第一个盘块
+    unsigned short suffix = END;
+    size_t k = cnt;
+    while (k > 0) {
+        const char *chunk = k == cnt ? last : data + (k - 1) * BLOCK_SIZE;
+        unsigned short b = dedup_lookup(chunk, suffix, &fps[k - 1]);
+        if (b == END) break;
+        suffix = b;
+        k--;
+    }
+    if (suffix != END) refs[suffix]++;
+    dd_stat.saved += cnt - k;
+
+    // 剩下的前缀是新盘块，后一个盘块的指纹已经算过
+    if (k == 0) tar_fcb_ptr->first = suffix;
+    else {
+        tar_fcb_ptr->first = alloc_run(k, cursor_ptr);
+        unsigned short b = tar_fcb_ptr->first;
+        for (size_t i = 0; i < k; i++, b = fat[b]) {
+            if (i == k - 1) fat[b] = suffix;
+            write_block(b, i == cnt - 1 ? last : data + i * BLOCK_SIZE, BLOCK_SIZE);
+            if (i != k - 1) fps[i] = crc32c(0, i == cnt - 1 ? last : data + i * BLOCK_SIZE, BLOCK_SIZE);
+            dedup_insert(b, fps[i], fat[b]);
+        }
+        dd_stat.hashed += k - 1;
+    }
+
+    dd_stat.seconds += now() - start;
+    return k;
+}
 
-    // 找目标 FCB 在当前目录下的位置
-    int i = 0;
-    while (i < dir_size && strcmp(dir[i].filename, fcb_ptr->filename) != 0) i++;
-    if (i == dir_size) return;
+/**
+ * 离线去重一个文件：从链尾开始逐块把内容和后继都相同的盘块合并到已登记的盘块上，没有合并的盘块登记到索引。
+ * 合并只修改前一个盘块的 FAT 项（或 FCB 的 first），被替换的盘块减少引用，没有引用时释放；预分配未写入的盘块保留。
+ * 没有共享的最后一个盘块在文件长度之后补零，和在线去重写入的盘块一致
+ * @param tar_fcb_ptr 文件 FCB，first 可能改变
+ * @return 1：first 改变了，需要写回目录项；0：没有改变
+ */
+static int dedup_file(fcb *tar_fcb_ptr) {
+    unsigned short chain[blocks_for(tar_fcb_ptr->len)];
+    size_t cnt = 0;
+    for (unsigned short b = tar_fcb_ptr->first; b < BLOCK_ASSET && cnt < sizeof(chain) / sizeof(chain[0]); b = fat[b])
+        chain[cnt++] = b;
+
+    unsigned short canon = cnt ? fat[chain[cnt - 1]] : END; // 已处理部分的第一个盘块
+    for (size_t k = cnt; k > 0; k--) {
+        unsigned short b = chain[k - 1];
+        if (k < cnt && fat[b] != canon) { // 后继被合并了，改为指向合并后的盘块
+            unsigned short old = fat[b];
+            fat[b] = canon;
+            refs[canon]++;
+            release_chain(old);
+        }
+        if (zlen[b] == ZLEN_UNWRITTEN) { // 预分配的盘块留给这个文件以后写入，不合并也不登记
+            canon = b;
+            continue;
+        }
 
-    // 分情况删除
-    if (fcb_ptr->is_file) { // 目标删除 FCB 是文件
-        unsigned short cur_block = fcb_ptr->first;
-        while (1) {
-            if (fat[cur_block] == END) {
-                fat[cur_block] = FREE;
-                break;
+        char buf[BLOCK_SIZE];
+        load_block(b, buf);
+        size_t tail = tar_fcb_ptr->len - MIN(tar_fcb_ptr->len, (cnt - 1) * BLOCK_SIZE); // 最后一个盘块的有效字节数
+        if (k == cnt && tail < BLOCK_SIZE && !refs[b]) { // 文件长度之后的旧数据补零，否则内容相同的文件无法合并
+            char zero[BLOCK_SIZE] = {0};
+            if (memcmp(buf + tail, zero, BLOCK_SIZE - tail)) {
+                memset(buf + tail, 0, BLOCK_SIZE - tail);
+                write_block(b, buf, BLOCK_SIZE);
             }
+        }
+        unsigned int fp;
+        unsigned short same = dedup_lookup(buf, fat[b], &fp);
+        if (same == END || same == b) {
+            dedup_insert(b, fp, fat[b]);
+            canon = b;
+        } else canon = same;
+    }
+
+    if (cnt == 0 || canon == tar_fcb_ptr->first) return 0;
+    unsigned short old = tar_fcb_ptr->first;
+    tar_fcb_ptr->first = canon;
+    refs[canon]++;
+    release_chain(old);
+    return 1;
+}
+
+/**
+ * 离线去重稀疏文件：把已分配盘块组成的链当作一个文件去重，最后一个逻辑盘块是空洞时链尾盘块是满的
+ * @param f 稀疏文件 FCB
+ * @param hm 紧跟的 hole_map，first 可能改变
+ * @return 1：first 改变了，需要写回 hole_map；0：没有改变
+ */
+static int dedup_sparse(const fcb *f, hole_map *hm) {
+    if (hm->first == FREE) return 0;
+
+    size_t last = blocks_for(f->len) - 1; // 最后一个逻辑盘块
+    size_t cnt = __builtin_popcountll(hm->map & hole_bits(last + 1));
+    fcb chain = {.is_file = 1, .first = hm->first};
+    chain.len = (hm->map >> last & 1) ? (cnt - 1) * BLOCK_SIZE + (f->len - last * BLOCK_SIZE) : cnt * BLOCK_SIZE;
+    if (!dedup_file(&chain)) return 0;
+    hm->first = chain.first;
+    return 1;
+}
 
-            unsigned short next = fat[cur_block];
-            fat[cur_block] = FREE;
-            cur_block = next;
+/**
+ * 把文件中没有共享的全零盘块改为空洞并释放，普通文件因此变成稀疏文件，目录项移到目录末尾并带上 hole_map。
+ * 链中第一个共享的盘块之后都是共享的，不处理；预分配未写入的盘块留给以后的写入，不释放。
+ * 不超过 FRAG_MAX 字节的文件不能是稀疏文件，不处理
+ * @param stack 文件所在目录的 FCB 栈，目录变化时随之更新
+ * @param pos 目录项在目录中的下标
+ * @param ent 目录项
+ * @return 释放的盘块数
+ */
+static size_t zero_holes(fcb stack[], size_t stack_size, size_t pos, fcb ent) {
+    if (ent.len <= FRAG_MAX || (ent.first == FREE && !IS_SPARSE(&ent))) return 0;
+
+    fcb *dir = &stack[stack_size - 1];
+    size_t old_slots = ENTRY_SLOTS(&ent);
+    if (old_slots == 1 && dir->len + sizeof(fcb) > UINT16_MAX) return 0; // 放不下 hole_map
+    fcb slots[2];
+    if (old_slots == 2) read_data(dir, (pos + 1) * sizeof(fcb), &slots[1], sizeof(fcb));
+    hole_map hm;
+    load_hole_map(&ent, &slots[1], &hm);
+
+    size_t freed = 0;
+    unsigned short *link = &hm.first; // 当前盘块的引用，hole_map 的 first 或上一个盘块的 FAT 项
+    for (size_t i = 0; i < blocks_for(ent.len) && *link >= DATA_START && *link < BLOCK_ASSET; i++) {
+        if (!(hm.map >> i & 1)) continue;
+        unsigned short b = *link;
+        if (refs[b]) break;
+
+        char buf[BLOCK_SIZE];
+        size_t n = MIN(BLOCK_SIZE, ent.len - i * BLOCK_SIZE); // 最后一个盘块只看文件长度之内的部分
+        const char *data = zlen[b] == ZLEN_UNWRITTEN ? NULL : view_block(b, buf);
+        if (data == NULL || data[0] != 0 || memcmp(data, data + 1, n - 1)) {
+            link = &fat[b];
+            continue;
         }
-    } else { // 目标删除 FCB 是目录，则递归删除
-        // 获取要删除目录的文件目录
-        fcb tar_dir[20];
-        size_t tar_dir_size = 0;
-        get_dir(fcb_ptr, tar_dir, &tar_dir_size);
+        *link = fat[b];
+        fat[b] = FREE;
+        hm.map &= ~((uint64_t) 1 << i);
+        freed++;
+    }
+    if (!freed) return 0;
+
+    if (!hm.map) hm.first = FREE; // 全是空洞
+    ent.first = FREE;
+    slots[0] = ent;
+    memcpy(&slots[1], &hm, sizeof(hm));
+    if (old_slots == 2) write_data(dir, pos * sizeof(fcb), slots, sizeof(slots));
+    else { // 释放了盘块，目录增长需要的盘块足够
+        remove_data(dir, pos * sizeof(fcb), sizeof(fcb));
+        write_data(dir, dir->len, slots, sizeof(slots));
+    }
+    store_dir_fcb(stack, stack_size);
+    refresh_stack(fcb_stack, fcb_stack_size, stack, stack_size);
+    return freed;
+}
+
+/**
+ * 从游标处向后分配 n 个空闲盘块串成一条链，连续多次分配的链在空闲空间中首尾相接，调用前需确认空闲盘块足够
+ * @param n 盘块数
+ * @param cursor_ptr 分配游标，返回时指向最后分配的盘块之后
+ * @return 第一个盘块号
+ */
+static unsigned short alloc_run(size_t n, unsigned short *cursor_ptr) {
+    unsigned short first = END;
+    unsigned short prev = END;
+    unsigned short b = *cursor_ptr;
+    for (size_t k = 0; k < n; k++, b++) {
+        while (fat[b] != FREE) b++;
+        if (prev == END) first = b;
+        else fat[prev] = b;
+        prev = b;
+    }
+    fat[prev] = END;
+    *cursor_ptr = b;
+    return first;
+}
 
-        // 遍历，递归删除
-        for (int k = 0; k < tar_dir_size; ++k) {
-            rmfcb_in(fcb_ptr, &tar_dir[k]);
+/**
+ * 分配 n 个空闲盘块串成一条链：优先使用从 goal 开始的连续空闲盘块，其次是第一段足够长的连续空闲盘块，
+ * 都没有时从头按顺序取空闲盘块。调用前需确认空闲盘块足够
+ * @param n 盘块数
+ * @param goal 希望的第一个盘块号，通常是链尾之后的盘块
+ * @return 第一个盘块号
+ */
+static unsigned short alloc_extent(size_t n, unsigned short goal) {
+    unsigned short cursor = DATA_START;
+    size_t run = 0;
+    for (size_t b = goal; b >= DATA_START && b < BLOCK_ASSET && fat[b] == FREE && run < n; b++) run++;
+    if (run == n) cursor = goal;
+    else {
+        run = 0;
+        for (size_t b = DATA_START; b < BLOCK_ASSET && run < n; b++) {
+            run = fat[b] == FREE ? run + 1 : 0;
+            if (run == n) cursor = b + 1 - n;
         }
+    }
+    return alloc_run(n, &cursor);
+}
 
-        // 回收 first_block
-        fat[fcb_ptr->first] = FREE;
+/**
+ * 链至少延长到 n 个盘块，新盘块一次分配、尽量接在链尾之后连续存放；还没有盘块时分配整条链。
+ * 调用前需确认空闲盘块足够，链尾不能被共享
+ * @param tar_fcb_ptr 目标 FCB，还没有盘块时写入 first
+ * @param n 盘块数
+ */
+static void extend_chain(fcb *tar_fcb_ptr, size_t n) {
+    unsigned short tail = END;
+    size_t have = 0;
+    for (unsigned short b = tar_fcb_ptr->first; b >= DATA_START && b < BLOCK_ASSET; b = fat[b]) {
+        tail = b;
+        have++;
     }
+    if (have >= n) return;
 
-    // 在当前目录中移除目标删除 FCB
-    while (i + 1 < dir_size) {
-        dir[i] = dir[i + 1];
-        i++;
+    if (tail == END) tar_fcb_ptr->first = alloc_extent(n, DATA_START);
+    else fat[tail] = alloc_extent(n - have, tail + 1);
+}
+
+/**
+ * 数据占用的盘块数，内联文件和还没有写入过的空目录没有盘块
+ */
+static size_t blocks_of(const fcb *tar_fcb_ptr) {
+    return tar_fcb_ptr->first == FREE ? 0 : blocks_for(tar_fcb_ptr->len);
+}
+
+/**
+ * 把数据写入一条已分配好的链，每个盘块只写一次
+ * @param first 第一个盘块号
+ * @param data 字节数据
+ * @param n 字节数
+ */
+static void write_chain(unsigned short first, const char *data, size_t n) {
+    unsigned short cur_block = first;
+    for (size_t off = 0; off == 0 || off < n; off += BLOCK_SIZE, cur_block = fat[cur_block])
+        write_block(cur_block, data + off, MIN(BLOCK_SIZE, n - off));
+}
+
+/**
+ * 在数据的 off 处写入 n 字节，off 不超过 len，链不够长时一次分配新盘块，len 至少增长到 off + n。
+ * 只访问写入范围所在的盘块：未压缩的盘块直接写入，每个字节只复制一次；压缩块或开启压缩时逐块读出、修改后重新压缩
+ * @param tar_fcb_ptr 目标 FCB
+ * @param off 写入位置
+ * @param src 字节数据，可以与目标位置重叠
+ * @param n 字节数
+ */
+static void write_data(fcb *tar_fcb_ptr, size_t off, const void *src, size_t n) {
+    unshare_data(tar_fcb_ptr, off, off + n); // 要修改或追加的盘块与其他链共享时先复制
+    extend_chain(tar_fcb_ptr, blocks_for(off + n)); // 追加的盘块一次分配，接在链尾之后
+    size_t len = MAX(tar_fcb_ptr->len, off + n);
+    size_t pos = 0; // cur_block 在数据中的起始位置
+    unsigned short cur_block = tar_fcb_ptr->first;
+    for (size_t done = 0; done < n;) {
+        if (off + done >= pos + BLOCK_SIZE) { // 下一个盘块
+            cur_block = fat[cur_block];
+            pos += BLOCK_SIZE;
+            continue;
+        }
+
+        size_t block_offset = off + done - pos;
+        size_t to_write = MIN(BLOCK_SIZE - block_offset, n - done);
+        if (sys_opt.compress || (zlen[cur_block] && zlen[cur_block] != ZLEN_UNWRITTEN)) {
+            char buf[BLOCK_SIZE];
+            load_block(cur_block, buf);
+            memmove(buf + block_offset, (const char *) src + done, to_write);
+            write_block(cur_block, buf, MIN(BLOCK_SIZE, len - pos));
+        } else {
+            char *dst = block_ptr(cur_block, 1);
+            if (zlen[cur_block] == ZLEN_UNWRITTEN) { // 第一次写入预分配的盘块，没写到的部分要读出零
+                memset(dst, 0, BLOCK_SIZE);
+                zlen[cur_block] = 0;
+            }
+            memmove(dst + block_offset, (const char *) src + done, to_write);
+        }
+        done += to_write;
     }
-    dir_size = i;
 
-    // 将当前目录重新写入虚拟磁盘空间
-    char buf[1024];
-    memcpy(buf, dir, dir_size * sizeof(fcb));
-    size_t buf_size = dir_size * sizeof(fcb);
-    rewrite_data(dir_ptr, buf, buf_size);
+    tar_fcb_ptr->len = len;
 }
 
 /**
- * 将数据重新写回目标 FCB 的虚拟磁盘（不会更新上一级目录）
+ * 删除数据中 off 处的 n 字节，后面的数据前移，释放多余的盘块
  * @param tar_fcb_ptr 目标 FCB
- * @param data 字节数据
+ * @param off 删除位置
  * @param n 字节数
  */
-static void rewrite_data(fcb *tar_fcb_ptr, char data[], size_t n) {
-    size_t data_offset = 0;
-    size_t block_offset = 0;
+static void remove_data(fcb *tar_fcb_ptr, size_t off, size_t n) {
+    // 后面的数据按盘块前移；压缩块先解压，块缓存模式下写入时可能淘汰源盘块所在的缓存帧，先复制到缓冲区
+    size_t len = tar_fcb_ptr->len;
+    char buf[BLOCK_SIZE];
     unsigned short cur_block = tar_fcb_ptr->first;
-    while (n - data_offset > 0) {
-        size_t to_write = MIN(n - data_offset, BLOCK_SIZE - block_offset);
-        memcpy(dist + cur_block * BLOCK_SIZE, data + data_offset, to_write);
+    for (size_t i = 0; i < (off + n) / BLOCK_SIZE; i++) cur_block = fat[cur_block];
+    for (size_t src = off + n; src < len;) {
+        size_t block_offset = src % BLOCK_SIZE;
+        size_t to_move = MIN(BLOCK_SIZE - block_offset, len - src);
+        const char *data = view_block(cur_block, buf) + block_offset;
+        if (sys_opt.cache_size && data != buf + block_offset) data = memcpy(buf, data, to_move);
+        write_data(tar_fcb_ptr, src - n, data, to_move);
+
+        src += to_move;
+        if (src % BLOCK_SIZE == 0) cur_block = fat[cur_block];
+    }
 
-        data_offset += to_write;
-        block_offset += to_write;
-        if (block_offset == BLOCK_SIZE) { // 当前块写满了
-            cur_block = (fat[cur_block] == END)
-                        ? fat[cur_block] = next_free_block()
-                        : fat[cur_block];
+    truncate_data(tar_fcb_ptr, len - n);
+}
+
+/**
+ * 数据截断到 n 字节，释放多余的盘块，至少保留一个盘块
+ * @param tar_fcb_ptr 目标 FCB
+ * @param n 新的字节数
+ */
+static void truncate_data(fcb *tar_fcb_ptr, size_t n) {
+    unshare_data(tar_fcb_ptr, n, n);
+    unsigned short cur_block = tar_fcb_ptr->first;
+    for (size_t pos = BLOCK_SIZE; pos < n; pos += BLOCK_SIZE) cur_block = fat[cur_block];
+
+    unsigned short clean = fat[cur_block];
+    fat[cur_block] = END;
+    if (clean != END) release_chain(clean);
+
+    tar_fcb_ptr->len = n;
+}
+
+/**
+ * 写入单个盘块，开启压缩时先尝试压缩，压缩后没有变小则按原样存储。
+ * 压缩后的负载放在盘块开头，之后补零：回写时只写 zlen 字节，盘块的其余部分在数据文件中打洞
+ * @param block 目标盘块
+ * @param data 字节数据
+ * @param n 字节数，不超过 BLOCK_SIZE
+ */
+static void write_block(unsigned short block, const char *data, size_t n) {
+    if (sys_opt.compress && n > 0) {
+        char buf[BLOCK_SIZE];
+        size_t buf_size = lz_compress(data, n, buf, n - 1);
+        if (buf_size) {
+            char *dst = block_ptr(block, 1);
+            memcpy(dst, buf, buf_size);
+            memset(dst + buf_size, 0, BLOCK_SIZE - buf_size);
+            zlen[block] = buf_size;
+            return;
         }
     }
 
-    // 数据可能变少了，需要释放磁盘块
-    if (fat[cur_block] != END) {
-        unsigned short clean_first = fat[cur_block];
-        fat[cur_block] = END;
+    memcpy(block_ptr(block, 1), data, n);
+    zlen[block] = 0;
+}
 
-        while (1) {
-            if (fat[clean_first] == END) {
-                fat[clean_first] = FREE;
-                break;
-            }
+/**
+ * 获取盘块数据在内存中的地址，块缓存模式下经由块缓存读取；事务中读写事务内的副本
+ * @param block 盘块号
+ * @param dirty 是否要修改该盘块
+ * @return 盘块数据地址，块缓存模式下只在下一次访问盘块之前有效
+ */
+static char *block_ptr(unsigned short block, int dirty) {
+    if (dirty) dedup_remove(block); // 内容要变了，指纹作废
+    if (!txn.active) return disk_block_ptr(block, dirty);
+
+    if (txn.blocks[block] != NULL) return txn.blocks[block];
+    if (!dirty) return disk_block_ptr(block, 0);
+
+    // 第一次修改时复制一份，之后都读写副本，提交前虚拟磁盘上的盘块不变
+    txn.blocks[block] = malloc(BLOCK_SIZE);
+    if (txn.blocks[block] == NULL) {
+        perror("Transaction malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    if (txn.fat[block] == FREE) memset(txn.blocks[block], 0, BLOCK_SIZE); // 事务中新分配的盘块，不需要读取
+    else memcpy(txn.blocks[block], disk_block_ptr(block, 0), BLOCK_SIZE);
+    txn.staged++;
+    return txn.blocks[block];
+}
+
+/**
+ * 获取虚拟磁盘上的盘块数据在内存中的地址，不经过事务
+ */
+static char *disk_block_ptr(unsigned short block, int dirty) {
+    if (dirty) mark_dirty(block);
+    if (sys_opt.cache_size) return cache_get(block, dirty); // 块缓存读取盘块时校验
+
+    char *data = dist + (size_t) block * BLOCK_SIZE;
+    verify_block(block, data);
+    return data;
+}
+
+/**
+ * 标记脏块，脏块数量超过阈值时通知后台回写线程
+ * @param block 盘块号
+ */
+static void mark_dirty(unsigned short block) {
+    mod_seq++;
+    if (blk_state[block] & BLK_DIRTY) return;
+
+    blk_state[block] |= BLK_DIRTY | BLK_ON_DISK | BLK_CHECKED;
+    dirty_cnt++;
+
+    size_t limit = sys_opt.cache_size ? sys_opt.cache_size : BLOCK_ASSET;
+    if (sys_opt.dirty_ratio && dirty_cnt * 100 >= limit * sys_opt.dirty_ratio) wb_kick();
+}
+
+/**
+ * 开始事务：保存 FAT、zlen、refs、frags 和 FCB 栈，之后修改的盘块都写入事务内的副本
+ * @return 0：成功；1：已经在事务中
+ */
+static int txn_begin(void) {
+    if (txn.active) return 1;
+
+    memcpy(txn.fat, fat, sizeof(fat));
+    memcpy(txn.zlen, zlen, sizeof(zlen));
+    memcpy(txn.refs, refs, sizeof(refs));
+    memcpy(txn.frags, frags, sizeof(frags));
+    memcpy(txn.stack, fcb_stack, sizeof(fcb_stack));
+    txn.stack_size = fcb_stack_size;
+    txn.staged = 0;
+    txn.active = 1;
+    return 0;
+}
 
-            unsigned short next = fat[clean_first];
-            fat[clean_first] = FREE;
-            clean_first = next;
+/**
+ * 提交事务：事务内的盘块副本一次写回虚拟磁盘，同一个盘块在事务中修改多少次都只写一次
+ * @return 写回的盘块数量
+ */
+static size_t txn_commit(void) {
+    txn.active = 0;
+
+    size_t written = 0;
+    for (int i = 0; i < BLOCK_ASSET && txn.staged; i++) {
+        if (txn.blocks[i] == NULL) continue;
+        if (fat[i] != FREE) { // 事务中释放的盘块不需要写回
+            memcpy(disk_block_ptr(i, 1), txn.blocks[i], BLOCK_SIZE);
+            written++;
         }
+        free(txn.blocks[i]);
+        txn.blocks[i] = NULL;
+        txn.staged--;
     }
+    write_meta(FAT_FIRST * BLOCK_SIZE, fat, sizeof(fat)); // 元数据区的副本中 FAT 是事务开始时的
+    return written;
+}
 
-    // 维护 FCB 的 len 字段
-    tar_fcb_ptr->len = n;
+/**
+ * 放弃事务：丢弃盘块副本，恢复 FAT、zlen、refs、frags 和 FCB 栈
+ * @return 0：成功；1：不在事务中
+ */
+static int txn_abort(void) {
+    if (!txn.active) return 1;
+
+    txn.active = 0;
+    for (int i = 0; i < BLOCK_ASSET && txn.staged; i++) {
+        if (txn.blocks[i] == NULL) continue;
+        free(txn.blocks[i]);
+        txn.blocks[i] = NULL;
+        txn.staged--;
+    }
+    memcpy(fat, txn.fat, sizeof(fat));
+    memcpy(zlen, txn.zlen, sizeof(zlen));
+    memcpy(refs, txn.refs, sizeof(refs));
+    memcpy(frags, txn.frags, sizeof(frags));
+    memcpy(fcb_stack, txn.stack, sizeof(fcb_stack));
+    fcb_stack_size = txn.stack_size;
+    return 0;
+}
+
+/**
+ * 事务进行中交换当前的 FAT、zlen、refs、frags 和事务开始时的版本，并暂停或恢复盘块副本。
+ * 回写线程取快照前后各调用一次，调用时已持有 fs_lock
+ */
+static void txn_swap(void) {
+    if (!txn.active && !txn.suspended) return;
+
+    unsigned short tmp[BLOCK_ASSET];
+    memcpy(tmp, fat, sizeof(fat));
+    memcpy(fat, txn.fat, sizeof(fat));
+    memcpy(txn.fat, tmp, sizeof(fat));
+    memcpy(tmp, zlen, sizeof(zlen));
+    memcpy(zlen, txn.zlen, sizeof(zlen));
+    memcpy(txn.zlen, tmp, sizeof(zlen));
+    memcpy(tmp, refs, sizeof(refs));
+    memcpy(refs, txn.refs, sizeof(refs));
+    memcpy(txn.refs, tmp, sizeof(refs));
+    uint32_t frags_tmp[BLOCK_ASSET];
+    memcpy(frags_tmp, frags, sizeof(frags));
+    memcpy(frags, txn.frags, sizeof(frags));
+    memcpy(txn.frags, frags_tmp, sizeof(frags));
+    txn.active = !txn.active;
+    txn.suspended = !txn.suspended;
+}
+
+/**
+ * 读取元数据区（FAT、根目录 FCB），可能跨越多个盘块
+ * @param off 虚拟磁盘位置偏移量
+ * @param dest 接收缓冲区
+ * @param n 字节数
+ */
+static void read_meta(size_t off, void *dest, size_t n) {
+    for (size_t done = 0; done < n;) {
+        size_t block_offset = (off + done) % BLOCK_SIZE;
+        size_t to_read = MIN(n - done, BLOCK_SIZE - block_offset);
+        memcpy((char *) dest + done, block_ptr((off + done) / BLOCK_SIZE, 0) + block_offset, to_read);
+        done += to_read;
+    }
 }
 
 /**
- * 获取指定目录
- * @param dir_ptr 目标目录 FCB
- * @param dir 目录接收缓冲区
- * @param dir_size_ptr 目录长度接收缓冲区
+ * 写入元数据区（FAT、根目录 FCB），可能跨越多个盘块
+ * @param off 虚拟磁盘位置偏移量
+ * @param src 字节数据
+ * @param n 字节数
  */
-static void get_dir(fcb *dir_ptr, fcb dir[], size_t *dir_size_ptr) {
-    // 获取指定目录
-    get_data_from_dist(dir, dir_ptr->first, dir_ptr->len);
-    *dir_size_ptr = dir_ptr->len / sizeof(fcb);
+static void write_meta(size_t off, const void *src, size_t n) {
+    for (size_t done = 0; done < n;) {
+        size_t block_offset = (off + done) % BLOCK_SIZE;
+        size_t to_write = MIN(n - done, BLOCK_SIZE - block_offset);
+        memcpy(block_ptr((off + done) / BLOCK_SIZE, 1) + block_offset, (const char *) src + done, to_write);
+        done += to_write;
+    }
 }
 
 /**
  * 格式化全局变量和虚拟磁盘
  */
 static void format() {
-    // fat
-    fat[FAT_FIRST] = FAT_FIRST + 1;
-    fat[FAT_FIRST + 1] = END;
+    // fat，FAT 和 root_fcb 占用的盘块串成一条链
+    for (size_t i = FAT_FIRST; i < ROOT_DIR_FIRST - 1; i++) {
+        fat[i] = i + 1;
+    }
+    fat[ROOT_DIR_FIRST - 1] = END;
     fat[ROOT_DIR_FIRST] = END;
     for (int i = ROOT_DIR_FIRST + 1; i < BLOCK_ASSET; i++) {
         fat[i] = FREE;
     }
+    for (int i = 0; i < BLOCK_ASSET; i++) blk_state[i] |= BLK_CHECKED; // 格式化后数据文件中的旧内容不再有效
+    block_ptr(ROOT_DIR_FIRST, 1); // 已分配的盘块都要写入数据文件，保证与校验和一致
     // 刷新回虚拟磁盘
-    memcpy(dist + FAT_FIRST * BLOCK_SIZE, fat, sizeof(fat));
+    write_meta(FAT_FIRST * BLOCK_SIZE, fat, sizeof(fat));
+    memset(zlen, 0, sizeof(zlen));
+    memset(refs, 0, sizeof(refs));
+    memset(frags, 0, sizeof(frags));
+    dedup_reset();
 
     // 根目录 fcb
     fcb root_dir_fcb;
+    memset(&root_dir_fcb, 0, sizeof(fcb));
     strcpy(root_dir_fcb.filename, "/");
     root_dir_fcb.ext[0] = '\0';
     root_dir_fcb.is_file = 0;
     root_dir_fcb.len = 0;
     root_dir_fcb.first = ROOT_DIR_FIRST;
     // 根目录 fcb 刷新回虚拟磁盘
-    memcpy(dist + ROOT_FCB_OFFSET, &root_dir_fcb, sizeof(fcb));
+    write_meta(ROOT_FCB_OFFSET, &root_dir_fcb, sizeof(fcb));
+
+    // 磁盘格式版本
+    disk_hdr hdr;
+    memcpy(hdr.magic, DISK_MAGIC, sizeof(hdr.magic));
+    hdr.version = DISK_VERSION;
+    write_meta(DISK_HDR_OFFSET, &hdr, sizeof(hdr));
 
     // FCB 栈
     fcb_stack_size = 0;
@@ -971,51 +4148,24 @@ static void format() {
 }
 
 static void rm_file(fcb *prev_dir_fcb_ptr, fcb *cur_dir_fcb_ptr, fcb *tar_fcb) {
-    // 清理文件的虚拟磁盘块，全设置为 FREE
-    for (int i = tar_fcb->first;;) {
-        if (fat[i] == END) {
-            fat[i] = FREE;
-            break;
-        }
-        unsigned short next = fat[i];
-        fat[i] = FREE;
-        i = next;
-    }
-
-    // 将删除文件的FCB从当前目录中移除，并重写当前目录回虚拟磁盘
-    fcb cur_dir[32];
-    size_t cur_dir_size = 0;
-    get_dir(cur_dir_fcb_ptr, cur_dir, &cur_dir_size);
-    int pos = 0;
-    for (; pos < cur_dir_size; ++pos) {
-        if (tar_fcb->is_file == cur_dir[pos].is_file && !strcmp(tar_fcb->filename, cur_dir[pos].filename)) {
-            break;
-        }
-    }
-    for (; pos + 1 < cur_dir_size; pos++) {
-        cur_dir[pos] = cur_dir[pos + 1];
-    }
-    cur_dir_size--;
-    char buf[1024];
-    memcpy(buf, cur_dir, cur_dir_size * sizeof(fcb));
-    rewrite_data(cur_dir_fcb_ptr, buf, cur_dir_size * sizeof(fcb));
-
-    // 当前目录减少了一项，少了 sizeof(fcb) byte，要更新上一级目录
+    size_t pos = find_entry(cur_dir_fcb_ptr, tar_fcb->filename, tar_fcb->is_file, NULL);
+    size_t dir_size = cur_dir_fcb_ptr->len / sizeof(fcb);
+
+    // 清理文件的虚拟磁盘块，与其他文件共享的盘块只减少引用数；打包文件只释放自己的片段，稀疏文件的链首在 hole_map 中
+    if ((IS_PACKED(tar_fcb) || IS_SPARSE(tar_fcb)) && pos + 1 < dir_size) {
+        fcb slot;
+        hole_map hm;
+        read_data(cur_dir_fcb_ptr, (pos + 1) * sizeof(fcb), &slot, sizeof(fcb));
+        load_hole_map(tar_fcb, &slot, &hm);
+        if (IS_PACKED(tar_fcb)) free_frag(&slot, tar_fcb->len);
+        else release_chain(hm.first);
+    } else release_chain(tar_fcb->first);
+
+    // 将删除文件的 FCB 连同槽从当前目录中移除，后面的目录项前移
+    if (pos < dir_size) remove_data(cur_dir_fcb_ptr, pos * sizeof(fcb), ENTRY_SLOTS(tar_fcb) * sizeof(fcb));
+
+    // 当前目录变短了，要更新上一级目录
     if (prev_dir_fcb_ptr == NULL) { // 没有上一级目录，当前目录是根目录
-        memcpy(dist + ROOT_FCB_OFFSET, cur_dir_fcb_ptr, sizeof(fcb));
-    } else { // 有上一级目录
-        fcb prev_dir[32];
-        size_t prev_dir_size = 0;
-        get_dir(prev_dir_fcb_ptr, prev_dir, &prev_dir_size);
-        for (int i = 0; i < prev_dir_size; ++i) {
-            if (!prev_dir[i].is_file && !strcmp(prev_dir[i].filename, cur_dir_fcb_ptr->filename)) {
-                prev_dir[i] = *cur_dir_fcb_ptr;
-                break;
-            }
-        }
-
-        // 将上一级目录重新写回虚拟磁盘
-        memcpy(buf, prev_dir, prev_dir_size * sizeof(fcb));
-        rewrite_data(prev_dir_fcb_ptr, buf, prev_dir_size * sizeof(fcb));
-    }
+        write_meta(ROOT_FCB_OFFSET, cur_dir_fcb_ptr, sizeof(fcb));
+    } else update_entry(prev_dir_fcb_ptr, cur_dir_fcb_ptr); // 有上一级目录
 }
@@ -2,34 +2,97 @@
 #define FILE_SYSTEM_FILE_SYS_H
 
 #include <time.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 /*
- * 布局：
+ * 布局（默认 BLOCK_ASSET = 1000）：
  *         0                 1               2             ...   999
  * +----------------+----------------+----------------+---------------+
- * |    FAT(2000B) + ROOT_FCB(48B)   | ROOT DIR FIRST |   DATA AREA   |
- * +----------------+----------------+-------------- -+---------------+
+ * | FAT(2000B) + ROOT_FCB(32B) + HDR | ROOT DIR FIRST |   DATA AREA   |
+ * +----------------+----------------+----------------+---------------+
  *        1024B           1024B             1024B          ...
+ * 编译时可以通过 -DBLOCK_ASSET=n 调整块数量，FAT 占用的盘块数随之变化
+ *
+ * 磁盘上的所有多字节字段（FAT、目录项、侧表）都是小端序。目录项（fcb）固定 32 字节、没有填充，
+ * 一个盘块正好放 32 个目录项；查找时常用的名称和类型在前，长度、起始盘块号和创建时间在后。
+ * 紧跟根目录 FCB 的 disk_hdr 记录磁盘格式版本，挂载时版本不兼容的数据文件直接拒绝
+ *
+ * 不超过 INLINE_MAX 字节的小文件内联在目录中：不分配盘块（first 为 FREE），内容放在紧跟目录项之后的内联槽中，
+ * 读取时直接从目录所在的盘块取出，不需要再访问数据盘块。内联槽与目录项一样大，第一个字节为 '\0'
+ * （目录项的名称不为空），其余字节存放内容；空文件只有目录项本身
+ *
+ * 超过 INLINE_MAX、不超过 FRAG_MAX 字节的小文件做尾部打包：同样不分配自己的盘块（first 为 FREE），
+ * 内容放在与其他小文件共用的片段盘块中，按 FRAG_UNIT 字节的片段单元分配。紧跟目录项的一个槽是 frag_ref，
+ * 记录片段所在的盘块和起始单元，长度就是目录项的 len。片段盘块在 FAT 中是单独一块的链（END），
+ * frags 位图记录其中哪些单元已用，最后一个片段释放时盘块随之释放
+ *
+ * 有空洞的文件是稀疏文件：目录项的 first 为 FREE、len 超过 FRAG_MAX，紧跟目录项的一个槽是 hole_map，
+ * 其中的位图记录每个逻辑盘块是否已分配，已分配的盘块按逻辑顺序组成一条普通的链，链首记录在 hole_map 中。
+ * 空洞不占盘块，读取时直接得到全零；写入空洞时才分配盘块，没有空洞时改回普通文件
+ *
+ * 数据文件是稀疏文件：空闲盘块不写入并打洞，只有已分配的盘块占用实际磁盘空间。
+ * 挂载参数 stripe= 可以把卷分布在多个数据文件上，盘块按条带单元轮流存放，见 stripe.h
+ *
+ * 数据文件在 BLOCK_ASSET 个盘块之后追加侧表（side table）：
+ * +---------------+-------------------+-------------------+-------------------+-------------------+
+ * | side_hdr(8B)  | zlen[BLOCK_ASSET] | crc[BLOCK_ASSET]  | refs[BLOCK_ASSET] | frags[BLOCK_ASSET]|
+ * +---------------+-------------------+-------------------+-------------------+-------------------+
+ * 旧数据文件没有侧表时，所有盘块均按未压缩处理；zlen 为 ZLEN_UNWRITTEN 的盘块由 fallocate 预分配、还未写入，
+ * 读取时直接得到全零，不访问数据文件，第一次写入时才清零并落盘；没有 crc 表时挂载时按数据文件现有内容计算
+ * crc 为盘块在数据文件中 BLOCK_SIZE 字节的 CRC32C，回写时更新，挂载时或首次访问时校验
+ * refs 为盘块的引用数减一：cp 让多个文件共享同一条链，链首盘块被多个目录项引用，
+ * 写时复制后链的后半段被多个盘块的 FAT 项引用；没有 refs 表时所有盘块都只有一个引用。
+ * frags 为片段盘块的已用单元位图，不是片段盘块的为 0；没有 frags 表时没有片段盘块
  */
 
 #define BLOCK_SIZE 1024  // 块大小（字节）
+#ifndef BLOCK_ASSET
 #define BLOCK_ASSET 1000 // 块数量
-#define DIST_SIZE (BLOCK_ASSET * BLOCK_SIZE) // 模拟磁盘大小（字节）
+#endif
+#define DIST_SIZE ((size_t) BLOCK_ASSET * BLOCK_SIZE) // 模拟磁盘大小（字节）
 
 #define END 0XFFFF // 内容结束标志
 #define FREE 0 // 盘块空闲标志
 
+#if BLOCK_ASSET >= END
+#error "BLOCK_ASSET must be less than END"
+#endif
+
 #define REAL_DATA_FILE "./data" // 实际磁盘数据文件
 
+#define DISK_MAGIC "FSDK" // 磁盘格式魔数
+#define DISK_VERSION 6     // 磁盘格式版本，1 为没有 disk_hdr 的 48 字节目录项旧格式，3 起目录中可以有内联槽，4 起可以有片段引用，5 起可以有预分配的盘块，6 起可以有稀疏文件
+#define DISK_VERSION_MIN 2 // 能挂载的最低版本，挂载时升级为 DISK_VERSION
+
+#define SIDE_MAGIC "FSST" // 侧表魔数
+#define SIDE_ZLEN 0X1     // 侧表中包含 zlen 表
+#define SIDE_CRC 0X2      // 侧表中包含 crc 表
+#define SIDE_REFS 0X4     // 侧表中包含 refs 表
+#define SIDE_FRAGS 0X8    // 侧表中包含 frags 表
+#define ZLEN_UNWRITTEN 0XFFFF // zlen 中表示盘块已预分配、还未写入
+
+#define SYNC_NONE 0  // 持久化模式：从不 fsync（退出时除外）
+#define SYNC_CMD 1   // 持久化模式：每个修改虚拟磁盘的命令执行完立即回写并 fsync
+#define SYNC_GROUP 2 // 持久化模式：组提交，窗口内的修改共用一次回写和 fsync，命令等到这次 fsync 完成后返回
+
+#define BLK_DIRTY 0X1   // 盘块状态：修改后还未回写
+#define BLK_ON_DISK 0X2 // 盘块状态：数据文件中有该盘块的数据（不是空洞）
+#define BLK_CHECKED 0X4 // 盘块状态：已校验过，或内存中的数据比数据文件新，不需要再校验
+
+#define VERIFY_LAZY 0  // 校验模式：首次访问盘块时校验
+#define VERIFY_MOUNT 1 // 校验模式：挂载时并行校验所有已分配的盘块
+#define VERIFY_OFF 2   // 校验模式：不校验（FAT 的合法性检查除外）
+
 #define FAT_FIRST 0               // FAT 起始盘块号
-#define ROOT_DIR_FIRST 2          // 根目录起始盘块号
+#define ROOT_FCB_OFFSET (BLOCK_ASSET * sizeof(unsigned short)) // root_fcb 所在虚拟磁盘位置偏移量，紧跟在 FAT 之后
+#define DISK_HDR_OFFSET (ROOT_FCB_OFFSET + sizeof(fcb)) // disk_hdr 所在虚拟磁盘位置偏移量，紧跟在 root_fcb 之后
+#define ROOT_DIR_FIRST ((DISK_HDR_OFFSET + sizeof(disk_hdr) + BLOCK_SIZE - 1) / BLOCK_SIZE) // 根目录起始盘块号
 #define DATA_START ROOT_DIR_FIRST // 数据区起始盘块号
 
-#define ROOT_FCB_OFFSET 2000 // root_fcb 所在虚拟磁盘位置偏移量
-
 #define MY_LS "ls"           // 列出当前目录命令
 #define MY_EXITSYS "exit" // 退出命令
 #define MY_FORMAT "format"   // 格式化命令
@@ -38,20 +101,155 @@
 #define MY_RMDIR "rmdir"     // 删除文件夹命令
 #define MY_CREATE "create"   // 创建文件命令
 #define MY_RM "rm"           // 删除文件命令
+#define MY_STAT "stat"       // 查看磁盘使用和缓存统计命令
+#define MY_SYNC "sync"       // 立即回写命令
+#define MY_FSCK "fsck"       // 一致性检查命令
+#define MY_IMPORT "import"   // 导入宿主机目录树命令
+#define MY_EXPORT "export"   // 导出目录树到宿主机命令
+#define MY_MV "mv"           // 移动、重命名命令
+#define MY_CP "cp"           // 共享盘块复制命令
+#define MY_FALLOCATE "fallocate" // 预分配命令
+#define MY_WRITE "write"     // 按偏移写入文件命令
+#define MY_DEDUP "dedup"     // 离线去重命令
+#define MY_BEGIN "begin"     // 开始事务命令
+#define MY_COMMIT "commit"   // 提交事务命令
+#define MY_ABORT "abort"     // 放弃事务命令
+#define MY_TRACE "trace"     // 命令轨迹记录命令
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+#define MAX(x, y) (((x) > (y)) ? (x) : (y))
 
-#define MIN(x, y) ((x) < (y)) ? (x) : (y)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "on-disk format is little-endian"
+#endif
 
 typedef struct fcb {
     char filename[16];     // 文件名
-    char ext[8];           // 扩展名
-    unsigned char is_file; // 文件属性字段，0：目录文件；1：实体文件
-    time_t created_time;   // 创建时间
-    unsigned short len;    // 文件或文件目录大小（字节数）
-    unsigned short first;  // 起始盘块号
+    uint8_t is_file;       // 文件属性字段，0：目录文件；1：实体文件
+    char ext[7];           // 扩展名（包括 '.'）
+    uint16_t len;          // 文件或文件目录大小（字节数）
+    uint16_t first;        // 起始盘块号
+    uint32_t created_time; // 创建时间（Unix 时间戳，秒）
 } fcb;
 
+_Static_assert(sizeof(fcb) == 32 && offsetof(fcb, is_file) == 16 && offsetof(fcb, len) == 24 &&
+               offsetof(fcb, created_time) == 28, "fcb must match the on-disk directory entry layout");
+
+#define INLINE_SLOT_DATA (sizeof(fcb) - 1)                                     // 每个内联槽存放的字节数
+#define INLINE_MAX (2 * INLINE_SLOT_DATA)                                      // 内联文件的最大字节数
+#define INLINE_SLOTS(len) (((len) + INLINE_SLOT_DATA - 1) / INLINE_SLOT_DATA) // 内联内容占用的槽数
+#define IS_SLOT(f) ((f)->filename[0] == '\0')                                  // 目录中的这一项是否为内联槽
+#define IS_INLINE(f) ((f)->is_file && (f)->first == FREE && (f)->len <= INLINE_MAX) // 是否为内联文件
+#define IS_PACKED(f) ((f)->is_file && (f)->first == FREE && (f)->len > INLINE_MAX && (f)->len <= FRAG_MAX) // 是否为尾部打包的文件
+#define IS_SPARSE(f) ((f)->is_file && (f)->first == FREE && (f)->len > FRAG_MAX) // 是否为有空洞的稀疏文件
+#define ENTRY_SLOTS(f) (IS_INLINE(f) ? 1 + INLINE_SLOTS((f)->len) : IS_PACKED(f) || IS_SPARSE(f) ? 2 : 1) // 目录项连同槽占用的项数
+
+#define FRAG_UNIT 32                                            // 片段单元大小（字节）
+#define FRAG_BLOCK_UNITS (BLOCK_SIZE / FRAG_UNIT)               // 每个片段盘块的单元数，与 frags 位图的位数相同
+#define FRAG_MAX (BLOCK_SIZE - FRAG_UNIT)                       // 尾部打包文件的最大字节数
+#define FRAG_UNITS(len) (((len) + FRAG_UNIT - 1) / FRAG_UNIT)   // 片段占用的单元数
+
+_Static_assert(FRAG_BLOCK_UNITS == 32, "frags bitmap must have one bit per fragment unit");
+
+typedef struct frag_ref {
+    char mark;      // '\0'，与内联槽相同，表示这一项不是目录项
+    uint8_t unit;   // 片段的起始单元号
+    uint16_t block; // 片段盘块号
+    char pad[28];
+} frag_ref;
+
+_Static_assert(sizeof(frag_ref) == sizeof(fcb), "frag_ref must fill one directory slot");
+
+#define HOLE_MAP_BITS 64 // 空洞位图的位数
+
+_Static_assert((UINT16_MAX + BLOCK_SIZE - 1) / BLOCK_SIZE <= HOLE_MAP_BITS, "hole map must cover the largest file");
+
+typedef struct hole_map {
+    char mark;      // '\0'，与内联槽相同，表示这一项不是目录项
+    uint8_t pad;
+    uint16_t first; // 已分配的盘块组成的链的第一个盘块号，全是空洞时为 FREE
+    uint32_t pad2;
+    uint64_t map;   // 第 i 位为 1 表示第 i 个逻辑盘块已分配，为 0 表示空洞
+    char pad3[16];
+} hole_map;
+
+_Static_assert(sizeof(hole_map) == sizeof(fcb), "hole_map must fill one directory slot");
+
+typedef struct disk_hdr {
+    char magic[4];    // 魔数，DISK_MAGIC
+    uint32_t version; // 磁盘格式版本，DISK_VERSION
+} disk_hdr;
+
+typedef struct side_hdr {
+    char magic[4];      // 魔数，SIDE_MAGIC
+    unsigned int flags; // 侧表包含哪些表，SIDE_ZLEN 等
+} side_hdr;
+
+#define SIDE_SIZE (sizeof(side_hdr) + (size_t) BLOCK_ASSET * (2 * sizeof(unsigned short) + sizeof(unsigned int) + sizeof(uint32_t))) // 侧表字节数
+
+#define STRIPE_SPEC_MAX 256 // 数据文件列表的最大长度
+
+typedef struct mount_opt {
+    unsigned char compress;      // 是否压缩写入的盘块，0：不压缩；1：压缩。回写时只写压缩后的字节，其余部分打洞
+    size_t cache_size;           // 块缓存帧数量，0：整个虚拟磁盘常驻内存；大于 0：按需读取盘块到块缓存
+    int aio_backend;             // 异步 I/O 后端，AIO_AUTO / AIO_URING / AIO_THREADS
+    unsigned int aio_depth;      // 异步 I/O 队列深度，0 表示默认值
+    unsigned int flush_interval; // 后台回写间隔（毫秒），0：不启动回写线程，退出时才写回
+    unsigned int dirty_ratio;    // 脏块占比（百分比）超过该值时立即回写，0：不按比例触发
+    unsigned char sync_mode;     // 持久化模式，SYNC_NONE / SYNC_CMD / SYNC_GROUP
+    unsigned int group_window;   // 组提交窗口（毫秒）
+    unsigned char verify;        // 校验模式，VERIFY_LAZY / VERIFY_MOUNT / VERIFY_OFF
+    unsigned char dedup;         // 写入文件数据时是否在线去重，0：不去重；1：去重
+    char stripe_spec[STRIPE_SPEC_MAX]; // 数据文件列表，以 ':' 分隔，空串表示 REAL_DATA_FILE
+} mount_opt;
+
+extern mount_opt sys_opt; // 挂载参数
+
+typedef struct fs_usage {
+    size_t blocks;       // 盘块总数
+    size_t used;         // 已分配的盘块数（包括元数据盘块）
+    size_t chains;       // 数据盘块组成的链数，共享的链只算一次
+    size_t fragments;    // 链中后继不是下一个盘块的数据盘块数，同 stat
+    size_t free_extents; // 连续的空闲盘块段数
+    size_t largest_free; // 最长的连续空闲盘块段的盘块数
+} fs_usage;
+
+int parse_mount_opt(const char *opts);
+
+int pread_full(int fd, void *buf, size_t n, size_t off);
+
+int pwrite_full(int fd, const void *buf, size_t n, size_t off);
+
+void verify_block(unsigned short block, const char *data);
+
+void checksum_block(unsigned short block, const char *data);
+
+void clean_block(unsigned short block);
+
+size_t stored_size(unsigned short block);
+
 void start_sys(void);
 
+int fs_exec(const char *line);
+
+int fs_mv(const char *src, const char *dst);
+
+int fs_cp(const char *src, const char *dst, int recursive);
+
+int fs_fallocate(const char *path, size_t bytes);
+
+int fs_write(const char *path, size_t off, const void *data, size_t n);
+
+int fs_read(const char *path, size_t off, void *buf, size_t n, size_t *n_ptr);
+
+int fs_begin(void);
+
+int fs_commit(void);
+
+void fs_abort(void);
+
+void fs_get_usage(fs_usage *usage_ptr);
+
 void command();
 
 #endif //FILE_SYSTEM_FILE_SYS_H
@@ -0,0 +1,568 @@
+#include "fsck.h"
+#include "lz.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define OWNER_NONE 0 // 盘块不属于任何链
+#define OWNER_META 1 // 盘块是元数据盘块
+#define OWNER_FRAG 2 // 盘块是片段盘块，由多个打包文件共用
+
+#define CHAIN_OK 0    // 链没有问题
+#define CHAIN_FIXED 1 // 链被截断或 len 被修正，FCB 需要写回
+#define CHAIN_DROP 2  // 首个盘块不可用，目录项需要删除
+
+#define FSCK_MAX_THREADS 64 // 最大线程数
+
+typedef struct node {
+    fcb f;                               // 修正后的 FCB
+    fcb slots[INLINE_SLOTS(INLINE_MAX)]; // 内联文件：紧跟目录项的内联槽；打包文件：片段引用；稀疏文件：hole_map
+    int parent;                          // 所在目录的节点号，根目录为 -1
+    int first_child;                     // 目录：第一个子节点号，一个目录的子节点编号连续
+    int child_cnt;                       // 目录：子节点数量（包括要删除的）
+    unsigned char changed;               // FCB 被修正，需要写回所在目录
+    unsigned char removed;               // 目录项需要删除
+    unsigned char dir_changed;           // 目录：有子节点被修正或删除，需要重写目录
+} node;
+
+static unsigned short *ck_fat;        // 被检查的 FAT
+static const unsigned short *ck_zlen; // 每个盘块压缩后的字节数
+static unsigned short *ck_refs;       // 每个盘块的引用数减一
+static const fsck_ops *ck_ops;        // 读写盘块的回调
+static int ck_repair;                 // 是否修复
+static unsigned int *owner;           // 盘块号 -> 所有者编号，OWNER_NONE 表示不可达
+static unsigned int next_id;          // 下一个所有者编号
+static unsigned int *in_deg;          // 盘块号 -> 引用它的目录项数量，遍历结束后再加上引用它的 FAT 项数量
+static uint32_t *frag_used;           // 盘块号 -> 打包文件实际占用的片段单元
+
+static pthread_mutex_t ck_lock = PTHREAD_MUTEX_INITIALIZER; // 保护下面的字段
+static pthread_cond_t ck_cond = PTHREAD_COND_INITIALIZER;
+static node *nodes;        // 目录树所有节点，子节点编号总是大于父节点
+static size_t nodes_size;
+static size_t nodes_cap;
+static int *queue;         // 待处理的目录节点号
+static size_t queue_head;
+static size_t queue_size;
+static size_t queue_cap;
+static int busy;           // 正在处理目录的线程数
+static fsck_report total;  // 各线程的统计汇总
+
+/**
+ * 确保数组容量足够，不够时扩容为两倍
+ */
+static void *reserve(void *arr, size_t *cap_ptr, size_t need, size_t elem_size) {
+    if (need <= *cap_ptr) return arr;
+
+    size_t cap = *cap_ptr ? *cap_ptr : 64;
+    while (cap < need) cap *= 2;
+    arr = realloc(arr, cap * elem_size);
+    if (arr == NULL) {
+        perror("Fsck malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    *cap_ptr = cap;
+    return arr;
+}
+
+/**
+ * 沿 FCB 的 FAT 链登记盘块所有者，遇到交叉链接、环、越界指针时截断，链长与 len 不符时修正 len。
+ * 已被其他链登记且 refs 大于 0 的盘块是共享的，之后的部分只计数不登记，也不修改。
+ * 只在修复模式下修改 FAT，但总是修正传入的 FCB，保证之后按 len 读取时不会越过出错的位置
+ * @param f FCB，会被修正
+ * @param rep 统计信息
+ * @return CHAIN_OK / CHAIN_FIXED / CHAIN_DROP
+ */
+static int check_chain(fcb *f, fsck_report *rep) {
+    unsigned int id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    size_t needed = f->len ? (f->len + BLOCK_SIZE - 1) / BLOCK_SIZE : 1; // 写入过的空目录也占一个盘块
+    size_t count = 0;
+    int shared = 0; // 是否进入了与其他链共享的部分
+    unsigned short prev = END;
+    unsigned short b = f->first;
+
+    if (!f->is_file && b == FREE && f->len == 0) return CHAIN_OK; // 还没有写入过的空目录没有盘块
+    if (b < DATA_START || b >= BLOCK_ASSET) {
+        printf("%s%s: Bad first block %d\n", f->filename, f->ext, b);
+        rep->bad_ptrs++;
+        return CHAIN_DROP;
+    }
+
+    while (1) {
+        unsigned int expected = OWNER_NONE;
+        if (!shared && !__atomic_compare_exchange_n(&owner[b], &expected, id, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            if (expected != id && expected != OWNER_META && ck_refs[b]) shared = 1; // 之后的部分由登记它的链检查
+            else {
+                if (expected == id) {
+                    printf("%s%s: Cycle at block %d\n", f->filename, f->ext, b);
+                    rep->cycles++;
+                } else {
+                    printf("%s%s: Block %d cross-linked\n", f->filename, f->ext, b);
+                    rep->cross_links++;
+                }
+                if (count == 0) return CHAIN_DROP;
+                if (ck_repair) ck_fat[prev] = END;
+                break;
+            }
+        }
+        count++;
+        if (!shared) rep->reachable++;
+
+        if (count == needed) { // 链比 len 长，多余的盘块交给泄漏检查释放
+            if (ck_fat[b] != END) {
+                printf("%s%s: Chain longer than len %d\n", f->filename, f->ext, f->len);
+                rep->bad_lens++;
+                if (ck_repair && !shared) ck_fat[b] = END;
+            }
+            break;
+        }
+
+        unsigned short next = ck_fat[b];
+        if (next == END) break;
+        if (next < DATA_START || next >= BLOCK_ASSET) {
+            printf("%s%s: Bad block pointer %d -> %d\n", f->filename, f->ext, b, next);
+            rep->bad_ptrs++;
+            if (ck_repair && !shared) ck_fat[b] = END;
+            break;
+        }
+        prev = b;
+        b = next;
+    }
+
+    // 链比 len 短时 len 截断到链的容量，目录的 len 必须是 FCB 大小的整数倍
+    __atomic_fetch_add(&in_deg[f->first], 1, __ATOMIC_RELAXED);
+    size_t len = MIN(f->len, count * BLOCK_SIZE);
+    if (!f->is_file) len -= len % sizeof(fcb);
+    if (len == f->len) return CHAIN_OK;
+
+    printf("%s%s: Bad len %d, should be %zu\n", f->filename, f->ext, f->len, len);
+    rep->bad_lens++;
+    f->len = len;
+    return CHAIN_FIXED;
+}
+
+/**
+ * 检查打包文件的片段引用：片段盘块合法、是单独一块的链，片段不越过盘块末尾，也不与其他片段重叠。
+ * 片段盘块第一次被引用时登记为 OWNER_FRAG，之后只在 frag_used 中登记占用的单元
+ * @param f 打包文件的 FCB
+ * @param slot 紧跟目录项的片段引用
+ * @param rep 统计信息
+ * @return 0：片段可用；1：目录项需要删除
+ */
+static int check_frag(const fcb *f, const fcb *slot, fsck_report *rep) {
+    frag_ref ref;
+    memcpy(&ref, slot, sizeof(ref));
+    size_t units = FRAG_UNITS(f->len);
+    if (f->len > FRAG_MAX || ref.block < DATA_START || ref.block >= BLOCK_ASSET || ck_fat[ref.block] != END ||
+        ref.unit + units > FRAG_BLOCK_UNITS) {
+        printf("%s%s: Bad fragment %d:%d\n", f->filename, f->ext, ref.block, ref.unit);
+        rep->bad_ptrs++;
+        return 1;
+    }
+
+    unsigned int expected = OWNER_NONE;
+    if (__atomic_compare_exchange_n(&owner[ref.block], &expected, OWNER_FRAG, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        rep->reachable++;
+    else if (expected != OWNER_FRAG) {
+        printf("%s%s: Block %d cross-linked\n", f->filename, f->ext, ref.block);
+        rep->cross_links++;
+        return 1;
+    }
+
+    // 与其他片段重叠时不登记任何单元
+    uint32_t mask = (uint32_t) ((((uint64_t) 1 << units) - 1) << ref.unit);
+    uint32_t used = __atomic_load_n(&frag_used[ref.block], __ATOMIC_RELAXED);
+    do {
+        if (used & mask) {
+            printf("%s%s: Fragment %d:%d overlaps\n", f->filename, f->ext, ref.block, ref.unit);
+            rep->cross_links++;
+            return 1;
+        }
+    } while (!__atomic_compare_exchange_n(&frag_used[ref.block], &used, used | mask, 0, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    return 0;
+}
+
+/**
+ * 检查稀疏文件：位图不超过文件的盘块数，已分配的盘块按普通的链检查。
+ * 链比位图中已分配的盘块少时，丢失的盘块（逻辑上靠后的）改为空洞，文件长度不变；链首不可用时整个文件都是空洞
+ * @param f 稀疏文件的 FCB
+ * @param slot 紧跟目录项的 hole_map，会被修正
+ * @param rep 统计信息
+ * @return CHAIN_OK / CHAIN_FIXED
+ */
+static int check_sparse(const fcb *f, fcb *slot, fsck_report *rep) {
+    hole_map hm;
+    memcpy(&hm, slot, sizeof(hm));
+    size_t blocks = (f->len + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint64_t valid = blocks >= HOLE_MAP_BITS ? ~(uint64_t) 0 : ((uint64_t) 1 << blocks) - 1;
+    int res = CHAIN_OK;
+    if (hm.map & ~valid) {
+        printf("%s%s: Hole map beyond len %d\n", f->filename, f->ext, f->len);
+        rep->bad_lens++;
+        hm.map &= valid;
+        res = CHAIN_FIXED;
+    }
+
+    size_t present = __builtin_popcountll(hm.map);
+    if (present == 0 && hm.first != FREE) {
+        printf("%s%s: Bad first block %d\n", f->filename, f->ext, hm.first);
+        rep->bad_ptrs++;
+        hm.first = FREE;
+        res = CHAIN_FIXED;
+    } else if (present) {
+        fcb chain = *f;
+        chain.first = hm.first;
+        chain.len = present * BLOCK_SIZE;
+        int chain_res = check_chain(&chain, rep);
+        if (chain_res != CHAIN_OK) {
+            size_t keep = chain_res == CHAIN_DROP ? 0 : chain.len / BLOCK_SIZE;
+            while ((size_t) __builtin_popcountll(hm.map) > keep) // 保留逻辑上靠前的 keep 个已分配盘块
+                hm.map &= ~((uint64_t) 1 << (HOLE_MAP_BITS - 1 - __builtin_clzll(hm.map)));
+            if (keep == 0) hm.first = FREE;
+            res = CHAIN_FIXED;
+        }
+    }
+
+    memcpy(slot, &hm, sizeof(hm));
+    return res;
+}
+
+/**
+ * 目录项是否完好：名称和扩展名以 '\0' 结尾，名称不为空，文件属性合法
+ */
+static int valid_entry(const fcb *f) {
+    return f->filename[0] != '\0' && memchr(f->filename, '\0', sizeof(f->filename)) != NULL &&
+           memchr(f->ext, '\0', sizeof(f->ext)) != NULL && f->is_file <= 1;
+}
+
+/**
+ * 内联文件的内联槽是否完整：都在目录范围内，第一个字节都是 '\0'
+ * @param dir 目录
+ * @param k 第一个内联槽的下标
+ * @param n 内联槽数量
+ * @param dir_size 目录项数量（包括内联槽）
+ */
+static int valid_slots(const fcb dir[], size_t k, size_t n, size_t dir_size) {
+    if (k + n > dir_size) return 0;
+    for (size_t j = k; j < k + n; j++) {
+        if (!IS_SLOT(&dir[j])) return 0;
+    }
+    return 1;
+}
+
+/**
+ * 读取目录数据，链已经检查过，只读取 len 字节
+ */
+static void read_dir(const fcb *f, char *data) {
+    char buf[BLOCK_SIZE];
+    unsigned short b = f->first;
+
+    for (size_t off = 0; off < f->len; off += BLOCK_SIZE, b = ck_fat[b]) {
+        size_t n = MIN(BLOCK_SIZE, f->len - off);
+        const char *raw = ck_ops->read_block(b);
+        if (ck_zlen[b]) { // 解压失败时按全零处理，目录项会被当作损坏
+            if (lz_decompress(raw, ck_zlen[b], buf, sizeof(buf)) < n) memset(buf, 0, sizeof(buf));
+            raw = buf;
+        }
+        memcpy(data + off, raw, n);
+    }
+}
+
+/**
+ * 工作线程：从队列取出目录，检查其中每个目录项的链，子目录放回队列，直到所有目录处理完
+ */
+static void *worker(void *arg) {
+    (void) arg;
+    fsck_report rep;
+    memset(&rep, 0, sizeof(rep));
+
+    pthread_mutex_lock(&ck_lock);
+    while (1) {
+        while (queue_head == queue_size && busy > 0) pthread_cond_wait(&ck_cond, &ck_lock);
+        if (queue_head == queue_size) break; // 队列为空且没有线程在处理，不会再有新目录
+
+        int idx = queue[queue_head++];
+        fcb dir_fcb = nodes[idx].f;
+        busy++;
+        pthread_mutex_unlock(&ck_lock);
+
+        size_t dir_size = dir_fcb.len / sizeof(fcb);
+        fcb *dir = malloc(dir_fcb.len + 1);
+        node *children = malloc(dir_size * sizeof(node) + 1);
+        if (dir == NULL || children == NULL) {
+            perror("Fsck malloc error!");
+            exit(EXIT_FAILURE);
+        }
+        read_dir(&dir_fcb, (char *) dir);
+
+        int dir_changed = 0;
+        size_t bad_entries = 0;
+        size_t children_size = 0;
+        for (size_t i = 0; i < dir_size; i++) {
+            node *child = &children[children_size++];
+            memset(child, 0, sizeof(node));
+            child->f = dir[i];
+            child->parent = idx;
+            child->first_child = -1;
+
+            if (!valid_entry(&child->f)) {
+                bad_entries++;
+                child->removed = 1;
+            } else if (IS_INLINE(&child->f)) { // 没有盘块，内容在紧跟的内联槽中
+                size_t slots = INLINE_SLOTS(child->f.len);
+                if (valid_slots(dir, i + 1, slots, dir_size)) {
+                    memcpy(child->slots, &dir[i + 1], slots * sizeof(fcb));
+                    i += slots;
+                } else {
+                    printf("%s%s: Bad inline data\n", child->f.filename, child->f.ext);
+                    bad_entries++;
+                    child->removed = 1;
+                }
+            } else if (IS_PACKED(&child->f)) { // 内容在片段盘块中，紧跟的槽是片段引用
+                if (!valid_slots(dir, i + 1, 1, dir_size)) {
+                    printf("%s%s: Bad fragment reference\n", child->f.filename, child->f.ext);
+                    bad_entries++;
+                    child->removed = 1;
+                } else {
+                    child->removed = check_frag(&child->f, &dir[i + 1], &rep);
+                    child->slots[0] = dir[i + 1];
+                    i++;
+                }
+            } else if (IS_SPARSE(&child->f)) { // 已分配的盘块组成的链，链首在紧跟的 hole_map 中
+                if (!valid_slots(dir, i + 1, 1, dir_size)) {
+                    printf("%s%s: Bad hole map\n", child->f.filename, child->f.ext);
+                    bad_entries++;
+                    child->removed = 1;
+                } else {
+                    child->slots[0] = dir[i + 1];
+                    child->changed = check_sparse(&child->f, &child->slots[0], &rep) == CHAIN_FIXED;
+                    i++;
+                }
+            } else {
+                int res = check_chain(&child->f, &rep);
+                child->removed = res == CHAIN_DROP;
+                child->changed = res == CHAIN_FIXED;
+            }
+
+            if (child->removed || child->changed) dir_changed = 1;
+            if (!child->removed && child->f.is_file) rep.files++;
+            else if (!child->removed) rep.dirs++;
+        }
+        if (bad_entries) printf("%s: %zu bad entries\n", dir_fcb.filename, bad_entries);
+        rep.bad_entries += bad_entries;
+
+        pthread_mutex_lock(&ck_lock);
+        nodes = reserve(nodes, &nodes_cap, nodes_size + children_size, sizeof(node));
+        queue = reserve(queue, &queue_cap, queue_size + children_size, sizeof(int));
+        nodes[idx].first_child = (int) nodes_size;
+        nodes[idx].child_cnt = (int) children_size;
+        nodes[idx].dir_changed = dir_changed;
+        for (size_t i = 0; i < children_size; i++) {
+            if (!children[i].removed && !children[i].f.is_file) queue[queue_size++] = (int) nodes_size;
+            nodes[nodes_size++] = children[i];
+        }
+        busy--;
+        pthread_cond_broadcast(&ck_cond);
+
+        free(children);
+        free(dir);
+    }
+
+    total.dirs += rep.dirs;
+    total.files += rep.files;
+    total.reachable += rep.reachable;
+    total.cross_links += rep.cross_links;
+    total.cycles += rep.cycles;
+    total.bad_ptrs += rep.bad_ptrs;
+    total.bad_lens += rep.bad_lens;
+    total.bad_entries += rep.bad_entries;
+    pthread_cond_broadcast(&ck_cond);
+    pthread_mutex_unlock(&ck_lock);
+    return NULL;
+}
+
+/**
+ * 检查（并修复）文件系统一致性，调用期间不能有其他线程修改文件系统
+ * @param fat FAT，修复模式下会被修改
+ * @param zlen 每个盘块压缩后的字节数
+ * @param refs 每个盘块的引用数减一，修复模式下会被修改
+ * @param frags 每个片段盘块中已用片段单元的位图，修复模式下会被修改
+ * @param root_fcb_ptr 根目录 FCB，修复模式下会被修改
+ * @param repair 是否修复
+ * @param ops 读写盘块的回调
+ * @param report 统计信息接收缓冲区
+ * @return 发现的问题数量
+ */
+size_t fsck_run(unsigned short fat[], const unsigned short zlen[], unsigned short refs[], uint32_t frags[],
+                fcb *root_fcb_ptr, int repair, const fsck_ops *ops, fsck_report *report) {
+    ck_fat = fat;
+    ck_zlen = zlen;
+    ck_refs = refs;
+    ck_ops = ops;
+    ck_repair = repair;
+    memset(&total, 0, sizeof(total));
+    owner = calloc(BLOCK_ASSET, sizeof(unsigned int));
+    in_deg = calloc(BLOCK_ASSET, sizeof(unsigned int));
+    frag_used = calloc(BLOCK_ASSET, sizeof(uint32_t));
+    if (owner == NULL || in_deg == NULL || frag_used == NULL) {
+        perror("Fsck malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    next_id = OWNER_FRAG + 1;
+
+    // 元数据盘块串成一条链
+    for (int i = FAT_FIRST; i < (int) DATA_START; i++) {
+        unsigned short expected = i == DATA_START - 1 ? END : i + 1;
+        owner[i] = OWNER_META;
+        total.reachable++;
+        if (fat[i] != expected) {
+            printf("Block %d: Bad metadata chain\n", i);
+            total.bad_ptrs++;
+            if (repair) fat[i] = expected;
+        }
+    }
+
+    // 根目录
+    nodes_size = 0;
+    queue_head = 0;
+    queue_size = 0;
+    busy = 0;
+    nodes = reserve(nodes, &nodes_cap, 1, sizeof(node));
+    queue = reserve(queue, &queue_cap, 1, sizeof(int));
+    memset(&nodes[0], 0, sizeof(node));
+    nodes[0].f = *root_fcb_ptr;
+    nodes[0].parent = -1;
+    nodes[0].first_child = -1;
+    int res = check_chain(&nodes[0].f, &total);
+    if (res == CHAIN_DROP) printf("Root directory corrupted\n");
+    else {
+        nodes[0].changed = res == CHAIN_FIXED;
+        nodes_size = 1;
+        queue[queue_size++] = 0;
+        total.dirs++;
+    }
+
+    // 多线程并行遍历目录树，当前线程也参与
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads_size = (int) MIN(cpus > 0 ? cpus : 1, FSCK_MAX_THREADS);
+    pthread_t threads[threads_size];
+    int started = 1;
+    while (started < threads_size && !pthread_create(&threads[started], NULL, worker, NULL)) started++;
+    worker(NULL);
+    for (int t = 1; t < started; t++) pthread_join(threads[t], NULL);
+
+    // 引用它的打包文件都被删除的片段盘块不再可达
+    for (int i = DATA_START; i < BLOCK_ASSET; i++) {
+        if (owner[i] != OWNER_FRAG || frag_used[i]) continue;
+        owner[i] = OWNER_NONE;
+        total.reachable--;
+    }
+
+    // 扫描整个 FAT 统计泄漏的盘块，循环没有分支，编译器可以向量化
+    size_t used = 0;
+    size_t leaked = 0;
+    for (int i = 0; i < BLOCK_ASSET; i++) {
+        used += fat[i] != FREE;
+        leaked += (fat[i] != FREE) & (owner[i] == OWNER_NONE);
+    }
+    total.used = used;
+    total.leaked = leaked;
+    for (int i = 0; i < BLOCK_ASSET && leaked;) {
+        if (fat[i] == FREE || owner[i] != OWNER_NONE) {
+            i++;
+            continue;
+        }
+        int j = i;
+        while (j < BLOCK_ASSET && fat[j] != FREE && owner[j] == OWNER_NONE) j++;
+        if (j - i == 1) printf("Block %d: Leaked\n", i);
+        else printf("Blocks %d-%d: Leaked\n", i, j - 1);
+        i = j;
+    }
+
+    if (repair) {
+        for (int i = 0; i < BLOCK_ASSET; i++) fat[i] = owner[i] == OWNER_NONE ? FREE : fat[i];
+    }
+
+    // 引用数：引用盘块的目录项数量加上可达盘块中指向它的 FAT 项数量，减一；不可达的盘块没有引用
+    for (int i = DATA_START; i < BLOCK_ASSET; i++) {
+        if (owner[i] != OWNER_NONE && fat[i] >= DATA_START && fat[i] < BLOCK_ASSET) in_deg[fat[i]]++;
+    }
+    for (int i = DATA_START; i < BLOCK_ASSET; i++) {
+        unsigned int expected = in_deg[i] ? in_deg[i] - 1 : 0;
+        if (refs[i] == expected) continue;
+        if (owner[i] != OWNER_NONE) {
+            printf("Block %d: Bad refcount %d, should be %u\n", i, refs[i], expected);
+            total.bad_refs++;
+        }
+        if (repair) refs[i] = expected;
+    }
+
+    // 片段位图：按打包文件实际占用的单元核对，不可达的盘块不是片段盘块
+    for (int i = DATA_START; i < BLOCK_ASSET; i++) {
+        if (frags[i] == frag_used[i]) continue;
+        if (owner[i] != OWNER_NONE) {
+            printf("Block %d: Bad fragment map %08x, should be %08x\n", i, frags[i], frag_used[i]);
+            total.bad_frags++;
+        }
+        if (repair) frags[i] = frag_used[i];
+    }
+
+    if (repair) {
+        // 子节点编号总是大于父节点，倒序处理保证子目录先于父目录写回
+        for (int i = (int) nodes_size - 1; i >= 0; i--) {
+            node *nd = &nodes[i];
+            if (nd->dir_changed) {
+                fcb *dir = malloc(nd->child_cnt * sizeof(fcb) * (1 + INLINE_SLOTS(INLINE_MAX)) + 1);
+                if (dir == NULL) {
+                    perror("Fsck malloc error!");
+                    exit(EXIT_FAILURE);
+                }
+                size_t dir_size = 0;
+                for (int c = nd->first_child; c < nd->first_child + nd->child_cnt; c++) {
+                    if (nodes[c].removed) continue;
+                    dir[dir_size++] = nodes[c].f;
+                    size_t slots = ENTRY_SLOTS(&nodes[c].f) - 1;
+                    memcpy(&dir[dir_size], nodes[c].slots, slots * sizeof(fcb));
+                    dir_size += slots;
+                }
+
+                unsigned short old_len = nd->f.len;
+                ops->write_dir(&nd->f, dir, dir_size);
+                if (nd->f.len != old_len) nd->changed = 1;
+                free(dir);
+            }
+
+            if (!nd->changed) continue;
+            if (nd->parent < 0) ops->write_root(&nd->f);
+            else nodes[nd->parent].dir_changed = 1;
+        }
+        if (nodes_size > 0) *root_fcb_ptr = nodes[0].f;
+    }
+
+    free(owner);
+    free(in_deg);
+    free(frag_used);
+    free(nodes);
+    free(queue);
+    owner = NULL;
+    in_deg = NULL;
+    frag_used = NULL;
+    nodes = NULL;
+    queue = NULL;
+    nodes_cap = 0;
+    queue_cap = 0;
+    *report = total;
+    return total.leaked + total.cross_links + total.cycles + total.bad_ptrs + total.bad_lens + total.bad_entries +
+           total.bad_refs + total.bad_frags;
+}
+
+/**
+ * 打印检查结果
+ */
+void fsck_print_report(const fsck_report *report) {
+    printf("dirs: %zu, files: %zu, used: %zu, reachable: %zu\n", report->dirs, report->files, report->used,
+           report->reachable);
+    printf("leaked: %zu, cross-linked: %zu, cycles: %zu, bad pointers: %zu, bad len: %zu, bad entries: %zu, "
+           "bad refs: %zu, bad fragment maps: %zu\n", report->leaked, report->cross_links, report->cycles,
+           report->bad_ptrs, report->bad_lens, report->bad_entries, report->bad_refs, report->bad_frags);
+}
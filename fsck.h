@@ -0,0 +1,40 @@
+#ifndef FILE_SYSTEM_FSCK_H
+#define FILE_SYSTEM_FSCK_H
+
+#include "file_sys.h"
+
+/*
+ * 一致性检查：从根目录 FCB 出发多线程并行遍历目录树，每条 FAT 链上的盘块登记到所有者表，
+ * 检查交叉链接（一个盘块属于多条链且没有记录为共享）、环、越界指针、len 与链长不符、损坏的目录项和内联槽，
+ * 打包文件的片段登记到所在片段盘块的单元位图，检查片段越界和重叠，稀疏文件已分配的盘块同样按链检查，
+ * 最后扫描整个 FAT 找出已分配但不可达的盘块（泄漏），并按实际的引用核对 refs 表和 frags 表。
+ * 修复模式下截断出错的链、修正 len、删除损坏的目录项、释放泄漏的盘块，目录改动在所有线程结束后串行写回
+ */
+
+typedef struct fsck_ops {
+    const char *(*read_block)(unsigned short block); // 读取盘块原始数据（可能是压缩数据），多个线程同时调用，结果在同一线程下次调用前有效
+    void (*write_dir)(fcb *dir_fcb_ptr, const fcb dir[], size_t dir_size); // 修复时重写目录，同时维护 len
+    void (*write_root)(const fcb *root_fcb_ptr); // 修复时写回根目录 FCB
+} fsck_ops;
+
+typedef struct fsck_report {
+    size_t dirs;         // 目录数量（包括根目录）
+    size_t files;        // 文件数量
+    size_t used;         // FAT 中已分配的盘块数
+    size_t reachable;    // 从根目录可达的盘块数（包括元数据盘块）
+    size_t leaked;       // 已分配但不可达的盘块数
+    size_t cross_links;  // 交叉链接
+    size_t cycles;       // 环
+    size_t bad_ptrs;     // 越界的 FAT 指针
+    size_t bad_lens;     // len 与链长不符
+    size_t bad_entries;  // 损坏的目录项
+    size_t bad_refs;     // 引用数不符的盘块
+    size_t bad_frags;    // 片段位图与实际占用不符的盘块
+} fsck_report;
+
+size_t fsck_run(unsigned short fat[], const unsigned short zlen[], unsigned short refs[], uint32_t frags[],
+                fcb *root_fcb_ptr, int repair, const fsck_ops *ops, fsck_report *report);
+
+void fsck_print_report(const fsck_report *report);
+
+#endif //FILE_SYSTEM_FSCK_H
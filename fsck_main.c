@@ -0,0 +1,147 @@
+#include "file_sys.h"
+#include "crc32c.h"
+#include "fsck.h"
+#include "stripe.h"
+
+#include <fcntl.h>
+
+/*
+ * 独立的一致性检查工具，不能在文件系统运行时对同一个数据文件使用：
+ * file_system_fsck [-y] [数据文件[:数据文件...]]，条带化的卷按挂载时的顺序列出所有数据文件
+ * -y：修复发现的问题，不指定时只检查
+ * 退出码：0：没有问题；1：问题已修复；4：有问题未修复
+ */
+
+static char *img;                       // 整个虚拟磁盘
+static unsigned short fat[BLOCK_ASSET];  // FAT
+static unsigned short zlen[BLOCK_ASSET]; // 每个盘块压缩后的字节数
+static unsigned int crc[BLOCK_ASSET];    // 每个盘块的 CRC32C
+static unsigned short refs[BLOCK_ASSET]; // 每个盘块的引用数减一
+static uint32_t frags[BLOCK_ASSET];      // 每个片段盘块中已用片段单元的位图
+static unsigned char touched[BLOCK_ASSET]; // 修复时改动过的盘块
+
+static const char *read_block(unsigned short block) {
+    return img + (size_t) block * BLOCK_SIZE;
+}
+
+/**
+ * 按未压缩格式重写目录，目录只会变短，释放多余的盘块
+ */
+static void write_dir(fcb *dir_fcb_ptr, const fcb dir[], size_t dir_size) {
+    size_t n = dir_size * sizeof(fcb);
+    unsigned short b = dir_fcb_ptr->first;
+
+    for (size_t off = 0;; off += BLOCK_SIZE) {
+        memcpy(img + (size_t) b * BLOCK_SIZE, (const char *) dir + off, MIN(BLOCK_SIZE, n - off));
+        zlen[b] = 0;
+        touched[b] = 1;
+        if (n - off <= BLOCK_SIZE) break;
+        b = fat[b];
+    }
+
+    for (unsigned short next = fat[b]; next != END;) {
+        unsigned short tmp = fat[next];
+        fat[next] = FREE;
+        next = tmp;
+    }
+    fat[b] = END;
+    dir_fcb_ptr->len = n;
+}
+
+static void write_root(const fcb *root_fcb_ptr) {
+    memcpy(img + ROOT_FCB_OFFSET, root_fcb_ptr, sizeof(fcb));
+    for (size_t b = ROOT_FCB_OFFSET / BLOCK_SIZE; b <= (ROOT_FCB_OFFSET + sizeof(fcb) - 1) / BLOCK_SIZE; b++) touched[b] = 1;
+}
+
+int main(int argc, char *argv[]) {
+    int repair = 0;
+    const char *path = REAL_DATA_FILE;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-y")) repair = 1;
+        else path = argv[i];
+    }
+
+    int is_new;
+    if (stripe_open(path, repair ? O_RDWR : O_RDONLY, &is_new)) return 4;
+    img = malloc(DIST_SIZE);
+    if (img == NULL) {
+        perror("Fsck malloc error!");
+        return 4;
+    }
+    if (stripe_pread(img, 0, BLOCK_ASSET)) {
+        printf("Data file size mismatch\n");
+        return 4;
+    }
+
+    // 侧表
+    size_t off;
+    int side_fd = stripe_side(&off);
+    side_hdr hdr;
+    int has_crc = 0;
+    if (!pread_full(side_fd, &hdr, sizeof(hdr), off) && !memcmp(hdr.magic, SIDE_MAGIC, sizeof(hdr.magic))) {
+        off += sizeof(hdr);
+        if ((hdr.flags & SIDE_ZLEN) && pread_full(side_fd, zlen, sizeof(zlen), off)) memset(zlen, 0, sizeof(zlen));
+        off += sizeof(zlen);
+        has_crc = (hdr.flags & SIDE_CRC) && !pread_full(side_fd, crc, sizeof(crc), off);
+        off += sizeof(crc);
+        if (has_crc && (hdr.flags & SIDE_REFS) && pread_full(side_fd, refs, sizeof(refs), off))
+            memset(refs, 0, sizeof(refs));
+        off += sizeof(refs);
+        if (has_crc && (hdr.flags & SIDE_REFS) && (hdr.flags & SIDE_FRAGS) &&
+            pread_full(side_fd, frags, sizeof(frags), off))
+            memset(frags, 0, sizeof(frags));
+    }
+    memcpy(fat, img + FAT_FIRST * BLOCK_SIZE, sizeof(fat));
+
+    // 目录项布局随磁盘格式版本变化，版本不一致时无法检查
+    disk_hdr disk;
+    memcpy(&disk, img + DISK_HDR_OFFSET, sizeof(disk));
+    uint32_t version = memcmp(disk.magic, DISK_MAGIC, sizeof(disk.magic)) ? 1 : disk.version;
+    if (version < DISK_VERSION_MIN || version > DISK_VERSION) {
+        printf("Data file version %u, expected %u\n", version, DISK_VERSION);
+        return 4;
+    }
+
+    fcb root_dir_fcb;
+    memcpy(&root_dir_fcb, img + ROOT_FCB_OFFSET, sizeof(fcb));
+
+    fsck_ops ops = {read_block, write_dir, write_root};
+    fsck_report report;
+    size_t problems = fsck_run(fat, zlen, refs, frags, &root_dir_fcb, repair, &ops, &report);
+    fsck_print_report(&report);
+    if (problems == 0 || !repair) {
+        stripe_close();
+        free(img);
+        return problems ? 4 : 0;
+    }
+
+    // 写回 FAT、改动过的盘块和侧表（包括修正后的 refs 表和 frags 表），没有 crc 表时按现有内容补全
+    memcpy(img + FAT_FIRST * BLOCK_SIZE, fat, sizeof(fat));
+    for (size_t i = FAT_FIRST; i < DATA_START; i++) touched[i] = 1;
+    crc32c_init();
+    for (int i = 0; i < BLOCK_ASSET; i++) {
+        if (!touched[i] && has_crc) continue;
+        crc[i] = crc32c(0, img + (size_t) i * BLOCK_SIZE, BLOCK_SIZE);
+        if (!touched[i]) continue;
+        if (stripe_pwrite(img + (size_t) i * BLOCK_SIZE, i, 1)) {
+            perror("Data file write error!");
+            return 4;
+        }
+    }
+
+    memcpy(hdr.magic, SIDE_MAGIC, sizeof(hdr.magic));
+    hdr.flags = SIDE_ZLEN | SIDE_CRC | SIDE_REFS | SIDE_FRAGS;
+    side_fd = stripe_side(&off);
+    if (pwrite_full(side_fd, &hdr, sizeof(hdr), off) || pwrite_full(side_fd, zlen, sizeof(zlen), off + sizeof(hdr)) ||
+        pwrite_full(side_fd, crc, sizeof(crc), off + sizeof(hdr) + sizeof(zlen)) ||
+        pwrite_full(side_fd, refs, sizeof(refs), off + sizeof(hdr) + sizeof(zlen) + sizeof(crc)) ||
+        pwrite_full(side_fd, frags, sizeof(frags), off + sizeof(hdr) + sizeof(zlen) + sizeof(crc) + sizeof(refs)) ||
+        stripe_close()) {
+        perror("Data file write error!");
+        return 4;
+    }
+
+    free(img);
+    printf("Repaired\n");
+    return 1;
+}
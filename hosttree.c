@@ -0,0 +1,320 @@
+#include "hosttree.h"
+#include "file_sys.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TREE_MAX_THREADS 64 // 最大线程数
+
+typedef struct job {
+    int idx;    // 目录节点号
+    char *path; // 目录在宿主机上的路径
+} job;
+
+static host_tree *cur_tree;       // 正在读写的目录树
+static size_t max_len;            // 读取时单个文件的最大字节数
+static void (*handle)(job *work); // 处理一个目录
+
+static pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER; // 保护下面的字段和 cur_tree 的节点数组
+static pthread_cond_t tree_cond = PTHREAD_COND_INITIALIZER;
+static job *queue;         // 待处理的目录
+static size_t queue_head;
+static size_t queue_size;
+static size_t queue_cap;
+static int busy;           // 正在处理目录的线程数
+static size_t errors;      // 出错数量
+
+/**
+ * 确保数组容量足够，不够时扩容为两倍
+ */
+static void *reserve(void *arr, size_t *cap_ptr, size_t need, size_t elem_size) {
+    if (need <= *cap_ptr) return arr;
+
+    size_t cap = *cap_ptr ? *cap_ptr : 64;
+    while (cap < need) cap *= 2;
+    arr = realloc(arr, cap * elem_size);
+    if (arr == NULL) {
+        perror("Tree malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    *cap_ptr = cap;
+    return arr;
+}
+
+/**
+ * 拼接宿主机路径，返回的字符串由调用者 free
+ */
+static char *join_path(const char *dir, const char *name) {
+    size_t n = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(n);
+    if (path == NULL) {
+        perror("Tree malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    snprintf(path, n, "%s/%s", dir, name);
+    return path;
+}
+
+/**
+ * 初始化只有根目录的目录树
+ */
+void tree_init(host_tree *tree) {
+    tree->nodes = NULL;
+    tree->size = 0;
+    tree->cap = 0;
+    tree->nodes = reserve(tree->nodes, &tree->cap, 1, sizeof(tree_node));
+    memset(&tree->nodes[0], 0, sizeof(tree_node));
+    strcpy(tree->nodes[0].name, "/");
+    tree->nodes[0].parent = -1;
+    tree->size = 1;
+}
+
+/**
+ * 给目录追加 n 个连续编号的空子节点，一个目录只能追加一次，多线程时调用者需持有锁
+ * @param parent 目录节点号
+ * @param n 子节点数量
+ * @return 第一个子节点号
+ */
+int tree_add(host_tree *tree, int parent, size_t n) {
+    tree->nodes = reserve(tree->nodes, &tree->cap, tree->size + n, sizeof(tree_node));
+    int first = (int) tree->size;
+    memset(&tree->nodes[first], 0, n * sizeof(tree_node));
+    for (size_t i = 0; i < n; i++) tree->nodes[first + i].parent = parent;
+    tree->nodes[parent].first_child = first;
+    tree->nodes[parent].child_cnt = (int) n;
+    tree->size += n;
+    return first;
+}
+
+/**
+ * 工作线程：从队列取出目录交给 handle，直到队列为空且没有线程在处理
+ */
+static void *worker(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&tree_lock);
+    while (1) {
+        while (queue_head == queue_size && busy > 0) pthread_cond_wait(&tree_cond, &tree_lock);
+        if (queue_head == queue_size) break; // 队列为空且没有线程在处理，不会再有新目录
+
+        job work = queue[queue_head++];
+        busy++;
+        pthread_mutex_unlock(&tree_lock);
+
+        handle(&work);
+        free(work.path);
+
+        pthread_mutex_lock(&tree_lock);
+        busy--;
+        pthread_cond_broadcast(&tree_cond);
+    }
+    pthread_cond_broadcast(&tree_cond);
+    pthread_mutex_unlock(&tree_lock);
+    return NULL;
+}
+
+/**
+ * 从根目录开始多线程处理整棵树，当前线程也参与
+ * @return 出错数量
+ */
+static size_t run(host_tree *tree, const char *host_dir, void (*fn)(job *work)) {
+    cur_tree = tree;
+    handle = fn;
+    errors = 0;
+    busy = 0;
+    queue_head = 0;
+    queue_size = 0;
+    queue = reserve(queue, &queue_cap, 1, sizeof(job));
+    queue[queue_size].idx = 0;
+    queue[queue_size++].path = strdup(host_dir);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads_size = (int) MIN(cpus > 0 ? cpus : 1, TREE_MAX_THREADS);
+    pthread_t threads[threads_size];
+    int started = 1;
+    while (started < threads_size && !pthread_create(&threads[started], NULL, worker, NULL)) started++;
+    worker(NULL);
+    for (int t = 1; t < started; t++) pthread_join(threads[t], NULL);
+
+    free(queue);
+    queue = NULL;
+    queue_cap = 0;
+    return errors;
+}
+
+typedef struct entry {
+    char name[16];         // 名称
+    unsigned char is_file; // 0：目录；1：文件
+    uint32_t mtime;        // 修改时间
+    char *data;            // 文件内容
+    size_t len;            // 文件字节数
+} entry;
+
+/**
+ * 读取时处理一个目录：列出目录项，读入文件内容，子节点一次性加入目录树，子目录放回队列
+ */
+static void load_dir(job *work) {
+    DIR *dir = opendir(work->path);
+    if (dir == NULL) {
+        printf("%s: %s\n", work->path, strerror(errno));
+        pthread_mutex_lock(&tree_lock);
+        errors++;
+        pthread_mutex_unlock(&tree_lock);
+        return;
+    }
+
+    entry *entries = NULL;
+    size_t entries_size = 0;
+    size_t entries_cap = 0;
+    size_t bad = 0;
+    for (struct dirent *de; (de = readdir(dir)) != NULL;) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+
+        struct stat st;
+        if (fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+            printf("%s/%s: %s\n", work->path, de->d_name, strerror(errno));
+            bad++;
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+            printf("%s/%s: Not a regular file or directory, skipped\n", work->path, de->d_name);
+            continue;
+        }
+        if (strlen(de->d_name) >= sizeof(entries->name)) {
+            printf("%s/%s: Name too long\n", work->path, de->d_name);
+            bad++;
+            continue;
+        }
+        if (S_ISREG(st.st_mode) && (size_t) st.st_size > max_len) {
+            printf("%s/%s: File too large\n", work->path, de->d_name);
+            bad++;
+            continue;
+        }
+
+        entries = reserve(entries, &entries_cap, entries_size + 1, sizeof(entry));
+        entry *e = &entries[entries_size++];
+        strcpy(e->name, de->d_name);
+        e->is_file = S_ISREG(st.st_mode);
+        e->mtime = (uint32_t) st.st_mtime;
+        e->data = NULL;
+        e->len = 0;
+        if (!e->is_file || st.st_size == 0) continue;
+
+        // 读入文件内容
+        e->len = st.st_size;
+        e->data = malloc(e->len);
+        int fd = openat(dirfd(dir), de->d_name, O_RDONLY);
+        if (e->data == NULL || fd < 0 || pread_full(fd, e->data, e->len, 0)) {
+            printf("%s/%s: Read error\n", work->path, de->d_name);
+            bad++;
+            entries_size--;
+            free(e->data);
+        }
+        if (fd >= 0) close(fd);
+    }
+    closedir(dir);
+
+    pthread_mutex_lock(&tree_lock);
+    errors += bad;
+    int first = tree_add(cur_tree, work->idx, entries_size);
+    queue = reserve(queue, &queue_cap, queue_size + entries_size, sizeof(job));
+    for (size_t i = 0; i < entries_size; i++) {
+        tree_node *nd = &cur_tree->nodes[first + i];
+        strcpy(nd->name, entries[i].name);
+        nd->is_file = entries[i].is_file;
+        nd->mtime = entries[i].mtime;
+        nd->data = entries[i].data;
+        nd->len = entries[i].len;
+        if (nd->is_file) continue;
+
+        queue[queue_size].idx = first + (int) i;
+        queue[queue_size++].path = join_path(work->path, entries[i].name);
+    }
+    pthread_cond_broadcast(&tree_cond);
+    pthread_mutex_unlock(&tree_lock);
+    free(entries);
+}
+
+/**
+ * 多线程读取宿主机目录树，读取出错的目录项不加入目录树
+ * @param host_dir 宿主机目录，成为目录树的根节点
+ * @param max_file 单个文件的最大字节数，更大的文件视为出错
+ * @param tree 目录树接收缓冲区，用完后 tree_free
+ * @return 出错数量
+ */
+size_t tree_load(const char *host_dir, size_t max_file, host_tree *tree) {
+    tree_init(tree);
+    max_len = max_file;
+    return run(tree, host_dir, load_dir);
+}
+
+/**
+ * 写入时处理一个目录：创建其中的文件和子目录，子目录放回队列
+ */
+static void store_dir(job *work) {
+    // 一个目录的子节点在写入期间不会变，不需要加锁读取
+    const tree_node *nd = &cur_tree->nodes[work->idx];
+    size_t bad = 0;
+    for (int c = nd->first_child; c < nd->first_child + nd->child_cnt; c++) {
+        const tree_node *child = &cur_tree->nodes[c];
+        char *path = join_path(work->path, child->name);
+
+        if (!child->is_file) {
+            if (mkdir(path, 0755) && errno != EEXIST) {
+                printf("%s: %s\n", path, strerror(errno));
+                bad++;
+                free(path);
+                continue;
+            }
+            pthread_mutex_lock(&tree_lock);
+            queue = reserve(queue, &queue_cap, queue_size + 1, sizeof(job));
+            queue[queue_size].idx = c;
+            queue[queue_size++].path = path;
+            pthread_cond_broadcast(&tree_cond);
+            pthread_mutex_unlock(&tree_lock);
+            continue;
+        }
+
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || pwrite_full(fd, child->data, child->len, 0)) {
+            printf("%s: %s\n", path, strerror(errno));
+            bad++;
+        }
+        if (fd >= 0) close(fd);
+        free(path);
+    }
+
+    if (bad) {
+        pthread_mutex_lock(&tree_lock);
+        errors += bad;
+        pthread_mutex_unlock(&tree_lock);
+    }
+}
+
+/**
+ * 多线程把目录树写入宿主机目录，已存在的同名文件被覆盖
+ * @param host_dir 宿主机目录，不存在时创建，对应目录树的根节点
+ * @param tree 目录树
+ * @return 出错数量
+ */
+size_t tree_store(const char *host_dir, const host_tree *tree) {
+    if (mkdir(host_dir, 0755) && errno != EEXIST) {
+        printf("%s: %s\n", host_dir, strerror(errno));
+        return 1;
+    }
+    return run((host_tree *) tree, host_dir, store_dir);
+}
+
+/**
+ * 释放目录树
+ */
+void tree_free(host_tree *tree) {
+    for (size_t i = 0; i < tree->size; i++) free(tree->nodes[i].data);
+    free(tree->nodes);
+    tree->nodes = NULL;
+    tree->size = 0;
+    tree->cap = 0;
+}
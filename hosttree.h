@@ -0,0 +1,41 @@
+#ifndef FILE_SYSTEM_HOSTTREE_H
+#define FILE_SYSTEM_HOSTTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 宿主机目录树与内存目录树之间的批量读写，用于 import / export。
+ * 多个线程从队列中取目录并行处理：读取时每个线程列出一个目录、读入其中的文件，子目录放回队列；
+ * 写入时每个线程创建一个目录下的文件和子目录。一个目录的子节点编号连续，子节点编号总是大于父节点。
+ * 只处理普通文件和目录，其他类型（符号链接、设备等）跳过
+ */
+
+typedef struct tree_node {
+    char name[22];         // 名称（包括扩展名），容纳最长的文件名和扩展名
+    unsigned char is_file; // 0：目录；1：文件
+    uint32_t mtime;        // 修改时间（Unix 时间戳，秒）
+    int parent;            // 所在目录的节点号，根节点为 -1
+    int first_child;       // 目录：第一个子节点号
+    int child_cnt;         // 目录：子节点数量
+    char *data;            // 文件：内容
+    size_t len;            // 文件：字节数
+} tree_node;
+
+typedef struct host_tree {
+    tree_node *nodes; // 所有节点，0 号为根目录
+    size_t size;      // 节点数量
+    size_t cap;       // 节点数组容量
+} host_tree;
+
+void tree_init(host_tree *tree);
+
+int tree_add(host_tree *tree, int parent, size_t n);
+
+size_t tree_load(const char *host_dir, size_t max_file, host_tree *tree);
+
+size_t tree_store(const char *host_dir, const host_tree *tree);
+
+void tree_free(host_tree *tree);
+
+#endif //FILE_SYSTEM_HOSTTREE_H
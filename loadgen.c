@@ -0,0 +1,439 @@
+#include "file_sys.h"
+
+#include <math.h>
+#include <unistd.h>
+
+/*
+ * 宏观负载测试，仿照 fs_mark / filebench：先按目录深度、每个目录的子目录数和文件数、文件大小分布建出目录树，
+ * 再通过库接口按比例混合执行 create / lookup / ls / rm / read / write，运行固定的操作数或时长，
+ * 报告吞吐量、每种操作的延迟分位数、镜像占用率和碎片情况。参数和随机种子相同时操作序列相同，可以对比不同版本：
+ * file_system_loadgen [-o 挂载参数] [-d 深度] [-w 子目录数] [-f 文件数] [-s 大小分布] [-m 操作比例]
+ *                     [-n 操作数] [-t 秒数] [-r 随机种子] [-v]
+ * 大小分布：N（固定）、A-B（均匀）、exp:M（指数分布，均值 M），都不超过 UINT16_MAX
+ * 操作比例：如 "create=20,lookup=20,ls=10,rm=15,read=20,write=15"，没有列出的操作不执行
+ * 没有指定 stripe= 时使用 LOADGEN_DATA_FILE，开始前格式化；-v 同时打印文件系统的输出
+ */
+
+#define LOADGEN_DATA_FILE "./loadgen.data" // 默认数据文件，不使用 REAL_DATA_FILE
+#define LOADGEN_MAX_DEPTH 8                // 最大目录深度
+#define LOADGEN_PATH_MAX 64                // 路径最大长度
+
+enum { OP_CREATE, OP_LOOKUP, OP_LS, OP_RM, OP_READ, OP_WRITE, OP_CNT };
+
+static const char *op_names[OP_CNT] = {"create", "lookup", "ls", "rm", "read", "write"};
+
+#define DIST_FIXED 0   // 固定大小
+#define DIST_UNIFORM 1 // [a, b] 均匀分布
+#define DIST_EXP 2     // 均值为 a 的指数分布
+
+typedef struct size_dist {
+    int kind; // DIST_FIXED / DIST_UNIFORM / DIST_EXP
+    size_t a;
+    size_t b;
+} size_dist;
+
+typedef struct file_ent {
+    char path[LOADGEN_PATH_MAX]; // 文件路径
+    size_t len;                  // 文件字节数
+} file_ent;
+
+typedef struct op_stat {
+    double *lat;   // 每次操作的延迟（微秒）
+    size_t size;   // 操作次数
+    size_t cap;    // lat 容量
+    size_t errors; // 失败次数
+    size_t bytes;  // 读写的字节数
+} op_stat;
+
+static uint64_t rng_state;                     // xorshift64 状态
+static char data[UINT16_MAX];                  // 写入的内容，从中截取
+static char (*dirs)[LOADGEN_PATH_MAX];         // 所有目录的路径，根目录为空串
+static size_t dirs_size;
+static file_ent *files;                        // 当前存在的文件
+static size_t files_size;
+static size_t files_cap;
+static size_t next_id;                         // 下一个新文件的编号
+static op_stat stats[OP_CNT];
+static FILE *report;                           // 报告输出，文件系统的输出重定向后仍打印到终端
+
+/**
+ * 当前单调时钟（秒）
+ */
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * xorshift64 伪随机数，不依赖 libc 的 rand，不同平台上同样的种子得到同样的序列
+ */
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void *xrealloc(void *p, size_t n) {
+    p = realloc(p, n);
+    if (p == NULL) {
+        perror("Loadgen malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/**
+ * 解析大小分布
+ * @return 0：成功；1：格式错误
+ */
+static int parse_dist(const char *s, size_dist *dist) {
+    char *end;
+    if (!strncmp(s, "exp:", 4)) {
+        dist->kind = DIST_EXP;
+        dist->a = strtoul(s + 4, &end, 10);
+        return end == s + 4 || *end != '\0' || dist->a > UINT16_MAX;
+    }
+
+    dist->a = strtoul(s, &end, 10);
+    if (end == s) return 1;
+    if (*end == '\0') {
+        dist->kind = DIST_FIXED;
+        return dist->a > UINT16_MAX;
+    }
+    if (*end != '-') return 1;
+    const char *b = end + 1;
+    dist->kind = DIST_UNIFORM;
+    dist->b = strtoul(b, &end, 10);
+    return end == b || *end != '\0' || dist->a > dist->b || dist->b > UINT16_MAX;
+}
+
+/**
+ * 按分布取一个文件大小
+ */
+static size_t draw_size(const size_dist *dist) {
+    if (dist->kind == DIST_FIXED) return dist->a;
+    if (dist->kind == DIST_UNIFORM) return dist->a + rng() % (dist->b - dist->a + 1);
+
+    double u = (rng() >> 11) / 9007199254740992.0; // [0, 1)
+    double n = -log1p(-u) * (double) dist->a;
+    return n > UINT16_MAX ? UINT16_MAX : (size_t) n;
+}
+
+/**
+ * 解析操作比例，如 "create=20,rm=10"
+ * @return 0：成功；1：格式错误或比例全为 0
+ */
+static int parse_mix(const char *s, unsigned int weights[OP_CNT]) {
+    memset(weights, 0, OP_CNT * sizeof(unsigned int));
+    unsigned int total = 0;
+    while (*s != '\0') {
+        int op = 0;
+        size_t name_len = 0;
+        for (; op < OP_CNT; op++) {
+            name_len = strlen(op_names[op]);
+            if (!strncmp(s, op_names[op], name_len) && s[name_len] == '=') break;
+        }
+        if (op == OP_CNT) return 1;
+
+        char *end;
+        weights[op] = strtoul(s + name_len + 1, &end, 10);
+        if (end == s + name_len + 1 || (*end != ',' && *end != '\0')) return 1;
+        total += weights[op];
+        s = *end == ',' ? end + 1 : end;
+    }
+    return total == 0;
+}
+
+/**
+ * 生成写入的内容：随机单词组成的文本，压缩和去重时都有一定效果
+ */
+static void gen_data(void) {
+    static const char *words[] = {"file", "system", "block", "data", "the", "of", "directory", "fat", "1024"};
+    size_t len = 0;
+    while (len < sizeof(data)) {
+        const char *w = words[rng() % (sizeof(words) / sizeof(words[0]))];
+        for (int i = 0; w[i] != '\0' && len < sizeof(data); i++) data[len++] = w[i];
+        if (len < sizeof(data)) data[len++] = ' ';
+    }
+}
+
+/**
+ * 记录一次操作
+ * @param seconds 延迟（秒）
+ * @param err 是否失败
+ */
+static void record(int op, double seconds, int err, size_t bytes) {
+    op_stat *st = &stats[op];
+    if (st->size == st->cap) {
+        st->cap = st->cap ? st->cap * 2 : 1024;
+        st->lat = xrealloc(st->lat, st->cap * sizeof(double));
+    }
+    st->lat[st->size++] = seconds * 1e6;
+    st->errors += err;
+    st->bytes += bytes;
+}
+
+/**
+ * 在目录中创建一个文件并写入按分布取的字节数，创建后查找一次确认目录项存在，成功时加入文件列表
+ */
+static void op_create(size_t dir, const size_dist *dist) {
+    if (files_size == files_cap) {
+        files_cap = files_cap ? files_cap * 2 : 256;
+        files = xrealloc(files, files_cap * sizeof(file_ent));
+    }
+    file_ent *f = &files[files_size];
+    snprintf(f->path, sizeof(f->path), "%s/f%zu", dirs[dir], next_id++);
+    size_t len = draw_size(dist);
+    char line[16 + LOADGEN_PATH_MAX];
+    snprintf(line, sizeof(line), "%s %s", MY_CREATE, f->path);
+
+    double start = now();
+    fs_exec(line);
+    int err = len && fs_write(f->path, 0, data + rng() % (sizeof(data) - len + 1), len);
+    double seconds = now() - start;
+
+    size_t got;
+    if (fs_read(f->path, 0, NULL, 0, &got)) err = 1; // 目录已满或空间不足，文件没有创建
+    else {
+        f->len = err ? 0 : len;
+        files_size++;
+    }
+    record(OP_CREATE, seconds, err, err ? 0 : len);
+}
+
+/**
+ * 执行一个随机选出的操作，没有文件时改为 create
+ */
+static void run_op(int op, const size_dist *dist, char *buf) {
+    if (op != OP_CREATE && op != OP_LS && files_size == 0) op = OP_CREATE;
+
+    size_t k = files_size ? rng() % files_size : 0;
+    file_ent *f = &files[k];
+    char line[16 + LOADGEN_PATH_MAX];
+    size_t got = 0;
+    double start = now();
+    int err = 0;
+    size_t bytes = 0;
+    switch (op) {
+        case OP_CREATE:
+            op_create(rng() % dirs_size, dist);
+            return;
+        case OP_LOOKUP:
+            err = fs_read(f->path, 0, NULL, 0, &got);
+            break;
+        case OP_LS: {
+            size_t dir = rng() % dirs_size;
+            snprintf(line, sizeof(line), "%s %s", MY_CD, dirs[dir][0] ? dirs[dir] : "/");
+            fs_exec(line);
+            fs_exec(MY_LS " -a");
+            break;
+        }
+        case OP_RM:
+            snprintf(line, sizeof(line), "%s %s", MY_RM, f->path);
+            fs_exec(line);
+            err = !fs_read(f->path, 0, NULL, 0, &got); // 删除后应找不到
+            *f = files[--files_size];
+            break;
+        case OP_READ:
+            err = fs_read(f->path, 0, buf, f->len, &got) || got != f->len;
+            bytes = got;
+            break;
+        case OP_WRITE: { // 在文件中或文件末尾写入一段，可能让文件变长
+            size_t off = rng() % (f->len + 1);
+            size_t n = MIN(MAX(draw_size(dist), 1), UINT16_MAX - off);
+            if (n == 0) {
+                off = 0;
+                n = 1;
+            }
+            err = fs_write(f->path, off, data + rng() % (sizeof(data) - n + 1), n);
+            if (!err) {
+                f->len = MAX(f->len, off + n);
+                bytes = n;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    record(op, now() - start, err, bytes);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * 打印镜像占用率和碎片情况
+ */
+static void print_usage(const char *when) {
+    fs_usage usage;
+    fs_get_usage(&usage);
+    fprintf(report, "%s: used %zu/%zu blocks (%.1f%%), files: %zu, chains: %zu, fragments: %zu, "
+                    "free extents: %zu, largest free: %zu blocks\n", when, usage.used, usage.blocks,
+            usage.used * 100.0 / usage.blocks, files_size, usage.chains, usage.fragments, usage.free_extents,
+            usage.largest_free);
+}
+
+/**
+ * 打印每种操作的次数、吞吐量和延迟分位数
+ */
+static void print_stats(double elapsed) {
+    fprintf(report, "%-8s%10s%8s%12s%10s%10s%10s%10s%10s\n", "op", "count", "errors", "ops/s", "MB/s", "p50(us)",
+            "p90(us)", "p99(us)", "max(us)");
+    size_t total = 0;
+    size_t errors = 0;
+    for (int op = 0; op < OP_CNT; op++) {
+        op_stat *st = &stats[op];
+        total += st->size;
+        errors += st->errors;
+        if (st->size == 0) continue;
+
+        qsort(st->lat, st->size, sizeof(double), cmp_double);
+        double p50 = st->lat[(st->size - 1) * 50 / 100];
+        double p90 = st->lat[(st->size - 1) * 90 / 100];
+        double p99 = st->lat[(st->size - 1) * 99 / 100];
+        fprintf(report, "%-8s%10zu%8zu%12.0f%10.2f%10.1f%10.1f%10.1f%10.1f\n", op_names[op], st->size, st->errors,
+                st->size / elapsed, st->bytes / elapsed / 1e6, p50, p90, p99, st->lat[st->size - 1]);
+    }
+    fprintf(report, "%-8s%10zu%8zu%12.0f\n", "total", total, errors, total / elapsed);
+}
+
+int main(int argc, char *argv[]) {
+    int depth = 2;
+    size_t fanout = 3;
+    size_t files_per_dir = 4;
+    size_dist dist = {DIST_EXP, 600, 0};
+    unsigned int weights[OP_CNT];
+    parse_mix("create=20,lookup=20,ls=10,rm=15,read=20,write=15", weights);
+    size_t max_ops = 10000;
+    double seconds = 0;
+    uint64_t seed = 1;
+    int verbose = 0;
+
+    strcpy(sys_opt.stripe_spec, LOADGEN_DATA_FILE);
+    for (int i = 1; i < argc; i++) {
+        const char *arg = i + 1 < argc ? argv[i + 1] : NULL;
+        char *end = NULL;
+        int bad = 0;
+        if (!strcmp(argv[i], "-v")) {
+            verbose = 1;
+            continue;
+        }
+        if (arg == NULL) bad = 1;
+        else if (!strcmp(argv[i], "-o")) bad = parse_mount_opt(arg);
+        else if (!strcmp(argv[i], "-d")) {
+            depth = (int) strtol(arg, &end, 10);
+            bad = *end != '\0' || depth < 0 || depth > LOADGEN_MAX_DEPTH;
+        } else if (!strcmp(argv[i], "-w")) {
+            fanout = strtoul(arg, &end, 10);
+            bad = *end != '\0' || fanout == 0 || fanout > 1000;
+        } else if (!strcmp(argv[i], "-f")) {
+            files_per_dir = strtoul(arg, &end, 10);
+            bad = *end != '\0';
+        } else if (!strcmp(argv[i], "-s")) bad = parse_dist(arg, &dist);
+        else if (!strcmp(argv[i], "-m")) bad = parse_mix(arg, weights);
+        else if (!strcmp(argv[i], "-n")) {
+            max_ops = strtoul(arg, &end, 10);
+            bad = *end != '\0';
+        } else if (!strcmp(argv[i], "-t")) {
+            seconds = strtod(arg, &end);
+            bad = *end != '\0' || seconds <= 0;
+            if (!bad) max_ops = SIZE_MAX;
+        } else if (!strcmp(argv[i], "-r")) {
+            seed = strtoull(arg, &end, 10);
+            bad = *end != '\0';
+        } else bad = 1;
+
+        if (bad) {
+            printf("Usage: %s [-o option[,option...]] [-d depth] [-w fanout] [-f files] [-s size|min-max|exp:mean] "
+                   "[-m op=weight[,...]] [-n ops] [-t seconds] [-r seed] [-v]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        i++;
+    }
+    rng_state = seed ? seed : 1;
+
+    // 目录路径：广度优先，第 k 层的每个目录有 fanout 个子目录
+    size_t level_size = 1;
+    dirs_size = 1;
+    for (int d = 1; d <= depth; d++) {
+        level_size *= fanout;
+        dirs_size += level_size;
+    }
+    dirs = xrealloc(NULL, dirs_size * sizeof(*dirs));
+    dirs[0][0] = '\0';
+    for (size_t i = 0, next = 1; next < dirs_size; i++) {
+        char parent[LOADGEN_PATH_MAX];
+        strcpy(parent, dirs[i]);
+        for (size_t c = 0; c < fanout && next < dirs_size; c++) {
+            int n = snprintf(dirs[next++], LOADGEN_PATH_MAX, "%s/d%zu", parent, c);
+            if (n < 0 || n >= LOADGEN_PATH_MAX) { // 截断后不同的目录可能同名
+                printf("Directory path too long, reduce depth or fanout\n");
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    gen_data();
+
+    // 报告打印到原来的标准输出，文件系统的输出丢弃
+    fflush(stdout);
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (report == NULL || (!verbose && freopen("/dev/null", "w", stdout) == NULL)) {
+        perror("Loadgen output error!");
+        return EXIT_FAILURE;
+    }
+    setvbuf(report, NULL, _IOLBF, 0);
+
+    start_sys();
+    fs_exec(MY_FORMAT);
+
+    // 建目录树
+    double start = now();
+    char line[16 + LOADGEN_PATH_MAX];
+    for (size_t i = 1; i < dirs_size; i++) {
+        snprintf(line, sizeof(line), "%s %s", MY_MKDIR, dirs[i]);
+        fs_exec(line);
+    }
+    for (size_t i = 0; i < dirs_size; i++) {
+        for (size_t k = 0; k < files_per_dir; k++) op_create(i, &dist);
+    }
+    double build = now() - start;
+    fprintf(report, "build: %zu dirs, %zu files (%zu failed), %.1f ms, %.0f files/s\n", dirs_size - 1, files_size,
+            stats[OP_CREATE].errors, build * 1000, stats[OP_CREATE].size / build);
+    print_usage("after build");
+    for (int op = 0; op < OP_CNT; op++) free(stats[op].lat);
+    memset(stats, 0, sizeof(stats)); // 只统计混合负载
+
+    // 混合负载
+    unsigned int total_weight = 0;
+    for (int op = 0; op < OP_CNT; op++) total_weight += weights[op];
+    char *buf = xrealloc(NULL, UINT16_MAX);
+    size_t ops = 0;
+    start = now();
+    for (; ops < max_ops && (seconds == 0 || now() - start < seconds); ops++) {
+        unsigned int w = rng() % total_weight;
+        int op = 0;
+        while (w >= weights[op]) w -= weights[op++];
+        run_op(op, &dist, buf);
+    }
+    double elapsed = now() - start;
+    fprintf(report, "run: %zu ops, %.1f ms\n", ops, elapsed * 1000);
+    print_stats(elapsed > 0 ? elapsed : 1e-9);
+
+    start = now();
+    fs_exec(MY_SYNC);
+    fprintf(report, "sync: %.1f ms\n", (now() - start) * 1000);
+    print_usage("after run");
+
+    fs_exec(MY_EXITSYS);
+    free(buf);
+    free(files);
+    free(dirs);
+    for (int op = 0; op < OP_CNT; op++) free(stats[op].lat);
+    fclose(report);
+    return 0;
+}
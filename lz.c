@@ -0,0 +1,166 @@
+#include "lz.h"
+
+#include <string.h>
+
+#define LZ_HASH_BITS 10      // 哈希表位数
+#define LZ_MAX_OFFSET 0XFFFF // 最大回溯距离
+
+/**
+ * 计算 4 字节序列的哈希值
+ */
+static unsigned int hash4(const unsigned char *p) {
+    unsigned int v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * 写入超出 token 部分的长度（每字节 255 表示还有下一个字节）
+ * @return 0：成功；1：超出输出缓冲区
+ */
+static int put_len(unsigned char *out, size_t *op_ptr, size_t cap, size_t len) {
+    while (len >= 255) {
+        if (*op_ptr >= cap) return 1;
+        out[(*op_ptr)++] = 255;
+        len -= 255;
+    }
+    if (*op_ptr >= cap) return 1;
+    out[(*op_ptr)++] = (unsigned char) len;
+    return 0;
+}
+
+/**
+ * 写入一个序列
+ * @param mlen 匹配长度，为 0 表示最后一个只有字面量的序列
+ * @return 0：成功；1：超出输出缓冲区
+ */
+static int put_seq(unsigned char *out, size_t *op_ptr, size_t cap,
+                   const unsigned char *lit, size_t lit_len, size_t offset, size_t mlen) {
+    size_t lit_token = lit_len < 15 ? lit_len : 15;
+    size_t match_token = 0;
+    if (mlen) match_token = mlen - LZ_MIN_MATCH < 15 ? mlen - LZ_MIN_MATCH : 15;
+
+    if (*op_ptr >= cap) return 1;
+    out[(*op_ptr)++] = (unsigned char) (lit_token << 4 | match_token);
+    if (lit_token == 15 && put_len(out, op_ptr, cap, lit_len - 15)) return 1;
+
+    if (cap - *op_ptr < lit_len) return 1;
+    memcpy(out + *op_ptr, lit, lit_len);
+    *op_ptr += lit_len;
+
+    if (mlen == 0) return 0; // 最后一个序列
+
+    if (cap - *op_ptr < 2) return 1;
+    out[(*op_ptr)++] = (unsigned char) (offset & 0XFF);
+    out[(*op_ptr)++] = (unsigned char) (offset >> 8);
+    if (match_token == 15 && put_len(out, op_ptr, cap, mlen - LZ_MIN_MATCH - 15)) return 1;
+
+    return 0;
+}
+
+/**
+ * 压缩数据
+ * @param src 原始数据
+ * @param n 原始数据字节数，不超过 LZ_MAX_INPUT
+ * @param dest 输出缓冲区
+ * @param cap 输出缓冲区大小
+ * @return 压缩后的字节数；0：输出缓冲区放不下（数据不可压缩）
+ */
+size_t lz_compress(const void *src, size_t n, void *dest, size_t cap) {
+    const unsigned char *in = src;
+    unsigned char *out = dest;
+    unsigned short table[1 << LZ_HASH_BITS]; // 位置 + 1，0 表示空位
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+
+    if (n == 0 || n > LZ_MAX_INPUT) return 0;
+
+    memset(table, 0, sizeof(table));
+
+    while (ip + LZ_MIN_MATCH <= n) {
+        unsigned int h = hash4(in + ip);
+        size_t cand = table[h] - 1;
+        int hit = table[h] != 0;
+        table[h] = (unsigned short) (ip + 1);
+
+        if (hit && ip - cand <= LZ_MAX_OFFSET && !memcmp(in + cand, in + ip, LZ_MIN_MATCH)) {
+            size_t mlen = LZ_MIN_MATCH;
+            while (ip + mlen < n && in[cand + mlen] == in[ip + mlen]) mlen++;
+
+            if (put_seq(out, &op, cap, in + anchor, ip - anchor, ip - cand, mlen)) return 0;
+
+            ip += mlen;
+            anchor = ip;
+        } else ip++;
+    }
+
+    // 剩余字面量
+    if (put_seq(out, &op, cap, in + anchor, n - anchor, 0, 0)) return 0;
+
+    return op;
+}
+
+/**
+ * 解压数据，会校验输入是否越界
+ * @param src 压缩数据
+ * @param n 压缩数据字节数
+ * @param dest 输出缓冲区
+ * @param cap 输出缓冲区大小
+ * @return 解压后的字节数；0：压缩数据损坏
+ */
+size_t lz_decompress(const void *src, size_t n, void *dest, size_t cap) {
+    const unsigned char *in = src;
+    unsigned char *out = dest;
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < n) {
+        unsigned char token = in[ip++];
+
+        // 字面量
+        size_t lit_len = token >> 4;
+        if (lit_len == 15) {
+            unsigned char b;
+            do {
+                if (ip >= n) return 0;
+                b = in[ip++];
+                lit_len += b;
+            } while (b == 255);
+        }
+        if (n - ip < lit_len || cap - op < lit_len) return 0;
+        memcpy(out + op, in + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == n) break; // 最后一个序列
+
+        // 匹配
+        if (n - ip < 2) return 0;
+        size_t offset = in[ip] | (size_t) in[ip + 1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > op) return 0;
+
+        size_t mlen = token & 0X0F;
+        if (mlen == 15) {
+            unsigned char b;
+            do {
+                if (ip >= n) return 0;
+                b = in[ip++];
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ_MIN_MATCH;
+        if (cap - op < mlen) return 0;
+
+        // 重叠时按周期分段复制，已复制部分以 offset 为周期重复，每段长度可以翻倍
+        for (size_t k = 0; k < mlen;) {
+            size_t chunk = offset + k < mlen - k ? offset + k : mlen - k;
+            memcpy(out + op + k, out + op - offset, chunk);
+            k += chunk;
+        }
+        op += mlen;
+    }
+
+    return op;
+}
@@ -0,0 +1,22 @@
+#ifndef FILE_SYSTEM_LZ_H
+#define FILE_SYSTEM_LZ_H
+
+#include <stddef.h>
+
+/*
+ * 块内 LZ 压缩编码（LZ4 风格），每个序列格式：
+ * +-------+-------------------+----------+------------+-------------------+
+ * | token | [literal len ...] | literals | offset(2B) | [match len ...]   |
+ * +-------+-------------------+----------+------------+-------------------+
+ * token 高 4 位为字面量长度，低 4 位为匹配长度 - LZ_MIN_MATCH，取值 15 时后续字节继续累加（255 表示还有下一个字节）
+ * 最后一个序列只有字面量，没有 offset 和匹配长度
+ */
+
+#define LZ_MIN_MATCH 4      // 最短匹配长度
+#define LZ_MAX_INPUT 0XFFFE // 单次压缩的最大输入字节数
+
+size_t lz_compress(const void *src, size_t n, void *dest, size_t cap);
+
+size_t lz_decompress(const void *src, size_t n, void *dest, size_t cap);
+
+#endif //FILE_SYSTEM_LZ_H
@@ -1,6 +1,16 @@
 #include "file_sys.h"
 
-int main(void) {
+int main(int argc, char *argv[]) {
+    // 解析挂载参数，如 "-o compress"
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            if (parse_mount_opt(argv[++i])) return EXIT_FAILURE;
+        } else {
+            printf("Usage: %s [-o option[,option...]]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
     // 初始化
     start_sys();
 
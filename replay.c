@@ -0,0 +1,239 @@
+#include "file_sys.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+/*
+ * 重放 trace record 记录的命令轨迹，把真实的操作序列变成回归基准：
+ * file_system_replay [-o 挂载参数] [-T] [-k] [-v] <轨迹文件>
+ * 数据文件（stripe= 指定，默认 REAL_DATA_FILE）先复制一份，在副本上从记录时的当前目录开始逐条执行命令，
+ * 原来的数据文件不修改。默认尽快执行，-T 按记录时的间隔执行。报告每种命令的次数、重放延迟的分位数
+ * 以及记录时的延迟，便于对比；-k 保留副本，-v 同时打印文件系统的输出。
+ * 要得到与记录时相同的结果，数据文件应当是开始记录时的状态，例如在 trace record 之前复制一份
+ */
+
+#define REPLAY_SUFFIX ".replay" // 副本文件名后缀
+
+typedef struct cmd_stat {
+    char name[16]; // 命令名
+    double *lat;   // 每次重放的延迟（微秒）
+    double *rec;   // 记录时的延迟（微秒）
+    size_t size;
+    size_t cap;
+} cmd_stat;
+
+static cmd_stat *stats;
+static size_t stats_size;
+static FILE *report; // 报告输出，文件系统的输出重定向后仍打印到终端
+
+static void *xrealloc(void *p, size_t n) {
+    p = realloc(p, n);
+    if (p == NULL) {
+        perror("Replay malloc error!");
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/**
+ * 复制数据文件
+ * @return 0：成功；1：出错，已打印原因
+ */
+static int copy_file(const char *src, const char *dst) {
+    FILE *in = fopen(src, "rb");
+    if (in == NULL) {
+        printf("%s: %s\n", src, strerror(errno));
+        return 1;
+    }
+    FILE *out = fopen(dst, "wb");
+    if (out == NULL) {
+        printf("%s: %s\n", dst, strerror(errno));
+        fclose(in);
+        return 1;
+    }
+
+    char buf[64 * 1024];
+    size_t n;
+    int err = 0;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0 && !err) err = fwrite(buf, 1, n, out) != n;
+    err |= ferror(in);
+    fclose(in);
+    err |= fclose(out) != 0;
+    if (err) printf("%s: Copy failed\n", dst);
+    return err;
+}
+
+/**
+ * 复制卷的所有数据文件，副本列表替换 sys_opt.stripe_spec
+ * @return 0：成功；1：出错，已打印原因
+ */
+static int copy_volume(void) {
+    char src[STRIPE_SPEC_MAX];
+    char dst[STRIPE_SPEC_MAX] = "";
+    snprintf(src, sizeof(src), "%s", sys_opt.stripe_spec[0] != '\0' ? sys_opt.stripe_spec : REAL_DATA_FILE);
+
+    size_t dst_len = 0;
+    for (char *p = strtok(src, ":"); p != NULL; p = strtok(NULL, ":")) {
+        int n = snprintf(dst + dst_len, sizeof(dst) - dst_len, "%s%s" REPLAY_SUFFIX, dst_len ? ":" : "", p);
+        if (n < 0 || (size_t) n >= sizeof(dst) - dst_len) {
+            printf("Data file list too long\n");
+            return 1;
+        }
+        if (copy_file(p, dst + dst_len + (dst_len ? 1 : 0))) return 1;
+        dst_len += n;
+    }
+    strcpy(sys_opt.stripe_spec, dst);
+    return 0;
+}
+
+/**
+ * 删除副本
+ */
+static void remove_volume(void) {
+    for (char *p = strtok(sys_opt.stripe_spec, ":"); p != NULL; p = strtok(NULL, ":")) unlink(p);
+}
+
+/**
+ * 记录一条命令的延迟，按命令名归类
+ */
+static void record(const char *line, double lat, double rec) {
+    char name[16];
+    size_t name_len = strcspn(line + strspn(line, " "), " ");
+    snprintf(name, sizeof(name), "%.*s", (int) name_len, line + strspn(line, " "));
+
+    size_t k = 0;
+    while (k < stats_size && strcmp(stats[k].name, name) != 0) k++;
+    if (k == stats_size) {
+        stats = xrealloc(stats, ++stats_size * sizeof(cmd_stat));
+        memset(&stats[k], 0, sizeof(cmd_stat));
+        strcpy(stats[k].name, name);
+    }
+
+    cmd_stat *st = &stats[k];
+    if (st->size == st->cap) {
+        st->cap = st->cap ? st->cap * 2 : 256;
+        st->lat = xrealloc(st->lat, st->cap * sizeof(double));
+        st->rec = xrealloc(st->rec, st->cap * sizeof(double));
+    }
+    st->lat[st->size] = lat;
+    st->rec[st->size++] = rec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t n, int p) {
+    return sorted[(n - 1) * p / 100];
+}
+
+/**
+ * 打印每种命令的次数、重放延迟分位数和记录时的延迟分位数
+ */
+static void print_stats(void) {
+    fprintf(report, "%-10s%8s%10s%10s%10s%10s%12s%12s\n", "command", "count", "p50(us)", "p90(us)", "p99(us)",
+            "max(us)", "rec p50", "rec p99");
+    for (size_t k = 0; k < stats_size; k++) {
+        cmd_stat *st = &stats[k];
+        qsort(st->lat, st->size, sizeof(double), cmp_double);
+        qsort(st->rec, st->size, sizeof(double), cmp_double);
+        fprintf(report, "%-10s%8zu%10.1f%10.1f%10.1f%10.1f%12.1f%12.1f\n", st->name, st->size,
+                percentile(st->lat, st->size, 50), percentile(st->lat, st->size, 90),
+                percentile(st->lat, st->size, 99), st->lat[st->size - 1], percentile(st->rec, st->size, 50),
+                percentile(st->rec, st->size, 99));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int timed = 0;
+    int keep = 0;
+    int verbose = 0;
+    const char *trace_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        int bad = 0;
+        if (!strcmp(argv[i], "-T")) timed = 1;
+        else if (!strcmp(argv[i], "-k")) keep = 1;
+        else if (!strcmp(argv[i], "-v")) verbose = 1;
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc) bad = parse_mount_opt(argv[++i]);
+        else if (argv[i][0] != '-' && trace_path == NULL) trace_path = argv[i];
+        else bad = 1;
+
+        if (bad) {
+            trace_path = NULL;
+            break;
+        }
+    }
+    if (trace_path == NULL) {
+        printf("Usage: %s [-o option[,option...]] [-T] [-k] [-v] <trace file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    trace_reader reader;
+    if (trace_open(trace_path, &reader)) return EXIT_FAILURE;
+    if (copy_volume()) {
+        trace_close(&reader);
+        return EXIT_FAILURE;
+    }
+
+    // 报告打印到原来的标准输出，文件系统的输出丢弃
+    fflush(stdout);
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    if (report == NULL || (!verbose && freopen("/dev/null", "w", stdout) == NULL)) {
+        perror("Replay output error!");
+        return EXIT_FAILURE;
+    }
+    setvbuf(report, NULL, _IOLBF, 0);
+
+    time_t started = (time_t) (reader.started / 1000000000u);
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&started));
+    fprintf(report, "trace: %s, recorded %s, cwd %s, %s\n", trace_path, when, reader.cwd,
+            timed ? "original timing" : "as fast as possible");
+
+    start_sys();
+    char line[16 + sizeof(reader.cwd)];
+    snprintf(line, sizeof(line), "%s %s", MY_CD, reader.cwd);
+    fs_exec(line);
+
+    // 逐条执行，-T 时等到记录时的相对时间再执行，落后时立即执行
+    trace_rec rec;
+    size_t count = 0;
+    uint64_t late = 0; // 最大的落后时间
+    uint64_t start = trace_now();
+    while (!trace_next(&reader, &rec)) {
+        if (timed) {
+            uint64_t due = start + rec.at;
+            uint64_t now = trace_now();
+            if (now < due) {
+                struct timespec ts = {(time_t) ((due - now) / 1000000000u), (long) ((due - now) % 1000000000u)};
+                while (nanosleep(&ts, &ts) && errno == EINTR);
+            } else late = MAX(late, now - due);
+        }
+
+        uint64_t t = trace_now();
+        if (fs_exec(rec.line)) break; // 轨迹中不会有退出命令
+        record(rec.line, (trace_now() - t) / 1e3, rec.took / 1e3);
+        count++;
+    }
+    double elapsed = (trace_now() - start) / 1e9;
+    trace_close(&reader);
+
+    fprintf(report, "replay: %zu commands, %.1f ms, %.0f commands/s", count, elapsed * 1000,
+            count / (elapsed > 0 ? elapsed : 1e-9));
+    if (timed) fprintf(report, ", max lag: %.1f ms", late / 1e6);
+    fprintf(report, "\n");
+    if (count) print_stats();
+
+    fs_exec(MY_EXITSYS);
+    if (!keep) remove_volume();
+    for (size_t k = 0; k < stats_size; k++) {
+        free(stats[k].lat);
+        free(stats[k].rec);
+    }
+    free(stats);
+    fclose(report);
+    return 0;
+}
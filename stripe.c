@@ -0,0 +1,311 @@
+#define _GNU_SOURCE // fallocate
+
+#include "stripe.h"
+#include "aio.h"
+#include "file_sys.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static int fds[STRIPE_MAX]; // 后备文件，按在卷中的序号排列
+static size_t fds_size;     // 后备文件数
+static size_t area_size;    // 每个后备文件中盘块区域的字节数，第一个文件的侧表紧随其后
+
+/**
+ * 找到盘块所在的后备文件
+ * @param block 盘块号
+ * @param off_ptr 盘块在后备文件中的偏移量的接收缓冲区
+ * @param run_ptr 从该盘块开始在后备文件中连续存放的盘块数的接收缓冲区
+ * @return 后备文件序号
+ */
+static size_t locate(size_t block, size_t *off_ptr, size_t *run_ptr) {
+    if (fds_size == 1) {
+        *off_ptr = block * BLOCK_SIZE;
+        *run_ptr = BLOCK_ASSET - block;
+        return 0;
+    }
+
+    size_t unit = block / STRIPE_UNIT;
+    *off_ptr = (unit / fds_size * STRIPE_UNIT + block % STRIPE_UNIT) * BLOCK_SIZE;
+    *run_ptr = STRIPE_UNIT - block % STRIPE_UNIT;
+    return unit % fds_size;
+}
+
+/**
+ * 打开卷的所有后备文件，全部为空时格式化为新卷：只有一个文件时与单文件数据文件相同，
+ * 多个文件时每个文件写入 stripe_hdr。已有的卷检查文件数、顺序和卷标识是否一致
+ * @param spec 后备文件列表，以 ':' 分隔，NULL 或空串表示 REAL_DATA_FILE
+ * @param oflag O_RDONLY / O_RDWR，带 O_CREAT 时不存在的文件被创建，全部为空时格式化；否则文件必须存在且不为空
+ * @param is_new_ptr 是否为新卷的接收缓冲区，新卷需要调用者格式化文件系统
+ * @return 0：成功；1：出错，已打印原因
+ */
+int stripe_open(const char *spec, int oflag, int *is_new_ptr) {
+    char *list = strdup(spec != NULL && spec[0] != '\0' ? spec : REAL_DATA_FILE);
+    if (list == NULL) {
+        perror("Stripe malloc error!");
+        exit(EXIT_FAILURE);
+    }
+
+    // 拆分文件列表，多出一项用于检查文件数是否超过上限
+    char *paths[STRIPE_MAX + 1];
+    size_t n = 0;
+    for (char *p = list; n <= STRIPE_MAX;) {
+        paths[n++] = p;
+        p = strchr(p, ':');
+        if (p == NULL) break;
+        *p++ = '\0';
+    }
+    int err = 0;
+    if (n > STRIPE_MAX) {
+        printf("Too many data files, at most %d\n", STRIPE_MAX);
+        err = 1;
+    }
+    for (size_t i = 0; i < n && !err; i++) {
+        if (paths[i][0] == '\0') {
+            printf("Empty data file name\n");
+            err = 1;
+        }
+    }
+    if (err) {
+        free(list);
+        return 1;
+    }
+
+    size_t units = (BLOCK_ASSET + STRIPE_UNIT - 1) / STRIPE_UNIT;
+    area_size = n == 1 ? DIST_SIZE : (units + n - 1) / n * STRIPE_UNIT * BLOCK_SIZE;
+    size_t file_size = area_size + SIDE_SIZE + (n > 1 ? sizeof(stripe_hdr) : 0);
+
+    // 打开所有文件，空文件是新文件，其余文件检查末尾的 stripe_hdr
+    size_t opened = 0;
+    size_t new_cnt = 0;
+    uint64_t volume = 0;
+    for (; opened < n && !err; opened++) {
+        struct stat st;
+        fds[opened] = open(paths[opened], oflag, 0644);
+        if (fds[opened] < 0 || fstat(fds[opened], &st)) {
+            printf("%s: %s\n", paths[opened], strerror(errno));
+            if (fds[opened] >= 0) close(fds[opened]);
+            err = 1;
+            break;
+        }
+        if (st.st_size == 0) {
+            new_cnt++;
+            continue;
+        }
+
+        stripe_hdr hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        if ((size_t) st.st_size >= sizeof(hdr)) pread_full(fds[opened], &hdr, sizeof(hdr), st.st_size - sizeof(hdr));
+        int striped = !memcmp(hdr.magic, STRIPE_MAGIC, sizeof(hdr.magic)) && hdr.count > 1;
+        if (n == 1 && striped) {
+            printf("%s: File %u of a volume striped over %u files\n", paths[opened], hdr.index + 1, hdr.count);
+            err = 1;
+        } else if (n == 1 && (size_t) st.st_size < DIST_SIZE) {
+            printf("Data file size mismatch\n");
+            err = 1;
+        } else if (n > 1 && (!striped || hdr.count != n || hdr.index != opened || (size_t) st.st_size != file_size ||
+                             (volume && hdr.volume != volume))) {
+            printf("%s: Not file %zu of this striped volume\n", paths[opened], opened + 1);
+            err = 1;
+        }
+        volume = hdr.volume;
+    }
+    if (!err && new_cnt && (new_cnt < n || !(oflag & O_CREAT))) {
+        printf(n == 1 ? "Data file size mismatch\n" : "Striped volume incomplete\n");
+        err = 1;
+    }
+
+    // 新卷：文件大小固定，全部是空洞，多个文件时在末尾写入 stripe_hdr
+    if (!err && new_cnt) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        volume = (uint64_t) now.tv_sec << 32 ^ (uint64_t) now.tv_nsec ^ (uint64_t) getpid() << 16;
+        for (size_t i = 0; i < n && !err; i++) {
+            stripe_hdr hdr = {STRIPE_MAGIC, (uint32_t) n, (uint32_t) i, 0, volume};
+            if (ftruncate(fds[i], (off_t) file_size) ||
+                (n > 1 && pwrite_full(fds[i], &hdr, sizeof(hdr), file_size - sizeof(hdr)))) {
+                printf("%s: %s\n", paths[i], strerror(errno));
+                err = 1;
+            }
+        }
+    }
+
+    free(list);
+    if (err) {
+        for (size_t i = 0; i < opened; i++) close(fds[i]);
+        return 1;
+    }
+    fds_size = n;
+    *is_new_ptr = new_cnt > 0;
+    return 0;
+}
+
+/**
+ * 卷的后备文件数
+ */
+size_t stripe_count(void) {
+    return fds_size;
+}
+
+/**
+ * 侧表所在的后备文件
+ * @param off_ptr 侧表在文件中的偏移量的接收缓冲区
+ * @return 文件描述符
+ */
+int stripe_side(size_t *off_ptr) {
+    *off_ptr = area_size;
+    return fds[0];
+}
+
+/**
+ * 同步读取连续的 n 个盘块
+ * @return 0：成功；1：读取出错
+ */
+int stripe_pread(void *buf, unsigned short first, size_t n) {
+    for (size_t done = 0; done < n;) {
+        size_t off, run;
+        size_t s = locate(first + done, &off, &run);
+        run = MIN(run, n - done);
+        if (pread_full(fds[s], (char *) buf + done * BLOCK_SIZE, run * BLOCK_SIZE, off)) return 1;
+        done += run;
+    }
+    return 0;
+}
+
+/**
+ * 同步写入连续的 n 个盘块
+ * @return 0：成功；1：写入出错
+ */
+int stripe_pwrite(const void *buf, unsigned short first, size_t n) {
+    for (size_t done = 0; done < n;) {
+        size_t off, run;
+        size_t s = locate(first + done, &off, &run);
+        run = MIN(run, n - done);
+        if (pwrite_full(fds[s], (const char *) buf + done * BLOCK_SIZE, run * BLOCK_SIZE, off)) return 1;
+        done += run;
+    }
+    return 0;
+}
+
+/**
+ * 排队读取连续的 n 个盘块，按条带单元拆成多个请求，不同文件上的请求同时在途，由调用者 aio_wait
+ */
+void stripe_read(aio_ctx *ctx, void *buf, unsigned short first, size_t n) {
+    for (size_t done = 0; done < n;) {
+        size_t off, run;
+        size_t s = locate(first + done, &off, &run);
+        run = MIN(MIN(run, n - done), AIO_CHUNK_BLOCKS);
+        aio_read(ctx, fds[s], (char *) buf + done * BLOCK_SIZE, run * BLOCK_SIZE, off);
+        done += run;
+    }
+}
+
+/**
+ * 排队写入连续的 n 个盘块，拆分方式同 stripe_read，缓冲区在 aio_wait 返回之前不能修改
+ */
+void stripe_write(aio_ctx *ctx, const void *buf, unsigned short first, size_t n) {
+    for (size_t done = 0; done < n;) {
+        size_t off, run;
+        size_t s = locate(first + done, &off, &run);
+        run = MIN(MIN(run, n - done), AIO_CHUNK_BLOCKS);
+        aio_write(ctx, fds[s], (const char *) buf + done * BLOCK_SIZE, run * BLOCK_SIZE, off);
+        done += run;
+    }
+}
+
+/**
+ * 盘块只保留前 n 字节：其余部分打洞，不支持打洞时返回 1，由调用者写入补零的尾部
+ */
+static int punch_tail(size_t s, size_t off, size_t n) {
+    if (n == BLOCK_SIZE) return 0;
+    return fallocate(fds[s], FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) (off + n), (off_t) (BLOCK_SIZE - n)) != 0;
+}
+
+/**
+ * 同步写入一个盘块的前 n 字节，其余部分打洞，用于压缩块
+ * @param buf 盘块数据，BLOCK_SIZE 字节，n 之后已补零
+ * @return 0：成功；1：写入出错
+ */
+int stripe_pwrite_head(const void *buf, unsigned short block, size_t n) {
+    size_t off, run;
+    size_t s = locate(block, &off, &run);
+    if (n && pwrite_full(fds[s], buf, n, off)) return 1;
+    if (punch_tail(s, off, n)) return pwrite_full(fds[s], (const char *) buf + n, BLOCK_SIZE - n, off + n);
+    return 0;
+}
+
+/**
+ * 排队写入一个盘块的前 n 字节，其余部分打洞，不支持打洞时把补零的尾部也排队写入。
+ * 缓冲区同 stripe_write，在 aio_wait 返回之前不能修改
+ */
+void stripe_write_head(aio_ctx *ctx, const void *buf, unsigned short block, size_t n) {
+    size_t off, run;
+    size_t s = locate(block, &off, &run);
+    if (n) aio_write(ctx, fds[s], buf, n, off);
+    if (punch_tail(s, off, n)) aio_write(ctx, fds[s], (const char *) buf + n, BLOCK_SIZE - n, off + n);
+}
+
+/**
+ * 所有后备文件同时落盘，等待全部完成
+ * @return 0：成功；1：出错
+ */
+int stripe_sync(aio_ctx *ctx) {
+    for (size_t i = 0; i < fds_size; i++) aio_fsync(ctx, fds[i]);
+    return aio_wait(ctx);
+}
+
+/**
+ * 释放连续的 n 个盘块在后备文件中占用的空间，文件系统不支持打洞时保留旧数据
+ */
+void stripe_punch(unsigned short first, size_t n) {
+    for (size_t done = 0; done < n;) {
+        size_t off, run;
+        size_t s = locate(first + done, &off, &run);
+        run = MIN(run, n - done);
+        fallocate(fds[s], FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) off, (off_t) (run * BLOCK_SIZE));
+        done += run;
+    }
+}
+
+/**
+ * 关闭所有后备文件
+ * @return 0：成功；1：有文件关闭出错
+ */
+int stripe_close(void) {
+    int err = 0;
+    for (size_t i = 0; i < fds_size; i++) err |= close(fds[i]) != 0;
+    fds_size = 0;
+    return err;
+}
+
+/**
+ * 从文件指定位置读取 n 个字节，处理部分读取的情况
+ * @return 0：成功；1：读取出错或文件长度不足
+ */
+int pread_full(int fd, void *buf, size_t n, size_t off) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t res = pread(fd, (char *) buf + done, n - done, (off_t) (off + done));
+        if (res < 0 && errno == EINTR) continue;
+        if (res <= 0) return 1;
+        done += res;
+    }
+    return 0;
+}
+
+/**
+ * 向文件指定位置写入 n 个字节，处理部分写入的情况
+ * @return 0：成功；1：写入出错
+ */
+int pwrite_full(int fd, const void *buf, size_t n, size_t off) {
+    size_t done = 0;
+    while (done < n) {
+        ssize_t res = pwrite(fd, (const char *) buf + done, n - done, (off_t) (off + done));
+        if (res < 0 && errno == EINTR) continue;
+        if (res < 0) return 1;
+        done += res;
+    }
+    return 0;
+}
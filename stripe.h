@@ -0,0 +1,53 @@
+#ifndef FILE_SYSTEM_STRIPE_H
+#define FILE_SYSTEM_STRIPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * 条带化的数据文件：卷可以分布在多个后备文件上（最好在不同的磁盘上），按 RAID-0 方式以 STRIPE_UNIT 个盘块为一个
+ * 条带单元轮流存放，第 k 个条带单元放在第 k % n 个文件的第 k / n 行。侧表只放在第一个文件的盘块区域之后，
+ * 其他文件的同一位置是空洞。多个文件时每个文件末尾有一个 stripe_hdr，挂载时检查这些文件是否属于同一个卷、顺序是否正确。
+ * 只有一个文件时布局与单文件数据文件完全相同，没有 stripe_hdr。
+ * 加载、回写和预读按条带单元拆成多个异步请求，所有文件上的请求同时在途
+ */
+
+#define STRIPE_MAX 16      // 最多的后备文件数
+#define STRIPE_UNIT 8      // 条带单元的盘块数
+#define STRIPE_MAGIC "FSSP" // stripe_hdr 魔数
+
+typedef struct stripe_hdr {
+    char magic[4];   // 魔数，STRIPE_MAGIC
+    uint32_t count;  // 卷的后备文件数
+    uint32_t index;  // 本文件在卷中的序号
+    uint32_t pad;
+    uint64_t volume; // 卷标识，格式化时生成，同一个卷的文件相同
+} stripe_hdr;
+
+typedef struct aio_ctx aio_ctx;
+
+int stripe_open(const char *spec, int oflag, int *is_new_ptr);
+
+size_t stripe_count(void);
+
+int stripe_side(size_t *off_ptr);
+
+int stripe_pread(void *buf, unsigned short first, size_t n);
+
+int stripe_pwrite(const void *buf, unsigned short first, size_t n);
+
+void stripe_read(aio_ctx *ctx, void *buf, unsigned short first, size_t n);
+
+void stripe_write(aio_ctx *ctx, const void *buf, unsigned short first, size_t n);
+
+int stripe_pwrite_head(const void *buf, unsigned short block, size_t n);
+
+void stripe_write_head(aio_ctx *ctx, const void *buf, unsigned short block, size_t n);
+
+int stripe_sync(aio_ctx *ctx);
+
+void stripe_punch(unsigned short first, size_t n);
+
+int stripe_close(void);
+
+#endif //FILE_SYSTEM_STRIPE_H
@@ -0,0 +1,182 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+static FILE *out;        // 正在记录的轨迹文件，NULL 表示没有记录
+static uint64_t t0;      // 开始记录的单调时间
+static uint64_t last;    // 上一条命令开始的单调时间
+static size_t out_count; // 已记录的命令数
+
+/**
+ * 当前单调时钟（纳秒）
+ */
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static void put_varint(FILE *f, uint64_t v) {
+    while (v >= 0x80) {
+        putc((int) (v & 0x7f) | 0x80, f);
+        v >>= 7;
+    }
+    putc((int) v, f);
+}
+
+/**
+ * @return 0：成功；1：文件结束或格式错误
+ */
+static int get_varint(FILE *f, uint64_t *v_ptr) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(f);
+        if (c == EOF) return 1;
+        v |= (uint64_t) (c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *v_ptr = v;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void put_str(FILE *f, const char *s) {
+    size_t n = strlen(s);
+    put_varint(f, n);
+    fwrite(s, 1, n, f);
+}
+
+/**
+ * @param s 接收缓冲区，256 字节
+ * @return 0：成功；1：文件结束或格式错误
+ */
+static int get_str(FILE *f, char s[256]) {
+    uint64_t n;
+    if (get_varint(f, &n) || n > 255 || fread(s, 1, n, f) != n) return 1;
+    s[n] = '\0';
+    return 0;
+}
+
+/**
+ * 开始记录轨迹，已有的文件被覆盖
+ * @param cwd 当前目录，重放时从这里开始
+ * @return 0：成功；1：已经在记录或文件打开失败，已打印原因
+ */
+int trace_start(const char *path, const char *cwd) {
+    if (out != NULL) {
+        printf("Trace already recording\n");
+        return 1;
+    }
+    out = fopen(path, "wb");
+    if (out == NULL) {
+        printf("%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), out);
+    putc(TRACE_VERSION, out);
+    put_varint(out, (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec);
+    put_str(out, cwd);
+    t0 = last = trace_now();
+    out_count = 0;
+    return 0;
+}
+
+/**
+ * 是否正在记录轨迹
+ */
+int trace_active(void) {
+    return out != NULL;
+}
+
+/**
+ * 记录一条命令，没有在记录时什么也不做
+ * @param line 命令，不含换行符
+ * @param start 命令开始执行的单调时间（trace_now）
+ * @param took 执行耗时（纳秒）
+ */
+void trace_log(const char *line, uint64_t start, uint64_t took) {
+    if (out == NULL) return;
+
+    put_varint(out, start - last);
+    put_varint(out, took);
+    put_str(out, line);
+    last = start;
+    out_count++;
+}
+
+/**
+ * 停止记录并关闭轨迹文件
+ * @param count_ptr 记录的命令数的接收缓冲区，可以为 NULL
+ * @return 0：成功；1：没有在记录或写入出错，已打印原因
+ */
+int trace_stop(size_t *count_ptr) {
+    if (out == NULL) {
+        printf("Trace not recording\n");
+        return 1;
+    }
+
+    int err = ferror(out) | fclose(out);
+    out = NULL;
+    if (count_ptr != NULL) *count_ptr = out_count;
+    if (err) printf("Trace write error\n");
+    return err != 0;
+}
+
+/**
+ * 打开轨迹文件并读取头部
+ * @return 0：成功；1：打开失败或不是轨迹文件，已打印原因
+ */
+int trace_open(const char *path, trace_reader *reader) {
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        printf("%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    char magic[4];
+    if (fread(magic, 1, sizeof(magic), reader->file) != sizeof(magic) ||
+        memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        printf("%s: Not a trace file\n", path);
+        trace_close(reader);
+        return 1;
+    }
+    int version = getc(reader->file);
+    if (version != TRACE_VERSION) {
+        printf("%s: Unsupported trace version %d\n", path, version);
+        trace_close(reader);
+        return 1;
+    }
+    if (get_varint(reader->file, &reader->started) || get_str(reader->file, reader->cwd)) {
+        printf("%s: Trace file truncated\n", path);
+        trace_close(reader);
+        return 1;
+    }
+    reader->at = 0;
+    return 0;
+}
+
+/**
+ * 读取下一条命令
+ * @return 0：成功；1：没有更多命令，文件末尾不完整的记录被忽略
+ */
+int trace_next(trace_reader *reader, trace_rec *rec) {
+    uint64_t gap;
+    if (get_varint(reader->file, &gap) || get_varint(reader->file, &rec->took) ||
+        get_str(reader->file, rec->line))
+        return 1;
+
+    reader->at += gap;
+    rec->at = reader->at;
+    return 0;
+}
+
+void trace_close(trace_reader *reader) {
+    if (reader->file != NULL) fclose(reader->file);
+    reader->file = NULL;
+}
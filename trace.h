@@ -0,0 +1,47 @@
+#ifndef FILE_SYSTEM_TRACE_H
+#define FILE_SYSTEM_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * 命令轨迹：记录命令行执行过的每条命令和时间，用于重放。文件格式：
+ *   头部：TRACE_MAGIC，版本（1 字节），开始记录时的时间（CLOCK_REALTIME 纳秒，varint），
+ *         开始记录时的当前目录（varint 长度 + 字节）
+ *   记录：与上一条命令开始时间的间隔（纳秒，varint），执行耗时（纳秒，varint），命令（varint 长度 + 字节，不含换行符）
+ * varint 为 LEB128，每字节低 7 位有效，最高位表示后面还有字节，一条短命令的记录通常只有十几个字节
+ */
+
+#define TRACE_MAGIC "FSTR" // 轨迹文件魔数
+#define TRACE_VERSION 1    // 轨迹文件格式版本
+
+typedef struct trace_rec {
+    uint64_t at;    // 距开始记录的时间（纳秒）
+    uint64_t took;  // 录制时的执行耗时（纳秒）
+    char line[256]; // 命令
+} trace_rec;
+
+typedef struct trace_reader {
+    FILE *file;
+    uint64_t started; // 开始记录时的时间（CLOCK_REALTIME 纳秒）
+    char cwd[256];    // 开始记录时的当前目录
+    uint64_t at;      // 上一条命令距开始记录的时间
+} trace_reader;
+
+uint64_t trace_now(void);
+
+int trace_start(const char *path, const char *cwd);
+
+int trace_active(void);
+
+void trace_log(const char *line, uint64_t start, uint64_t took);
+
+int trace_stop(size_t *count_ptr);
+
+int trace_open(const char *path, trace_reader *reader);
+
+int trace_next(trace_reader *reader, trace_rec *rec);
+
+void trace_close(trace_reader *reader);
+
+#endif //FILE_SYSTEM_TRACE_H
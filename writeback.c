@@ -0,0 +1,296 @@
+#include "writeback.h"
+#include "aio.h"
+#include "file_sys.h"
+#include "stripe.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+pthread_mutex_t fs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t wb_io_lock; // 快照到落盘之间持有，保证按快照顺序写入；可重入，取快照时可能淘汰脏帧
+static pthread_mutex_t wb_lock = PTHREAD_MUTEX_INITIALIZER;    // 保护下面的线程控制字段
+static pthread_cond_t wb_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t wb_done_cond = PTHREAD_COND_INITIALIZER; // 组提交落盘，唤醒等待的命令
+
+static wb_take_fn wb_take;      // 取快照函数
+static aio_ctx *wb_io;          // 回写使用的异步 I/O 上下文
+static pthread_t wb_thread;     // 回写线程
+static int wb_running;          // 回写线程是否在运行
+static int wb_stopping;         // 通知回写线程退出
+static int wb_kicked;           // 脏块比例超过阈值，立即回写
+static unsigned int wb_interval; // 回写间隔（毫秒），0 表示不定期回写
+static unsigned int wb_group;    // 组提交窗口（毫秒）
+static int wb_durable;           // 后台回写后是否 fsync
+static int wb_commit_pending;    // 有等待组提交的修改
+static struct timespec wb_commit_deadline; // 组提交窗口结束时间
+static unsigned long wb_commit_seq; // 最后一个组提交请求的序号
+static unsigned long wb_done_seq;   // 已经落盘的组提交请求序号，不超过它的请求都已 fsync
+static unsigned long wb_flushes; // 回写次数
+static unsigned long wb_blocks;  // 回写盘块数
+static unsigned long wb_bytes;   // 回写写入的数据字节数
+static unsigned long wb_commits; // 请求组提交的次数
+static unsigned long wb_fsyncs;  // fsync 次数
+
+/**
+ * 初始化回写模块，不启动回写线程，盘块通过 stripe 写入数据文件
+ * @param take 取脏块快照函数
+ * @return 0：成功；1：失败
+ */
+int wb_init(wb_take_fn take) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&wb_io_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    wb_take = take;
+    wb_io = aio_create(0, AIO_AUTO);
+    return wb_io == NULL;
+}
+
+/**
+ * 写入一批快照，连续的整块合并后按条带单元拆分，压缩块只写压缩后的字节并打洞，
+ * 所有数据文件上的请求同时在途，全部完成后返回
+ */
+static void write_batch(const wb_batch *batch) {
+    for (size_t i = 0; i < batch->size;) {
+        wb_bytes += batch->lens[i];
+        if (batch->lens[i] < BLOCK_SIZE) {
+            stripe_write_head(wb_io, batch->data + i * BLOCK_SIZE, batch->blocks[i], batch->lens[i]);
+            i++;
+            continue;
+        }
+
+        size_t j = i + 1;
+        while (j < batch->size && batch->blocks[j] == batch->blocks[j - 1] + 1 && batch->lens[j] == BLOCK_SIZE) {
+            wb_bytes += BLOCK_SIZE;
+            j++;
+        }
+        stripe_write(wb_io, batch->data + i * BLOCK_SIZE, batch->blocks[i], j - i);
+        i = j;
+    }
+    size_t side_off;
+    int side_fd = stripe_side(&side_off);
+    if (batch->side_size) aio_write(wb_io, side_fd, batch->side, batch->side_size, side_off);
+
+    if (aio_wait(wb_io)) {
+        perror("Data file write error!");
+        exit(EXIT_FAILURE);
+    }
+
+    wb_flushes++;
+    wb_blocks += batch->size;
+}
+
+/**
+ * 所有数据文件同时落盘
+ */
+static void sync_file(void) {
+    if (stripe_sync(wb_io)) {
+        perror("Data file sync error!");
+        exit(EXIT_FAILURE);
+    }
+    wb_fsyncs++;
+}
+
+/**
+ * 序号不超过 seq 的组提交请求都已落盘，唤醒等待的命令，调用时已持有 wb_lock
+ */
+static void commit_done(unsigned long seq) {
+    if (seq <= wb_done_seq) return;
+    wb_done_seq = seq;
+    pthread_cond_broadcast(&wb_done_cond);
+}
+
+/**
+ * 计算当前时间之后 ms 毫秒的时间点
+ */
+static struct timespec deadline_after(unsigned int ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (long) (ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    return deadline;
+}
+
+/**
+ * 时间点 a 是否早于 b
+ */
+static int time_before(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+static void free_batch(wb_batch *batch) {
+    free(batch->blocks);
+    free(batch->data);
+    free(batch->lens);
+    free(batch->side);
+    memset(batch, 0, sizeof(*batch));
+}
+
+static void *flusher(void *arg) {
+    pthread_mutex_lock(&wb_lock);
+    struct timespec next_flush = deadline_after(wb_interval); // 下一次定期回写的时间，只在回写后推迟
+    while (!wb_stopping) {
+        if (!wb_kicked) {
+            // 等到组提交窗口结束或下一次定期回写，取较早的一个；其他唤醒不改变这两个时间
+            int res = 0;
+            while (!wb_stopping && !wb_kicked && res != ETIMEDOUT) {
+                const struct timespec *deadline = wb_commit_pending ? &wb_commit_deadline : NULL;
+                if (wb_interval && (deadline == NULL || time_before(&next_flush, deadline))) deadline = &next_flush;
+                if (deadline != NULL) res = pthread_cond_timedwait(&wb_cond, &wb_lock, deadline);
+                else pthread_cond_wait(&wb_cond, &wb_lock);
+            }
+            if (wb_stopping) break;
+        }
+        wb_kicked = 0;
+        wb_commit_pending = 0; // 窗口内的所有修改共用这一次回写和 fsync
+        unsigned long seq = wb_commit_seq; // 这些请求的修改都在取快照之前完成，包含在这次回写中
+        pthread_mutex_unlock(&wb_lock);
+
+        // 持有 fs_lock 只取快照，写入时不阻塞命令循环
+        wb_batch batch = {0};
+        pthread_mutex_lock(&fs_lock);
+        pthread_mutex_lock(&wb_io_lock);
+        wb_take(&batch);
+        pthread_mutex_unlock(&fs_lock);
+        write_batch(&batch);
+        if (wb_durable) sync_file();
+        pthread_mutex_unlock(&wb_io_lock);
+        free_batch(&batch);
+
+        pthread_mutex_lock(&wb_lock);
+        if (wb_durable) commit_done(seq);
+        next_flush = deadline_after(wb_interval);
+    }
+    pthread_mutex_unlock(&wb_lock);
+    return arg;
+}
+
+/**
+ * 启动回写线程
+ * @param interval_ms 定期回写间隔（毫秒），0 表示只在脏块过多或组提交时回写
+ * @param group_ms 组提交窗口（毫秒）
+ * @param durable 后台回写后是否 fsync
+ * @return 0：成功；1：失败
+ */
+int wb_start(unsigned int interval_ms, unsigned int group_ms, int durable) {
+    wb_interval = interval_ms;
+    wb_group = group_ms;
+    wb_durable = durable;
+    wb_stopping = 0;
+    if (pthread_create(&wb_thread, NULL, flusher, NULL)) return 1;
+    wb_running = 1;
+    return 0;
+}
+
+/**
+ * 脏块比例超过阈值，通知回写线程立即回写，不等待
+ */
+void wb_kick(void) {
+    if (!wb_running) return;
+    pthread_mutex_lock(&wb_lock);
+    wb_kicked = 1;
+    pthread_cond_signal(&wb_cond);
+    pthread_mutex_unlock(&wb_lock);
+}
+
+/**
+ * 请求组提交，不等待：窗口内的后续请求共用同一次回写和 fsync。调用时需持有 fs_lock，修改已经完成
+ * @return 请求序号，释放 fs_lock 后交给 wb_wait 等待落盘；回写线程没有运行时为 0
+ */
+unsigned long wb_commit(void) {
+    if (!wb_running) return 0;
+    pthread_mutex_lock(&wb_lock);
+    wb_commits++;
+    unsigned long seq = ++wb_commit_seq;
+    if (!wb_commit_pending) { // 窗口从第一个请求开始计时
+        wb_commit_pending = 1;
+        wb_commit_deadline = deadline_after(wb_group);
+        pthread_cond_signal(&wb_cond);
+    }
+    pthread_mutex_unlock(&wb_lock);
+    return seq;
+}
+
+/**
+ * 等待组提交请求所在的那次回写 fsync 完成，调用时不能持有 fs_lock，否则回写线程无法取快照
+ * @param seq wb_commit 返回的请求序号，0 表示不需要等待
+ */
+void wb_wait(unsigned long seq) {
+    pthread_mutex_lock(&wb_lock);
+    while (wb_done_seq < seq) pthread_cond_wait(&wb_done_cond, &wb_lock);
+    pthread_mutex_unlock(&wb_lock);
+}
+
+/**
+ * 立即回写所有脏块并 fsync，等待落盘，调用时需持有 fs_lock；之前的组提交请求也随之落盘
+ */
+void wb_sync(void) {
+    pthread_mutex_lock(&wb_lock);
+    unsigned long seq = wb_commit_seq;
+    pthread_mutex_unlock(&wb_lock);
+
+    wb_batch batch = {0};
+    pthread_mutex_lock(&wb_io_lock); // 等待正在进行的回写完成
+    wb_take(&batch);
+    write_batch(&batch);
+    sync_file();
+    pthread_mutex_unlock(&wb_io_lock);
+    free_batch(&batch);
+
+    pthread_mutex_lock(&wb_lock);
+    commit_done(seq);
+    pthread_mutex_unlock(&wb_lock);
+}
+
+/**
+ * 开始直接写数据文件（如块缓存淘汰脏帧），等待正在进行的回写完成
+ */
+void wb_io_begin(void) {
+    pthread_mutex_lock(&wb_io_lock);
+}
+
+void wb_io_end(void) {
+    pthread_mutex_unlock(&wb_io_lock);
+}
+
+/**
+ * 获取回写统计信息
+ */
+void wb_get_stat(wb_stat *stat_ptr) {
+    pthread_mutex_lock(&wb_io_lock);
+    pthread_mutex_lock(&wb_lock);
+    stat_ptr->flushes = wb_flushes;
+    stat_ptr->blocks = wb_blocks;
+    stat_ptr->bytes = wb_bytes;
+    stat_ptr->commits = wb_commits;
+    stat_ptr->fsyncs = wb_fsyncs;
+    pthread_mutex_unlock(&wb_lock);
+    pthread_mutex_unlock(&wb_io_lock);
+}
+
+/**
+ * 停止回写线程，调用时不能持有 fs_lock
+ */
+void wb_stop(void) {
+    if (!wb_running) return;
+    pthread_mutex_lock(&wb_lock);
+    wb_stopping = 1;
+    pthread_cond_signal(&wb_cond);
+    pthread_mutex_unlock(&wb_lock);
+    pthread_join(wb_thread, NULL);
+    wb_running = 0;
+}
+
+void wb_destroy(void) {
+    wb_stop();
+    aio_destroy(wb_io);
+    wb_io = NULL;
+    pthread_mutex_destroy(&wb_io_lock);
+}
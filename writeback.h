@@ -0,0 +1,58 @@
+#ifndef FILE_SYSTEM_WRITEBACK_H
+#define FILE_SYSTEM_WRITEBACK_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * 后台回写：回写线程按固定间隔（或脏块比例超过阈值时）在 fs_lock 保护下取走脏块快照，释放 fs_lock 后再异步写入数据文件，
+ * 命令循环只在取快照时短暂等待，不会等待批量 I/O。
+ * 所有写数据文件的操作都要在 wb_io_begin / wb_io_end 之间进行，保证按快照顺序落盘。
+ * 组提交：wb_commit 在 fs_lock 内登记请求并返回序号，窗口内的所有请求共用一次回写和 fsync，命令释放 fs_lock 后
+ * 用 wb_wait 等到包含自己修改的那次 fsync 完成；wb_sync 立即回写并 fsync。
+ */
+
+typedef struct wb_batch {
+    unsigned short *blocks; // 脏块盘块号
+    char *data;             // 脏块数据，每块 BLOCK_SIZE 字节，与 blocks 一一对应
+    unsigned short *lens;   // 每个脏块要写入的字节数，压缩块只写压缩后的字节，其余部分打洞
+    size_t size;            // 脏块数量
+    char *side;             // 侧表快照
+    size_t side_size;       // 侧表字节数
+} wb_batch;
+
+typedef struct wb_stat {
+    unsigned long flushes; // 回写次数
+    unsigned long blocks;  // 回写盘块数
+    unsigned long bytes;   // 回写写入的数据字节数，压缩块只算压缩后的字节
+    unsigned long commits; // 请求组提交的次数
+    unsigned long fsyncs;  // fsync 次数
+} wb_stat;
+
+typedef void (*wb_take_fn)(wb_batch *batch); // 取脏块快照，调用时已持有 fs_lock
+
+extern pthread_mutex_t fs_lock; // 命令执行与取快照互斥
+
+int wb_init(wb_take_fn take);
+
+int wb_start(unsigned int interval_ms, unsigned int group_ms, int durable);
+
+void wb_kick(void);
+
+unsigned long wb_commit(void);
+
+void wb_wait(unsigned long seq);
+
+void wb_sync(void);
+
+void wb_io_begin(void);
+
+void wb_io_end(void);
+
+void wb_get_stat(wb_stat *stat_ptr);
+
+void wb_stop(void);
+
+void wb_destroy(void);
+
+#endif //FILE_SYSTEM_WRITEBACK_H